@@ -8,18 +8,20 @@
 #include <PxPhysicsAPI.h>
 
 #include "../network/util/reader.hpp"
-#include "../network/quic/client.hpp"
+#include "../network/transport.hpp"
 #include "../network/protocol/common.hpp"
+#include "../network/protocol/clock.hpp"
+#include "prediction.hpp"
+#include "playout.hpp"
 
 using std::mutex;
 using std::vector;
+using std::scoped_lock;
 using std::unordered_map;
 
 using namespace physx;
 
-class BaseClient : public QuicClient {
-	// Implemented in network/protocol/client-tick.cpp
-	void onData(string_view buffer);
+class BaseClient : public NetClient {
 	void onInput() {};
 
 	uint64_t last_packet;
@@ -27,6 +29,17 @@ class BaseClient : public QuicClient {
 	mutex m;
 
 protected:
+	// Implemented in network/protocol/client-tick.cpp
+	void onData(string_view buffer);
+
+	// Snapshot didn't match the local cache, the data array can't be trusted anymore.
+	// Called without the lock held, default bails out of the process
+	virtual void onDesync(const char* reason) {
+		printf("Desync: %s\n", reason);
+		disconnect();
+		exit(1);
+	}
+
 	class NetworkedObject;
 private:
 	struct NetworkData {
@@ -44,6 +57,8 @@ protected:
 	class NetworkedObject {
 		friend BaseClient;
 	protected:
+		PoseRing<8> poses;
+
 		virtual ~NetworkedObject() {};
 		virtual void onWake() {};
 		virtual void onSleep() {};
@@ -58,6 +73,8 @@ protected:
 		uint32_t pid;
 		PlayerState state;
 	protected:
+		PoseRing<8> poses;
+
 		NetworkedPlayer(uint32_t pid, const PlayerState& state) : pid(pid), state(state) {};
 		virtual ~NetworkedPlayer() {};
 		virtual void onState(const PlayerState& newState) {};
@@ -71,6 +88,10 @@ private:
 
 	uint32_t my_pid = 0;
 
+	Predictor predictor;
+	PlayoutClock playout;
+	ClockSync clock;
+
 public:
 	template<typename SyncCallback>
 	inline void syncObj(const SyncCallback& cb) {
@@ -110,6 +131,54 @@ public:
 
 	uint64_t lastPacketTime() { return last_packet; }
 
+	// Tags the input with a sequence number, applies it to the local prediction and sends it.
+	// Meant to be called once per server step (see inputInterval)
+	uint32_t sendInput(const PlayerInput& input);
+
+	// The server's step in ns, the rate to send inputs at. 0 until the first snapshot told us
+	uint64_t inputInterval() {
+		scoped_lock lock(m);
+		return uint64_t(double(predictor.dt) * 1e9);
+	}
+
+	// Server time (ms) to render remote state at, lags behind the newest snapshot by the
+	// adaptive playout delay. Use with the pose rings while holding the lock (syncObj/syncPlayer)
+	double renderTime();
+
+	// Smoothed round trip (ms) from the ping exchange, 0 until the first pong
+	double rtt() {
+		scoped_lock lock(m);
+		return clock.rttMs();
+	}
+
+	// Server steady clock minus ours (ms)
+	double clockOffset() {
+		scoped_lock lock(m);
+		return clock.offsetMs();
+	}
+
+	// Now on the server's steady clock (us), for anything that has to name a server moment
+	uint64_t serverTime() {
+		scoped_lock lock(m);
+		return clock.toRemote(ClockSync::now());
+	}
+
+	// What the transport itself measures (QUIC only, 0 otherwise), to cross-check rtt()
+	double transportRtt();
+
+	double playoutDelay() {
+		scoped_lock lock(m);
+		return playout.playoutDelay();
+	}
+
+	// Predicted position of the local player, false until the first snapshot arrived
+	bool predictedPosition(PxVec3& out) {
+		scoped_lock lock(m);
+		if (!predictor.ready()) return false;
+		out = predictor.position();
+		return true;
+	}
+
 	NetworkedPlayer* me() {
 		m.lock();
 		auto iter = player_map.find(my_pid);
@@ -2,7 +2,6 @@
 #include <uv.h>
 
 #include "gui.hpp"
-#include "../network/util/writer.hpp"
 
 void GUIClient::Cube::render() {
 	cube(halfExtents);
@@ -27,21 +26,24 @@ void GUIClient::render() {
 		glutWarpPointer(int(dim.x / 2), int(dim.y / 2));
 	}
 
-	float lerp = 0.f;
-	uint64_t lastPacket = lastPacketTime();
-
-	if (lastPacket) lerp = (uv_hrtime() - lastPacket) / MS_TO_NANO / 200.f;
-	lerp = min(lerp, 1.f);
+	// Remote state is drawn a playout delay behind the newest snapshot, see PlayoutClock
+	auto t = renderTime();
 
 	syncObj([&] (auto ptr) {
 		auto obj = static_cast<RenderableObject*>(ptr);
-		obj->update(1.f / 60, lerp);
+		obj->update(t);
 		render(obj);		
 	});
 
+	PxVec3 predicted;
+	bool predicting = predictedPosition(predicted);
+	auto self = me();
+
 	syncPlayer([&] (auto ptr) {
 		auto p = static_cast<RenderablePlayer*>(ptr);
-		p->update(1.f / 60, lerp);
+		p->update(t);
+		// Local player is drawn where the prediction says, not where the last snapshot was
+		if (predicting && ptr == self) p->currPos = predicted;
 		render(p);
 	});
 
@@ -100,6 +102,11 @@ void GUIClient::postRender() {
 		if (bandwidth < 2 * 1024 * 1024) stream << (bandwidth / 1024.f) << "KB/s";
 		else stream << (bandwidth / 1024.f / 1024.f) << "MB/s";
 	}
+	stream.precision(3);
+	stream << " | Delay: " << playoutDelay() << "ms";
+	stream << " | RTT: " << rtt() << "ms";
+	auto transport = transportRtt();
+	if (transport > 0) stream << " (QUIC " << transport << "ms)";
 	renderString(10, 40, 0, stream.str());
 
 	if (!roam) {
@@ -114,9 +121,7 @@ void GUIClient::postRender() {
 		input.dir = PxVec2(cam()->dir.x, cam()->dir.z);
 	}
 
-	Writer w;
-	w.write<PlayerInput>(input);
-	send(w.finalize(), true);
+	sendInput();
 }
 
 GUIClient::NetworkedObject* GUIClient::addObj(uint16_t type, uint16_t state, uint16_t flags, Reader& r) {
@@ -135,10 +140,20 @@ GUIClient::NetworkedObject* GUIClient::addObj(uint16_t type, uint16_t state, uin
 	return new RenderableObject();
 };
 
+// One input per predicted tick, key handlers only change the input state
 void GUIClient::sendInput() {
-	Writer w;
-	w.write<PlayerInput>(input);
-	send(w.finalize(), true);
+	auto now = uv_hrtime();
+	// Server's step, nothing goes out before the first snapshot
+	auto interval = inputInterval();
+	if (!interval) return;
+
+	// Fell too far behind (window dragged, breakpoint...), don't fast forward
+	if (!lastInput || now - lastInput > 10 * interval) lastInput = now - interval;
+
+	while (now - lastInput >= interval) {
+		BaseClient::sendInput(input);
+		lastInput += interval;
+	}
 }
 
 void GUIClient::onKeyUp(unsigned char k) {
@@ -184,8 +199,6 @@ void GUIClient::onKeyDown(unsigned char k) {
 			if (!roam) input.movR = true;
 			break;
 	}
-
-	sendInput();
 }
 
 void GUIClient::onSpecialKeyUp(int k) {
@@ -206,8 +219,6 @@ void GUIClient::onSpecialKeyDown(int k) {
 			input.movR = true;
 			break;
 	}
-
-	sendInput();
 }
 
 void GUIClient::onMouseButton(int button, int mode, int x, int y) {
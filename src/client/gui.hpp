@@ -44,12 +44,6 @@ class GUIClient : public BaseClient, public BaseRenderer {
 	class RenderableObject : public NetworkedObject {
 		bool sleeping = false;
 
-		PxVec3 prevPos;
-		PxVec3 netPos;
-
-		PxQuat prevQuat;
-		PxQuat netQuat;
-
 	protected:
 		void onWake() { 
 			sleeping = false; 
@@ -60,21 +54,12 @@ class GUIClient : public BaseClient, public BaseRenderer {
 		};
 
 		void onAdd(const PxVec3& pos, const PxQuat& quat) {
-			prevPos = currPos = netPos = pos;
-			prevQuat = currQuat = netQuat = quat;
+			currPos = pos;
+			currQuat = quat;
 
 			// printf("init pos: [%.4f,%.4f,%.4f]\n", pos.x, pos.y, pos.z);
 		};
 
-		void onUpdate(const PxVec3& pos, const PxQuat& quat) {
-			prevPos = currPos;
-			netPos = pos;
-			prevQuat = currQuat;
-			netQuat = quat;
-
-			// printf("update pos: [%.4f,%.4f,%.4f]\n", pos.x, pos.y, pos.z);
-		};
-
 		// TODO onRemove -> call subclass
 	public:
 		PxVec3 currPos;
@@ -82,41 +67,10 @@ class GUIClient : public BaseClient, public BaseRenderer {
 
 		bool isSleeping() { return sleeping; };
 
-		// Called from render thread, remember to wrap this in sync to prevent racing with quic thread
-		virtual void update(float dt, float lerp) {
-			if (sleeping) {
-				currPos = netPos;
-				currQuat = netQuat;
-			} else {
-				currPos = prevPos + (netPos - prevPos) * lerp;
-
-				auto& q1 = prevQuat;
-				auto& q2 = netQuat;
-				auto& out = currQuat;
-
-				// slerp
-				float dot = q1.dot(q2);
-				float cosom = fabsf(dot);
-				float s0, s1;
-
-				if (cosom < 0.9999f) {
-					const float omega = acosf(cosom);
-					const float invsin = 1.f / sinf(omega);
-					s0 = sinf((1.f - lerp) * omega) * invsin;
-					s1 = sin(lerp * omega) * invsin;
-				} else {
-					s0 = 1 - lerp;
-					s1 = lerp;
-				}
-
-				s1 = dot >= 0 ? s1 : -s1;
-
-				out.x = s0 * q1.x + s1 * q2.x;
-				out.y = s0 * q1.y + s1 * q2.y;
-				out.z = s0 * q1.z + s1 * q2.z;
-				out.w = s0 * q1.w + s1 * q2.w;
-				out.normalize();
-			}
+		// Called from render thread, remember to wrap this in sync to prevent racing with quic thread.
+		// t is the server time (ms) to show, see BaseClient::renderTime
+		virtual void update(double t) {
+			poses.sample(t, currPos, currQuat);
 		};
 
 		virtual void render() {};
@@ -154,8 +108,9 @@ class GUIClient : public BaseClient, public BaseRenderer {
 			onAdd(state.position, PLAYER_QUAT);
 		};
 
-		void onState(const PlayerState& state) {
-			onUpdate(state.position, PLAYER_QUAT);
+		void update(double t) {
+			NetworkedPlayer::poses.sample(t, currPos, currQuat);
+			currQuat = PLAYER_QUAT;
 		};
 
 		PxVec3 position() { return currPos; }
@@ -171,6 +126,7 @@ class GUIClient : public BaseClient, public BaseRenderer {
 	virtual NetworkedPlayer* addPlayer(uint32_t pid, const PlayerState& state) { return new RenderablePlayer(pid, state); }
 
 	PlayerInput input;
+	uint64_t lastInput = 0;
 
 	void onKeyUp(unsigned char k);
 	void onKeyDown(unsigned char k);
@@ -178,6 +134,7 @@ class GUIClient : public BaseClient, public BaseRenderer {
 	void onSpecialKeyDown(int k);
 	void onKeyHold(unsigned char k);
 
+	using BaseClient::sendInput;
 	void sendInput();
 
 	void render(RenderableObject* obj);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include <PxPhysicsAPI.h>
+
+using namespace physx;
+
+inline PxQuat slerp(const PxQuat& q1, const PxQuat& q2, float t) {
+	float dot = q1.dot(q2);
+	float cosom = fabsf(dot);
+	float s0, s1;
+
+	if (cosom < 0.9999f) {
+		const float omega = acosf(cosom);
+		const float invsin = 1.f / sinf(omega);
+		s0 = sinf((1.f - t) * omega) * invsin;
+		s1 = sinf(t * omega) * invsin;
+	} else {
+		s0 = 1 - t;
+		s1 = t;
+	}
+
+	s1 = dot >= 0 ? s1 : -s1;
+
+	PxQuat out(s0 * q1.x + s1 * q2.x, s0 * q1.y + s1 * q2.y, s0 * q1.z + s1 * q2.z, s0 * q1.w + s1 * q2.w);
+	out.normalize();
+	return out;
+}
+
+// Last few poses of something, stamped with the server time of the snapshot they came in
+template<size_t N>
+class PoseRing {
+	struct Pose {
+		double time;
+		PxVec3 pos;
+		PxQuat quat;
+	};
+
+	Pose poses[N];
+	size_t head = 0; // next write
+	size_t count = 0;
+
+	const Pose& at(size_t i) const { return poses[(head + N - count + i) % N]; } // 0 = oldest
+
+public:
+	void push(double time, const PxVec3& pos, const PxQuat& quat) {
+		poses[head] = { time, pos, quat };
+		head = (head + 1) % N;
+		count = std::min(count + 1, N);
+	}
+
+	void reset(double time, const PxVec3& pos, const PxQuat& quat) {
+		count = 0;
+		push(time, pos, quat);
+	}
+
+	bool empty() const { return !count; };
+
+	// Interpolates between the two poses bracketing t, holds the oldest/newest outside of them
+	void sample(double t, PxVec3& pos, PxQuat& quat) const {
+		if (!count) return;
+
+		if (t >= at(count - 1).time) {
+			pos = at(count - 1).pos;
+			quat = at(count - 1).quat;
+			return;
+		}
+
+		for (size_t i = count - 1; i > 0; i--) {
+			auto& a = at(i - 1);
+			auto& b = at(i);
+			if (t < a.time) continue;
+
+			auto span = b.time - a.time;
+			auto alpha = span > 0 ? float((t - a.time) / span) : 1.f;
+			pos = a.pos + (b.pos - a.pos) * alpha;
+			quat = slerp(a.quat, b.quat, alpha);
+			return;
+		}
+
+		pos = at(0).pos;
+		quat = at(0).quat;
+	}
+};
+
+// Adaptive playout delay. Tracks snapshot arrival jitter (RFC 3550 style, clock offset cancels
+// out) and renders far enough behind the newest snapshot that there's nearly always a later
+// one to interpolate towards. All times in ms
+class PlayoutClock {
+	static constexpr uint32_t WINDOW = 64;
+
+	bool started = false;
+	double lastRemote = 0, lastTransit = 0;
+
+	// Lowest transit (local - remote) seen over the last two windows: latency + clock offset
+	double transitFloor = 0, windowMin = 0, prevWindowMin = 0;
+	uint32_t windowCount = 0;
+
+	double interval = 100.0;
+	double jitter = 0;
+	double delay = 100.0;
+
+public:
+	double jitterScale = 3.0;
+	double minDelay = 0.0;
+	double maxDelay = 500.0;
+
+	void onSnapshot(double remote, double local) {
+		auto transit = local - remote;
+
+		if (!started) {
+			started = true;
+			transitFloor = windowMin = prevWindowMin = transit;
+		} else {
+			auto gap = remote - lastRemote;
+			if (gap > 0) interval += (gap - interval) / 16;
+			jitter += (fabs(transit - lastTransit) - jitter) / 16;
+		}
+
+		windowMin = std::min(windowMin, transit);
+		if (++windowCount >= WINDOW) {
+			prevWindowMin = windowMin;
+			windowMin = transit;
+			windowCount = 0;
+		}
+		transitFloor = std::min(windowMin, prevWindowMin);
+
+		lastRemote = remote;
+		lastTransit = transit;
+
+		// Ease towards the target so render time never jumps
+		auto target = std::clamp(interval + jitterScale * jitter, minDelay, maxDelay);
+		delay += (target - delay) * 0.1;
+	}
+
+	// Server time to render at
+	double renderTime(double local) const { return local - transitFloor - delay; };
+
+	double playoutDelay() const { return delay; };
+	double jitterMs() const { return jitter; };
+	double intervalMs() const { return interval; };
+};
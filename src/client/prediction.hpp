@@ -0,0 +1,78 @@
+#pragma once
+
+#include <deque>
+
+#include "../world/movement.hpp"
+
+// Client side replica of the local player's movement. Inputs are applied as soon as they're
+// sent, then replayed on top of every authoritative state from the server (rewinding to the
+// last input the server acknowledged). There is no collision data on the client, the only
+// obstacle it knows about is the ground height the server last reported
+class Predictor {
+	struct Pending {
+		uint32_t seq;
+		PlayerInput input;
+	};
+
+	std::deque<Pending> pending;
+	uint32_t seq = 0;
+
+	PlayerState state;
+	uint64_t tick = 0;
+	float groundY = 0.f;
+	bool synced = false;
+
+	// Visual offset left over from the last correction, decays every step
+	PxVec3 smoothing = PxZero;
+
+	void step(const PlayerInput& input) {
+		auto move = movement::intent(input, state, tick);
+		auto position = state.position + move * dt;
+
+		bool down = position.y <= groundY;
+		if (down) position.y = groundY;
+
+		movement::land(state, position, down, tick);
+		tick++;
+	}
+
+public:
+	static constexpr size_t MAX_PENDING = 256;
+	static constexpr float SNAP_DISTANCE = 2.f;
+
+	// Seconds per server step, from the snapshots (0 until the first one). The server applies one
+	// input per step, clients send at this rate
+	float dt = 0.f;
+
+	// Applies the input locally, returns the sequence number to send it with
+	uint32_t push(const PlayerInput& input) {
+		pending.push_back({ ++seq, input });
+		if (pending.size() > MAX_PENDING) pending.pop_front();
+
+		if (synced) step(input);
+		smoothing *= 0.8f;
+		return seq;
+	}
+
+	// serverTick is the tick the server will simulate next, ack the last input it simulated
+	void reconcile(uint32_t ack, const PlayerState& server, uint64_t serverTick) {
+		while (!pending.empty() && pending.front().seq <= ack) pending.pop_front();
+
+		auto before = state.position;
+
+		state = server;
+		tick = serverTick;
+		if (server.ground) groundY = server.position.y;
+
+		for (auto& p : pending) step(p.input);
+
+		if (synced) smoothing += before - state.position;
+		if (smoothing.magnitude() > SNAP_DISTANCE) smoothing = PxZero;
+		synced = true;
+	}
+
+	bool ready() { return synced; };
+	PxVec3 position() { return state.position + smoothing; };
+	const PlayerState& current() { return state; };
+	size_t unacknowledged() { return pending.size(); };
+};
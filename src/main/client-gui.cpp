@@ -1,5 +1,6 @@
 #include "../misc/repl.hpp"
 #include "../client/gui.hpp"
+#include "../network/quic/client.hpp"
 
 int main(int argc, char** argv) {
 	auto error = QuicClient::init(true);
@@ -8,7 +9,7 @@ int main(int argc, char** argv) {
 	glutInit(&argc, argv);
 
 	auto client = new GUIClient();
-	client->connect("localhost", 6969);
+	QuicClient::connect(client, "localhost", 6969);
 	client->loop();
 
 	delete client;
@@ -1,16 +1,357 @@
+#include <uv.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string>
+#include <cstring>
+#include <fstream>
+
+#include "../misc/stats.hpp"
 #include "../client/base.hpp"
+#include "../network/quic/client.hpp"
+#include "../network/uv/tcp.hpp"
+#include "../network/uv/udp.hpp"
+
+using namespace std::chrono;
+
+// One step of a scripted input sequence, e.g. "fj 500 90" = forward + jump for 500ms facing 90 degrees
+struct ScriptStep {
+	PlayerInput input;
+	uint64_t ms;
+};
+
+static vector<ScriptStep> loadScript(const char* path) {
+	vector<ScriptStep> steps;
+	std::ifstream file(path);
+	string keys;
+	uint64_t ms;
+	float degrees;
+
+	while (file >> keys >> ms >> degrees) {
+		ScriptStep step;
+		step.input.movF = keys.find('f') != string::npos;
+		step.input.movB = keys.find('b') != string::npos;
+		step.input.movL = keys.find('l') != string::npos;
+		step.input.movR = keys.find('r') != string::npos;
+		step.input.jump = keys.find('j') != string::npos;
+		step.input.dir = PxVec2(cosf(degrees * PxPi / 180.f), sinf(degrees * PxPi / 180.f));
+		step.ms = std::max<uint64_t>(1, ms);
+		steps.push_back(step);
+	}
+
+	return steps;
+}
+
+// Decodes every snapshot like a real client and keeps timings for the report
+class SwarmBot : public BaseClient {
+	std::mt19937 gen;
+	const vector<ScriptStep>& script;
+	size_t step = 0;
+	uint64_t stepEnd = 0;
+	uint64_t lastInput = 0; // ns, per step mode
+
+	uint64_t lastArrival = 0;
+	float lastGap = -1.f;
+
+	void onData(string_view buffer) {
+		auto start = uv_hrtime();
+		BaseClient::onData(buffer);
+		auto end = uv_hrtime();
+
+		scoped_lock lock(stats_mutex);
+		decode.add((end - start) / 1000000.f);
+		bytes += buffer.size();
+		packets++;
+
+		// RFC 3550 style: variation between consecutive inter-arrival gaps
+		if (lastArrival) {
+			auto gap = (start - lastArrival) / 1000000.f;
+			if (lastGap >= 0.f) jitter.add(fabsf(gap - lastGap));
+			lastGap = gap;
+		}
+		lastArrival = start;
+	}
+
+	void onDesync(const char* reason) {
+		desyncs++;
+		disconnect();
+	}
+
+	void onConnect() { connected = true; }
+	void onDisconnect() { connected = false; }
+
+public:
+	mutex stats_mutex; // Guards the samples and counters below
+	Samples decode;
+	Samples jitter;
+	uint64_t bytes = 0;
+	uint64_t packets = 0;
+
+	atomic<bool> connected = false;
+	atomic<uint32_t> desyncs = 0;
+
+	SwarmBot(uint32_t seed, const vector<ScriptStep>& script) : gen(seed), script(script) {
+		// Don't march in lockstep
+		if (!script.empty()) step = gen() % script.size();
+	};
+
+	// Per step: catches up to one input per server step (the server applies one per step, and
+	// doesn't move a player that has none queued). Otherwise exactly one input per call
+	void sendInput(uint64_t nowMs, bool perStep) {
+		if (!isConnected()) return;
+		if (!perStep) {
+			sendOne(nowMs);
+			return;
+		}
+
+		auto interval = inputInterval();
+		if (!interval) return;
+
+		auto now = uv_hrtime();
+		if (!lastInput || now - lastInput > 10 * interval) lastInput = now - interval;
+		while (now - lastInput >= interval) {
+			sendOne(nowMs);
+			lastInput += interval;
+		}
+	}
+
+	void sendOne(uint64_t nowMs) {
+		PlayerInput input;
+		if (script.empty()) {
+			std::uniform_int_distribution<int> coin(0, 7);
+			std::uniform_real_distribution<float> angle(0.f, 2 * PxPi);
+			input.movF = coin(gen) < 5;
+			input.movB = !input.movF && !coin(gen);
+			input.movL = coin(gen) == 1;
+			input.movR = coin(gen) == 2;
+			input.jump = coin(gen) == 3;
+			auto a = angle(gen);
+			input.dir = PxVec2(cosf(a), sinf(a));
+		} else {
+			if (nowMs >= stepEnd) {
+				step = (step + 1) % script.size();
+				stepEnd = nowMs + script[step].ms;
+			}
+			input = script[step].input;
+		}
+
+		BaseClient::sendInput(input);
+	}
+};
+
+struct Options {
+	string transport = "quic";
+	string host = "localhost";
+	uint16_t port = 6969;
+	uint32_t bots = 1;
+	uint32_t threads = 0;
+	uint32_t rate = 0; // Hz, 0 = one input per server step
+	uint32_t seed = 6969;
+	float seconds = 0.f;
+	const char* script = nullptr;
+};
+
+// Connections are spread over a pool of loop threads, each one sends input for its own bots
+struct Worker {
+	uv_loop_t loop;
+	uv_timer_t input;
+	uv_async_t stop;
+	bool perStep = true;
+	vector<SwarmBot*> bots;
+	std::thread thread;
+
+	static void input_cb(uv_timer_t* timer) {
+		auto self = static_cast<Worker*>(timer->data);
+		auto now = uv_now(&self->loop);
+		for (auto bot : self->bots) bot->sendInput(now, self->perStep);
+	}
+
+	static void stop_cb(uv_async_t* handle) {
+		auto self = static_cast<Worker*>(handle->data);
+		for (auto bot : self->bots) bot->disconnect();
+		uv_timer_stop(&self->input);
+		uv_close((uv_handle_t*) &self->input, nullptr);
+		uv_close((uv_handle_t*) &self->stop, nullptr);
+	}
+
+	void start(const Options& opt) {
+		uv_loop_init(&loop);
+		uv_timer_init(&loop, &input);
+		input.data = this;
+		uv_async_init(&loop, &stop, stop_cb);
+		stop.data = this;
+
+		// uv links are connected from the thread that runs their loop
+		thread = std::thread([this, &opt] {
+			for (auto bot : bots) {
+				if (opt.transport == "tcp") TcpClient::connect(bot, &loop, opt.host, opt.port);
+				else if (opt.transport == "udp") UdpClient::connect(bot, &loop, opt.host, opt.port);
+				else QuicClient::connect(bot, opt.host, opt.port);
+			}
+
+			// Per step, poll often enough that no bot falls a step behind for long
+			perStep = !opt.rate;
+			auto every = perStep ? 5 : std::max<uint64_t>(1, 1000 / opt.rate);
+			uv_timer_start(&input, input_cb, every, every);
+
+			uv_run(&loop, UV_RUN_DEFAULT);
+			uv_loop_close(&loop);
+		});
+	}
+};
+
+static void usage() {
+	printf("usage: client-headless [--transport quic|tcp|udp] [--host H] [--port N]\n"
+		   "                       [--bots N] [--threads N] [--rate Hz] [--seed N]\n"
+		   "                       [--script file] [--seconds N]\n"
+		   "script lines: <keys fblrj or -> <ms> <degrees>\n"
+		   "--rate 0 (default) sends one input per server step. A lower fixed rate leaves bots\n"
+		   "standing still on the steps in between, the server applies one input per step\n");
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (arg == "--help" || arg == "-h" || !value) {
+			usage();
+			return arg == "--help" || arg == "-h" ? 0 : 1;
+		}
+
+		i++;
+		if (arg == "--transport") opt.transport = value;
+		else if (arg == "--host") opt.host = value;
+		else if (arg == "--port") opt.port = uint16_t(std::stoul(value));
+		else if (arg == "--bots") opt.bots = std::max<uint32_t>(1, std::stoul(value));
+		else if (arg == "--threads") opt.threads = std::stoul(value);
+		else if (arg == "--rate") opt.rate = std::stoul(value);
+		else if (arg == "--seed") opt.seed = std::stoul(value);
+		else if (arg == "--script") opt.script = value;
+		else if (arg == "--seconds") opt.seconds = std::stof(value);
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	vector<ScriptStep> script;
+	if (opt.script) {
+		script = loadScript(opt.script);
+		if (script.empty()) {
+			printf("[swarm] empty or unreadable script: %s\n", opt.script);
+			return 1;
+		}
+	}
+
+	if (opt.transport == "quic") {
+		auto error = QuicClient::init(true);
+		if (error) return error;
+	}
+
+	if (!opt.threads) opt.threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+	opt.threads = std::min(opt.threads, opt.bots);
+
+	std::mt19937 gen(opt.seed);
+	vector<SwarmBot*> bots;
+	vector<Worker*> workers;
+
+	for (uint32_t i = 0; i < opt.threads; i++) workers.push_back(new Worker());
+	for (uint32_t i = 0; i < opt.bots; i++) {
+		auto bot = new SwarmBot(gen(), script);
+		bots.push_back(bot);
+		workers[i % opt.threads]->bots.push_back(bot);
+	}
+
+	if (opt.rate) printf("[swarm] %u bots over %s on %u threads, input @ %uHz\n",
+		opt.bots, opt.transport.c_str(), opt.threads, opt.rate);
+	else printf("[swarm] %u bots over %s on %u threads, input every server step\n",
+		opt.bots, opt.transport.c_str(), opt.threads);
+
+	for (auto w : workers) w->start(opt);
+
+	// Report every second until the time is up (or enter is pressed)
+	atomic<bool> quit = false;
+	std::thread input;
+	if (opt.seconds <= 0.f) input = std::thread([&] { getchar(); quit = true; });
+
+	Samples decode("decode"), jitter("jitter"), rtt("rtt");
+	uint64_t bytes = 0, packets = 0;
+
+	auto start = steady_clock::now();
+	auto last = start;
+
+	while (!quit) {
+		std::this_thread::sleep_for(milliseconds(1000));
+
+		Samples decodeSec, jitterSec, rttSec, transportSec;
+		uint64_t bytesSec = 0, packetsSec = 0;
+		uint32_t connected = 0, desyncs = 0;
+
+		for (auto bot : bots) {
+			scoped_lock lock(bot->stats_mutex);
+			decodeSec.merge(bot->decode);
+			jitterSec.merge(bot->jitter);
+			bytesSec += bot->bytes;
+			packetsSec += bot->packets;
+			bot->decode.clear();
+			bot->jitter.clear();
+			bot->bytes = bot->packets = 0;
+			connected += bot->connected;
+			desyncs += bot->desyncs;
+		}
+
+		// Outside the stats lock, these take the client lock
+		for (auto bot : bots) {
+			if (!bot->connected) continue;
+			auto r = bot->rtt();
+			if (r > 0) rttSec.add(float(r));
+			auto t = bot->transportRtt();
+			if (t > 0) transportSec.add(float(t));
+		}
+
+		auto now = steady_clock::now();
+		auto sec = duration<float>(now - last).count();
+		last = now;
+
+		printf("[swarm] %4u/%u up | %7.2f KB/s | %6.1f pkt/s | decode p50 %.3fms p99 %.3fms | jitter p50 %.2fms p99 %.2fms | rtt p50 %.2fms p99 %.2fms (transport p50 %.2fms) | desync %u\n",
+			connected, opt.bots, bytesSec / sec / 1024, packetsSec / sec,
+			decodeSec.percentile(50), decodeSec.percentile(99),
+			jitterSec.percentile(50), jitterSec.percentile(99),
+			rttSec.percentile(50), rttSec.percentile(99), transportSec.percentile(50), desyncs);
+
+		decode.merge(decodeSec);
+		jitter.merge(jitterSec);
+		rtt.merge(rttSec);
+		bytes += bytesSec;
+		packets += packetsSec;
+
+		if (opt.seconds > 0.f && duration<float>(now - start).count() >= opt.seconds) quit = true;
+	}
 
-int main() {
-	auto error = QuicClient::init(true);
-	if (error) return error;
+	auto total = duration<float>(steady_clock::now() - start).count();
+	uint32_t desyncs = 0;
+	for (auto bot : bots) desyncs += bot->desyncs;
 
-	auto client = new BaseClient();
+	printf("[swarm] %.1fs, %lu packets, %.2f KB/s total, desyncs: %u\n",
+		total, packets, bytes / total / 1024, desyncs);
+	Samples::csvHeader();
+	decode.csv();
+	jitter.csv();
+	rtt.csv();
 
-	client->connect("localhost", 6969);
+	for (auto w : workers) uv_async_send(&w->stop);
+	for (auto w : workers) {
+		w->thread.join();
+		delete w;
+	}
+	if (input.joinable()) input.join();
 
-	// connect is not blocking
-	getchar();
-	delete client;
+	for (auto bot : bots) delete bot;
 
-	QuicClient::cleanup();
-}
\ No newline at end of file
+	if (opt.transport == "quic") QuicClient::cleanup();
+}
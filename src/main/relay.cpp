@@ -0,0 +1,89 @@
+#include <string>
+
+#include "../misc/repl.hpp"
+#include "../relay/relay.hpp"
+#include "../network/quic/server.hpp"
+#include "../network/quic/client.hpp"
+#include "../network/uv/tcp.hpp"
+#include "../network/uv/udp.hpp"
+
+int main(int argc, char** argv) {
+    // Upstream is the sim host (or another relay), or with a bus name the sim process on this machine
+    string bus;
+    string upstreamTransport = "quic";
+    string upstreamHost = "localhost";
+    uint16_t upstreamPort = 6969;
+    string transport = "quic";
+    uint16_t port = 7969;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--bus" && value) bus = argv[++i];
+        else if (arg == "--upstream-transport" && value) upstreamTransport = argv[++i];
+        else if (arg == "--upstream-host" && value) upstreamHost = argv[++i];
+        else if (arg == "--upstream-port" && value) upstreamPort = uint16_t(std::stoul(argv[++i]));
+        else if (arg == "--transport" && value) transport = argv[++i];
+        else if (arg == "--port" && value) port = uint16_t(std::stoul(argv[++i]));
+        else {
+            printf("usage: relay [--upstream-transport quic|tcp] [--upstream-host H] [--upstream-port N]\n"
+                   "             [--bus NAME] [--transport quic|tcp|udp] [--port N]\n");
+            return 1;
+        }
+    }
+
+    if (transport == "quic") {
+        auto error = QuicServer::init();
+        if (error) return error;
+    }
+    if (bus.empty() && upstreamTransport == "quic") {
+        auto error = QuicClient::init(true);
+        if (error) return error;
+    }
+
+    SnapshotBus* shm = nullptr;
+    Relay* relay;
+    if (!bus.empty()) {
+        if (!(shm = SnapshotBus::open(bus))) return 1;
+        relay = new Relay(shm);
+        if (!relay->start()) return 1;
+    } else {
+        relay = new Relay();
+        if (upstreamTransport == "tcp") TcpClient::connect(relay->upstreamClient(), uv_default_loop(), upstreamHost, upstreamPort);
+        else QuicClient::connect(relay->upstreamClient(), upstreamHost, upstreamPort);
+    }
+
+    QuicServer* quic = nullptr;
+    TcpServer* tcp = nullptr;
+    UdpServer* udp = nullptr;
+
+    bool listening;
+    if (transport == "tcp") listening = (tcp = new TcpServer(relay))->listen(port);
+    else if (transport == "udp") listening = (udp = new UdpServer(relay))->listen(port);
+    else listening = (quic = new QuicServer(relay))->listen(port);
+    if (!listening) return 1;
+
+    if (shm) printf("[relay] bus %s -> :%u (%s)\n", bus.c_str(), port, transport.c_str());
+    else printf("[relay] %s:%u (%s) -> :%u (%s)\n", upstreamHost.c_str(), upstreamPort,
+        upstreamTransport.c_str(), port, transport.c_str());
+
+    repl::onCommand = [relay](string_view line) {
+        if (line == "stats") relay->print();
+        else if (line == "clients") printf("[repl] %zu clients\n", relay->clientCount());
+        else if (!line.empty()) printf("[repl] unknown command\n");
+    };
+    repl::run();
+
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+
+    delete quic;
+    delete tcp;
+    delete udp;
+    delete relay;
+    delete shm;
+
+    if (bus.empty() && upstreamTransport == "quic") QuicClient::cleanup();
+    if (transport == "quic") QuicServer::cleanup();
+    return 0;
+}
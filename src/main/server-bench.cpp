@@ -0,0 +1,305 @@
+#include <chrono>
+#include <string>
+#include <cstring>
+
+#include "../misc/stats.hpp"
+#include "../world/world.hpp"
+#include "../server/game.hpp"
+#include "../server/bot.hpp"
+#include "../client/base.hpp"
+#include "../network/loopback/loopback.hpp"
+
+using namespace std::chrono;
+
+// Full client over the loopback transport, decodes every snapshot
+struct BenchClient : BaseClient {
+    std::mt19937 gen;
+
+    BenchClient(uint32_t seed) : gen(seed) {};
+
+    void sendInput() {
+        std::uniform_int_distribution<int> coin(0, 3);
+
+        PlayerInput input;
+        input.movF = coin(gen);
+        input.jump = !coin(gen);
+        input.dir = PxVec2(1.f, 0.f);
+
+        BaseClient::sendInput(input);
+    }
+};
+
+static void usage() {
+    printf("usage: server-bench [--ticks N] [--warmup N] [--cubes N] [--per-tick N]\n"
+           "                    [--shape box|sphere|capsule|mixed] [--players N]\n"
+           "                    [--bot-behavior wander|jump|follow] [--bot-encode]\n"
+           "                    [--spread m] [--serial-controllers]\n"
+           "                    [--rewind N] [--rewind-ticks N] [--queries N]\n"
+           "                    [--report-contacts none|players|all]\n"
+           "                    [--regions CxR] [--region-size m] [--region-margin m]\n"
+           "                    [--freeze-radius m] [--freeze-sleep]\n"
+           "                    [--seed N] [--tick-ms N] [--net-ms N] [--net-burst] [--format csv|json]\n"
+           "                    [--clients N] [--latency ms] [--jitter ms] [--loss 0..1]\n");
+}
+
+int main(int argc, char** argv) {
+    uint64_t ticks = 1000;
+    uint64_t warmup = 100;
+    uint32_t players = 0;
+    auto behavior = BotPlayer::WANDER;
+    bool encode = false;
+    bool serialControllers = false;
+    bool netBurst = false;      // every player encodes on the same step instead of spread out
+    float spread = 0.f; // half width of the bot spawn square, 0 = scale with the count
+    uint32_t seed = 6969;
+    uint64_t tickMs = 20;
+    uint64_t netMs = 100;
+    bool json = false;
+    uint32_t rewinds = 0;    // lag compensated raycasts per tick
+    uint64_t rewindTicks = 5; // how far back they look
+    uint32_t queries = 0;     // batched scene queries per tick, split evenly into raycasts/sweeps/overlaps
+    string reports = "none";  // contact reports: none, players (vs everything) or all pairs
+
+    uint32_t clients = 0;
+    LoopbackConfig link;
+
+    SpawnConfig spawner;
+    PartitionConfig partition;
+    ActivationConfig activation;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--bot-encode" || arg == "--serial-controllers" || arg == "--net-burst" || arg == "--freeze-sleep") {
+            if (arg == "--bot-encode") encode = true;
+            else if (arg == "--net-burst") netBurst = true;
+            else if (arg == "--freeze-sleep") activation.kinematic = false;
+            else serialControllers = true;
+            continue;
+        }
+
+        if (arg == "--help" || arg == "-h" || !value) {
+            usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+
+        i++;
+        if (arg == "--ticks") ticks = std::stoull(value);
+        else if (arg == "--warmup") warmup = std::stoull(value);
+        else if (arg == "--cubes") spawner.total = uint16_t(std::stoul(value));
+        else if (arg == "--per-tick") spawner.perTick = uint16_t(std::stoul(value));
+        else if (arg == "--players") players = std::stoul(value);
+        else if (arg == "--spread") spread = std::stof(value);
+        else if (arg == "--seed") seed = std::stoul(value);
+        else if (arg == "--tick-ms") tickMs = std::stoull(value);
+        else if (arg == "--net-ms") netMs = std::stoull(value);
+        else if (arg == "--format") json = !strcmp(value, "json");
+        else if (arg == "--rewind") rewinds = std::stoul(value);
+        else if (arg == "--rewind-ticks") rewindTicks = std::stoull(value);
+        else if (arg == "--queries") queries = std::stoul(value);
+        else if (arg == "--report-contacts") reports = value;
+        else if (arg == "--regions") sscanf(value, "%ux%u", &partition.cols, &partition.rows);
+        else if (arg == "--region-size") partition.size = std::stof(value);
+        else if (arg == "--region-margin") partition.margin = std::stof(value);
+        else if (arg == "--freeze-radius") {
+            activation.enabled = true;
+            activation.radius = std::stof(value);
+        }
+        else if (arg == "--clients") clients = std::stoul(value);
+        else if (arg == "--latency") link.latencyNano = uint64_t(std::stod(value) * 1000000);
+        else if (arg == "--jitter") link.jitterNano = uint64_t(std::stod(value) * 1000000);
+        else if (arg == "--loss") link.loss = std::stof(value);
+        else if (arg == "--shape") {
+            if (!strcmp(value, "box")) spawner.shape = BOX_T;
+            else if (!strcmp(value, "sphere")) spawner.shape = SPH_T;
+            else if (!strcmp(value, "capsule")) spawner.shape = CPS_T;
+            else spawner.shape = UNK_T;
+        } else if (arg == "--bot-behavior") {
+            if (!BotPlayer::parse(value, behavior)) {
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    auto error = World::init();
+    if (error) return error;
+
+    // No listener, clients (if any) go through the loopback transport
+    auto server = new PhysXServer();
+    auto world = server->world;
+    world->seed(seed);
+    world->spawner = spawner;
+    world->controllers.parallel = !serialControllers;
+    world->activation = activation;
+    if (!world->partition(partition)) {
+        usage();
+        return 1;
+    }
+
+    // Before anyone spawns, players pick their phase of the interval on the way in
+    const uint64_t netEvery = std::max<uint64_t>(1, netMs / std::max<uint64_t>(1, tickMs));
+    world->netEvery = uint32_t(netEvery);
+    world->netStagger = !netBurst;
+    if (reports == "all") world->reportContacts(GROUP_ALL, GROUP_ALL);
+    else if (reports == "players") world->reportContacts(GROUP_PLAYER, GROUP_ALL);
+    world->initScene();
+
+    // Roughly constant density (~4m^2 per bot) unless told otherwise
+    if (spread <= 0.f) spread = std::max(20.f, sqrtf(float(players)));
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> area(-spread, spread);
+
+    // Bots pick their input (and optionally encode a snapshot) in updateNet
+    for (uint32_t i = 0; i < players; i++) {
+        auto bot = new BotPlayer(i, behavior, gen(), encode);
+        world->spawn(bot, PxVec3(area(gen), 5.f, area(gen)));
+    }
+
+    link.seed = seed;
+    auto hub = new LoopbackHub(server, link);
+
+    vector<BenchClient*> remotes;
+    for (uint32_t i = 0; i < clients; i++) {
+        auto client = new BenchClient(gen());
+        hub->connect(client);
+        remotes.push_back(client);
+    }
+
+    const uint64_t tickNano = tickMs * MS_TO_NANO;
+    const float dt = tickNano / 1000000000.f;
+
+    Samples updatePlayers("updatePlayers", ticks);
+    Samples simulate("simulate", ticks);
+    Samples fetchResults("fetchResults", ticks);
+    Samples updateNet("updateNet", ticks);
+    Samples gc("gc", ticks);
+    Samples history("history", ticks);
+    Samples rewind("rewind", ticks);
+    Samples sceneQueries("queries", ticks);
+    QueryBatch batch;
+    uint64_t contactEvents = 0;
+    Samples transport("transport", ticks);
+    Samples total("total", ticks);
+
+    auto elapsed = [](high_resolution_clock::time_point& from) {
+        auto now = high_resolution_clock::now();
+        auto ms = duration<float, std::milli>(now - from).count();
+        from = now;
+        return ms;
+    };
+
+    fprintf(stderr, "[bench] seed: %u, cubes: %u, players: %u, clients: %u, ticks: %lu (+%lu warmup)\n",
+        seed, spawner.total, players, clients, ticks, warmup);
+
+    for (uint64_t t = 0; t < warmup + ticks; t++) {
+        bool record = t >= warmup;
+
+        // Same phase order as PhysXServer::tick
+        auto start = high_resolution_clock::now();
+        auto phase = start;
+
+        // One input per step, like a real client (the server applies one per step)
+        for (auto& client : remotes) client->sendInput();
+
+        // Deliver inputs and snapshots due by now (virtual time, so latency is deterministic)
+        hub->pump(t * tickNano);
+        auto tTransport = elapsed(phase);
+
+        world->updatePlayers(dt);
+        auto tPlayers = elapsed(phase);
+
+        world->step(dt, false);
+        auto tSim = elapsed(phase);
+
+        // Only whoever is due this step encodes (bots think at the same rate)
+        world->updateNet(dt);
+        auto tNet = elapsed(phase);
+
+        world->syncSim();
+        auto tFetch = elapsed(phase);
+
+        contactEvents += world->drainContacts([](const ContactEvent&) {});
+
+        world->recordHistory();
+        auto tHistory = elapsed(phase);
+
+        // What AI / weapon code would queue up during the tick: line of sight, short sweeps, proximity
+        if (queries) {
+            batch.clear();
+            PxSphereGeometry probe(0.5f);
+            for (uint32_t i = 0; i < queries; i++) {
+                auto pose = PxTransform(PxVec3(area(gen), 1.f, area(gen)));
+                auto dir = PxVec3(area(gen), 0.f, area(gen)).getNormalized();
+                if (dir.isZero()) dir = PxVec3(1.f, 0.f, 0.f);
+
+                if (i % 3 == 0) batch.raycast(pose.p, dir, 50.f);
+                else if (i % 3 == 1) batch.sweep(probe, pose, dir, 5.f);
+                else batch.overlap(PxSphereGeometry(3.f), pose);
+            }
+            world->submit(&batch);
+        }
+        world->runQueries();
+        auto tQueries = elapsed(phase);
+
+        // Random downward rays over the spawn area, against the poses of a few ticks ago
+        for (uint32_t i = 0; i < rewinds; i++) {
+            PoseFrame::RaycastHit hit;
+            auto origin = PxVec3(area(gen), 30.f, area(gen));
+            auto dir = PxVec3(area(gen) * 0.05f, -1.f, area(gen) * 0.05f).getNormalized();
+            world->rewindRaycast(world->getTick() + 1 - rewindTicks, origin, dir, 100.f, hit);
+        }
+        auto tRewind = elapsed(phase);
+
+        world->gc();
+        auto tGC = elapsed(phase);
+
+        if (!record) continue;
+
+        transport.add(tTransport);
+        updatePlayers.add(tPlayers);
+        simulate.add(tSim);
+        fetchResults.add(tFetch);
+        history.add(tHistory);
+        if (rewinds) rewind.add(tRewind);
+        if (queries) sceneQueries.add(tQueries);
+        updateNet.add(tNet);
+        gc.add(tGC);
+        total.add(duration<float, std::milli>(phase - start).count());
+    }
+
+    if (world->regionCount() > 1) fprintf(stderr, "[bench] migrations: %lu\n", world->migrations.load());
+    if (activation.enabled) {
+        fprintf(stderr, "[bench] frozen: %u, freezes: %lu, thaws: %lu\n",
+            world->frozenCount.load(), world->freezes.load(), world->thaws.load());
+    }
+    if (reports != "none") {
+        fprintf(stderr, "[bench] contact events: %lu, dropped: %lu\n", contactEvents, world->contactsDropped.load());
+    }
+
+    Samples* all[] = { &transport, &updatePlayers, &simulate, &fetchResults, &history, &rewind, &sceneQueries, &updateNet, &gc, &total };
+
+    if (json) {
+        printf("{\"seed\":%u,\"cubes\":%u,\"players\":%u,\"clients\":%u,\"ticks\":%lu,\"phases\":{",
+            seed, spawner.total, players, clients, ticks);
+        for (size_t i = 0; i < std::size(all); i++) {
+            if (i) printf(",");
+            all[i]->json();
+        }
+        printf("}}\n");
+    } else {
+        Samples::csvHeader();
+        for (auto s : all) s->csv();
+    }
+
+    delete hub;
+    for (auto client : remotes) delete client;
+    delete server;
+    World::cleanup();
+    return 0;
+}
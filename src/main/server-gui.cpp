@@ -2,6 +2,7 @@
 
 #include "../misc/repl.hpp"
 #include "../server/game.hpp"
+#include "../network/quic/server.hpp"
 #include "../server/debug/renderer.hpp"
 #include "../network/util/bitmagic.hpp"
 
@@ -14,10 +15,13 @@ int main(int argc, char** argv) {
     if (error) return error;
 
     auto server = new PhysXServer();
+    auto quic = new QuicServer(server);
 
     uint16_t port = 6969;
-    if (!server->listen(port)) return 1;
+    if (!quic->listen(port)) return 1;
     server->world->initScene();
+    // Someone is watching the window, keep the fountain going
+    server->hibernation.enabled = false;
 
     repl::run();
 #ifdef WIN32
@@ -33,8 +37,9 @@ int main(int argc, char** argv) {
         std::raise(SIGINT);
     });
 
-    server->run(tick, 100);
+    server->run(tick * MS_TO_NANO, 100 * MS_TO_NANO);
 
+    delete quic;
     delete server;
     delete t;
 
@@ -2,35 +2,258 @@
 
 #include <thread>
 #include <chrono>
+#include <string>
+#include <cstring>
 
 #include "../misc/repl.hpp"
 #include "../world/world.hpp"
 #include "../server/game.hpp"
+#include "../server/rooms.hpp"
+#include "../server/shard.hpp"
+#include "../server/bus.hpp"
+#include "../network/quic/server.hpp"
+#include "../network/uv/tcp.hpp"
+#include "../network/uv/udp.hpp"
 #include "../server/debug/renderer.hpp"
 
-int main() {
+// bots                              count + bytes encoded so far
+// bots add N [wander|jump|follow] [encode]
+// bots remove N | bots clear
+static void botCommand(PhysXServer* server, string_view line) {
+    char verb[16] = {}, kind[16] = {}, flag[16] = {};
+    uint32_t count = 0;
+    string cmd(line);
+
+    auto n = sscanf(cmd.c_str(), "bots %15s %u %15s %15s", verb, &count, kind, flag);
+    if (n <= 0) {
+        printf("[repl] %zu bots, %lu bytes encoded\n", server->botCount(), server->botEncodedBytes());
+    } else if (!strcmp(verb, "add") && n >= 2) {
+        auto behavior = BotPlayer::WANDER;
+        if (n >= 3 && strcmp(kind, "encode") && !BotPlayer::parse(kind, behavior)) {
+            printf("[repl] unknown behavior: %s\n", kind);
+            return;
+        }
+        bool encode = !strcmp(kind, "encode") || !strcmp(flag, "encode");
+        server->addBots(count, behavior, encode);
+    } else if (!strcmp(verb, "remove") && n >= 2) {
+        server->removeBots(count);
+    } else if (!strcmp(verb, "clear")) {
+        server->removeBots(uint32_t(server->botCount()));
+    } else {
+        printf("[repl] usage: bots [add N [wander|jump|follow] [encode] | remove N | clear]\n");
+    }
+}
+
+// rate                              default snapshot interval in steps
+// rate N                            set the default
+// rate PID N                        one player (0 follows the default again)
+static void rateCommand(PhysXServer* server, string_view line) {
+    auto world = server->world;
+    uint32_t a = 0, b = 0;
+    string cmd(line);
+
+    auto n = sscanf(cmd.c_str(), "rate %u %u", &a, &b);
+    if (n == 1 && a) world->netEvery = a;
+    else if (n == 2) {
+        auto player = world->findPlayer(a);
+        if (!player) {
+            printf("[repl] no player #%u\n", a);
+            return;
+        }
+        player->netEvery = b;
+        printf("[repl] #%u: every %u steps\n", a, world->netInterval(player));
+        return;
+    } else if (n > 0) {
+        printf("[repl] usage: rate [N | PID N]\n");
+        return;
+    }
+    printf("[repl] snapshots every %u steps (x%u overload)\n", world->netEvery.load(), world->netScale.load());
+}
+
+int main(int argc, char** argv) {
+    // quic (default), or tcp/udp without TLS for trusted networks
+    string transport = "quic";
+    uint16_t port = 6969;
+    uint32_t bots = 0;
+    auto behavior = BotPlayer::WANDER;
+    bool encode = false;
+    bool tickThread = false;
+    bool degrade = true;
+    bool hibernate = true;
+    uint32_t rooms = 0;       // 0 = one world on its own, no room manager
+    uint32_t roomSize = 8;
+    uint32_t roomThreads = 4; // shared physx pool
+    uint32_t roomWorkers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    PartitionConfig partition;
+    ShardConfig sharding;     // count 1 = not sharded
+    string bus;               // shared memory name for network processes (relay --bus)
+    ActivationConfig activation;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--bot-encode") encode = true;
+        else if (arg == "--tick-thread") tickThread = true;
+        else if (arg == "--no-degrade") degrade = false;
+        else if (arg == "--no-hibernate") hibernate = false;
+        else if (arg == "--freeze-sleep") activation.kinematic = false;
+        else if (arg == "--freeze-radius" && value) {
+            activation.enabled = true;
+            activation.radius = std::stof(argv[++i]);
+        }
+        else if (arg == "--transport" && value) transport = argv[++i];
+        else if (arg == "--port" && value) port = uint16_t(std::stoul(argv[++i]));
+        else if (arg == "--bots" && value) bots = std::stoul(argv[++i]);
+        else if (arg == "--rooms" && value) rooms = std::stoul(argv[++i]);
+        else if (arg == "--room-size" && value) roomSize = std::stoul(argv[++i]);
+        else if (arg == "--room-threads" && value) roomThreads = std::stoul(argv[++i]);
+        else if (arg == "--room-workers" && value) roomWorkers = std::stoul(argv[++i]);
+        else if (arg == "--regions" && value) sscanf(argv[++i], "%ux%u", &partition.cols, &partition.rows);
+        else if (arg == "--region-size" && value) partition.size = std::stof(argv[++i]);
+        else if (arg == "--shard" && value) sscanf(argv[++i], "%u/%u", &sharding.index, &sharding.count);
+        else if (arg == "--shard-width" && value) sharding.width = std::stof(argv[++i]);
+        else if (arg == "--shard-port" && value) sharding.basePort = uint16_t(std::stoul(argv[++i]));
+        else if (arg == "--shard-host" && value) sharding.host = argv[++i];
+        else if (arg == "--bus" && value) bus = argv[++i];
+        else if (arg == "--bot-behavior" && value && BotPlayer::parse(argv[++i], behavior)) {}
+        else {
+            printf("usage: server-headless [--transport quic|tcp|udp] [--port N] [--tick-thread] [--no-degrade]\n"
+                   "                       [--no-hibernate] [--rooms N] [--room-size N]\n"
+                   "                       [--room-threads N] [--room-workers N] [--regions CxR] [--region-size m]\n"
+                   "                       [--shard I/N] [--shard-width m] [--shard-port N] [--shard-host H]\n"
+                   "                       [--bus NAME] [--freeze-radius m] [--freeze-sleep]\n"
+                   "                       [--bots N] [--bot-behavior wander|jump|follow] [--bot-encode]\n");
+            return 1;
+        }
+    }
+
     auto error = World::init();
     if (error) return error;
-    error = QuicServer::init();
-    if (error) return error;
+    if (transport == "quic") {
+        error = QuicServer::init();
+        if (error) return error;
+    }
 
-    auto server = new PhysXServer();
+    // Rooms build their own scenes, a grid would only apply to room 0
+    if (rooms && partition.cols * partition.rows > 1) {
+        printf("--regions and --rooms don't mix\n");
+        return 1;
+    }
 
-    uint16_t port = 6969;
-    if (!server->listen(port)) return 1;
-    server->world->initScene();
+    // With rooms the transports hand connections to the manager, console commands go to room 0
+    RoomManager* manager = rooms ? new RoomManager(rooms, roomSize, roomThreads) : nullptr;
+    auto server = manager ? manager->rooms[0]->server : new PhysXServer();
+    NetServer* net = manager ? static_cast<NetServer*>(manager) : server;
+    if (!manager) {
+        if (!server->world->partition(partition)) return 1;
+        server->world->initScene();
+    }
+
+    // Every shard is its own process, rooms would each need a strip of their own
+    ShardNode* shard = nullptr;
+    if (sharding.count > 1) {
+        if (manager) {
+            printf("--shard and --rooms don't mix\n");
+            return 1;
+        }
+        shard = new ShardNode(server, sharding);
+        if (!shard->start()) return 1;
+    }
+
+    // Clients can still connect here directly, the bus only adds network processes on top
+    SnapshotBus* shm = nullptr;
+    SimBus* simBus = nullptr;
+    if (!bus.empty()) {
+        if (manager) {
+            printf("--bus and --rooms don't mix\n");
+            return 1;
+        }
+        if (!(shm = SnapshotBus::create(bus))) return 1;
+        simBus = new SimBus(server, shm);
+        simBus->start();
+    }
+
+    QuicServer* quic = nullptr;
+    TcpServer* tcp = nullptr;
+    UdpServer* udp = nullptr;
+
+    bool listening;
+    if (transport == "tcp") listening = (tcp = new TcpServer(net))->listen(port);
+    else if (transport == "udp") listening = (udp = new UdpServer(net))->listen(port);
+    else listening = (quic = new QuicServer(net))->listen(port);
+    if (!listening) return 1;
+
+    auto setup = [&](PhysXServer* room) {
+        if (bots) room->addBots(bots, behavior, encode);
+        room->overload.config.enabled = degrade;
+        room->hibernation.enabled = hibernate;
+        room->world->activation = activation;
+    };
+    if (manager) for (auto& room : manager->rooms) setup(room->server);
+    else setup(server);
+
+    // CPU used between two `tick`s, divided by the rooms (or the one world) hosted
+    double lastCpu = 0.0;
+    uint64_t lastTick = uv_hrtime();
+    auto hosted = std::max<uint32_t>(1, rooms);
+
+    repl::onCommand = [server, manager, shard, simBus, lastCpu, lastTick, hosted](string_view line) mutable {
+        // Bots belong to whichever thread steps the world
+        if (line.substr(0, 4) == "bots") server->post([server, cmd = string(line)] { botCommand(server, cmd); });
+        else if (line.substr(0, 4) == "rate") server->post([server, cmd = string(line)] { rateCommand(server, cmd); });
+        else if (line == "clients") server->printClients();
+        else if (line == "rooms" && manager) manager->print();
+        else if (line == "shard" && shard) server->post([shard] { shard->print(); });
+        else if (line == "bus" && simBus) server->post([simBus] { simBus->print(); });
+        else if (line == "tick") {
+            printf("[repl] %lu steps of %.3fms, %.1fms dropped, last step %.3fms\n",
+                server->clock.steps.load(), server->stepInterval() / float(MS_TO_NANO),
+                server->clock.droppedNano.load() / float(MS_TO_NANO), server->world->timing.sim.load());
+            server->clock.jitter.print("tick jitter");
+            server->overload.print();
+
+            uv_rusage_t usage;
+            uv_getrusage(&usage);
+            auto cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+            printf("[repl] %s, %lu hibernations (%.1fs), process cpu %.2fs\n",
+                server->asleep() ? "hibernating" : "awake", server->clock.hibernations.load(),
+                server->clock.hibernatedNano.load() / 1e9, cpu);
+
+            auto now = uv_hrtime();
+            auto wall = (now - lastTick) / 1e9;
+            printf("[repl] since the last tick: %.2fs cpu over %.1fs, %.3fms cpu per second per world (%u)\n",
+                cpu - lastCpu, wall, wall > 0 ? (cpu - lastCpu) * 1000.0 / wall / hosted : 0.0, hosted);
+            lastCpu = cpu;
+            lastTick = now;
 
+            auto world = server->world;
+            if (world->activation.enabled) {
+                printf("[repl] %u objects frozen, %lu freezes, %lu thaws\n",
+                    world->frozenCount.load(), world->freezes.load(), world->thaws.load());
+            }
+        } else if (line == "tick reset") server->clock.jitter.clear();
+        else if (!line.empty()) printf("[repl] unknown command\n");
+    };
     repl::run();
 #ifdef WIN32
     uint64_t tick = 15;
 #else
     uint64_t tick = 20;
 #endif
-    server->run(tick, 100);
+    if (manager) manager->run(tick * MS_TO_NANO, 100 * MS_TO_NANO, roomWorkers);
+    else server->run(tick * MS_TO_NANO, 100 * MS_TO_NANO, tickThread);
 
-    delete server;
+    delete quic;
+    delete tcp;
+    delete udp;
+    delete shard;
+    delete simBus;
+    delete shm;
+    if (manager) delete manager;
+    else delete server;
 
     World::cleanup();
-    QuicServer::cleanup();
+    if (transport == "quic") QuicServer::cleanup();
 	return 0;
 }
\ No newline at end of file
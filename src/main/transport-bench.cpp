@@ -0,0 +1,312 @@
+#include <uv.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <chrono>
+#include <thread>
+#include <string>
+#include <cstring>
+
+#include "../misc/stats.hpp"
+#include "../network/transport.hpp"
+#include "../network/uv/tcp.hpp"
+#include "../network/uv/udp.hpp"
+#include "../network/quic/server.hpp"
+#include "../network/quic/client.hpp"
+
+using namespace std::chrono;
+
+constexpr char PING = 'P';
+constexpr char DATA = 'D';
+
+static inline uint64_t nanoNow() {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Echoes pings back, everything else is ignored
+struct EchoServer : NetServer {
+    struct Echo : Connection {
+        void onData(string_view buffer) {
+            if (buffer.empty() || buffer[0] != PING) return;
+            auto copy = static_cast<char*>(malloc(buffer.size()));
+            memcpy(copy, buffer.data(), buffer.size());
+            send(string_view(copy, buffer.size()), true);
+        }
+    };
+
+    mutex created_mutex;
+    vector<Connection*> created;
+
+    Connection* client() {
+        auto conn = new Echo();
+        scoped_lock lock(created_mutex);
+        created.push_back(conn);
+        return conn;
+    }
+
+    ~EchoServer() {
+        for (auto conn : created) delete conn;
+    }
+};
+
+struct BenchConn : NetClient {
+    atomic<bool> ready = false;
+    atomic<uint64_t> bytes = 0;
+
+    mutex rtt_mutex;
+    Samples rtt;
+
+    void onConnect() { ready = true; }
+
+    void onData(string_view buffer) {
+        if (buffer.empty()) return;
+        if (buffer[0] == PING && buffer.size() == 1 + sizeof(uint64_t)) {
+            uint64_t sent;
+            memcpy(&sent, buffer.data() + 1, sizeof(uint64_t));
+            scoped_lock lock(rtt_mutex);
+            rtt.add((nanoNow() - sent) / 1000000.f);
+        } else {
+            bytes += buffer.size();
+        }
+    }
+
+    void ping() {
+        auto buf = static_cast<char*>(malloc(1 + sizeof(uint64_t)));
+        auto now = nanoNow();
+        buf[0] = PING;
+        memcpy(buf + 1, &now, sizeof(uint64_t));
+        send(string_view(buf, 1 + sizeof(uint64_t)), true);
+    }
+};
+
+struct Options {
+    string backend = "tcp";
+    uint16_t port = 7000;
+    float seconds = 5.f;
+    uint32_t rate = 10;     // server pushes per second
+    uint32_t payload = 1024;
+    uint32_t pingMs = 100;
+};
+
+static double cpuSeconds() {
+    uv_rusage_t usage;
+    uv_getrusage(&usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// One run: N clients against one server on the same machine, server and client ends on separate loops
+static bool run(const Options& opt, uint32_t conns, uint16_t port) {
+    auto server = new EchoServer();
+    bool quic = opt.backend == "quic";
+    bool udp = opt.backend == "udp";
+
+    uv_loop_t serverLoop, clientLoop;
+    uv_loop_init(&serverLoop);
+    uv_loop_init(&clientLoop);
+
+    QuicServer* quicServer = nullptr;
+    TcpServer* tcpServer = nullptr;
+    UdpServer* udpServer = nullptr;
+
+    bool listening;
+    if (quic) listening = (quicServer = new QuicServer(server))->listen(port);
+    else if (udp) listening = (udpServer = new UdpServer(server, &serverLoop))->listen(port);
+    else listening = (tcpServer = new TcpServer(server, &serverLoop))->listen(port);
+
+    if (!listening) {
+        delete quicServer;
+        delete tcpServer;
+        delete udpServer;
+        delete server;
+        return false;
+    }
+
+    // Stops the listener from inside the loop, uv_run returns once every link is closed
+    struct Listeners { TcpServer* tcp; UdpServer* udp; } listeners = { tcpServer, udpServer };
+    uv_async_t stopper;
+    uv_async_init(&serverLoop, &stopper, [](uv_async_t* handle) {
+        auto self = static_cast<Listeners*>(handle->data);
+        if (self->tcp) self->tcp->stop();
+        if (self->udp) self->udp->stop();
+        uv_close((uv_handle_t*) handle, nullptr);
+    });
+    stopper.data = &listeners;
+
+    std::thread serverThread([&] { uv_run(&serverLoop, UV_RUN_DEFAULT); });
+
+    vector<BenchConn*> clients;
+    for (uint32_t i = 0; i < conns; i++) clients.push_back(new BenchConn());
+
+    // uv links are connected from the thread that runs their loop
+    std::thread clientThread([&] {
+        for (auto client : clients) {
+            if (quic) QuicClient::connect(client, "localhost", port);
+            else if (udp) UdpClient::connect(client, &clientLoop, "localhost", port);
+            else TcpClient::connect(client, &clientLoop, "localhost", port);
+        }
+        uv_run(&clientLoop, UV_RUN_DEFAULT);
+    });
+
+    auto deadline = steady_clock::now() + seconds(10);
+    auto connected = [&] {
+        uint32_t n = 0;
+        for (auto c : clients) n += c->ready && c->isConnected();
+        return n;
+    };
+    while ((server->count() < conns || connected() < conns) && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+
+    auto established = connected();
+    if (established < conns) {
+        fprintf(stderr, "[bench] %s: only %u/%u connections established\n",
+            opt.backend.c_str(), established, conns);
+    }
+
+    auto payload = static_cast<char*>(malloc(opt.payload));
+    memset(payload, 0, opt.payload);
+    payload[0] = DATA;
+
+    auto cpuStart = cpuSeconds();
+    auto wallStart = nanoNow();
+    auto end = wallStart + uint64_t(opt.seconds * 1e9);
+
+    uint64_t pushEvery = 1000000000ull / std::max<uint32_t>(1, opt.rate);
+    uint64_t pingEvery = uint64_t(opt.pingMs) * 1000000;
+    uint64_t nextPush = wallStart, nextPing = wallStart;
+
+    for (auto now = wallStart; now < end; now = nanoNow()) {
+        if (now >= nextPush) {
+            server->broadcast(string_view(payload, opt.payload), false, COMP_NONE);
+            nextPush += pushEvery;
+        }
+        if (now >= nextPing) {
+            for (auto c : clients) c->ping();
+            nextPing += pingEvery;
+        }
+        auto next = std::min(nextPush, nextPing);
+        if (next > now) std::this_thread::sleep_for(nanoseconds(next - now));
+    }
+
+    auto wall = (nanoNow() - wallStart) / 1e9;
+    auto cpu = cpuSeconds() - cpuStart;
+
+    Samples rtt("rtt");
+    uint64_t bytes = 0;
+    for (auto c : clients) {
+        scoped_lock lock(c->rtt_mutex);
+        rtt.merge(c->rtt);
+        bytes += c->bytes;
+    }
+
+    printf("%s,%u,%u,%.2f,%lu,%.3f,%.3f,%.3f,%.3f,%.2f,%.1f,%.2f\n",
+        opt.backend.c_str(), conns, established, wall, rtt.count(),
+        rtt.percentile(50), rtt.percentile(90), rtt.percentile(99), rtt.max(),
+        bytes / wall / (1024 * 1024), 100 * cpu / wall, 1e6 * cpu / wall / std::max<uint32_t>(1, established));
+    fflush(stdout);
+
+    // Clients first so the server side sees every disconnect
+    for (auto c : clients) c->disconnect();
+    clientThread.join();
+
+    deadline = steady_clock::now() + seconds(5);
+    while (server->count() && steady_clock::now() < deadline) std::this_thread::sleep_for(milliseconds(10));
+
+    if (quic) quicServer->stop();
+    uv_async_send(&stopper);
+    serverThread.join();
+
+    uv_loop_close(&serverLoop);
+    uv_loop_close(&clientLoop);
+
+    for (auto c : clients) delete c;
+    delete quicServer;
+    delete tcpServer;
+    delete udpServer;
+    delete server;
+    free(payload);
+    return true;
+}
+
+static void usage() {
+    printf("usage: transport-bench [--backend quic|tcp|udp] [--conns 100,500,1000] [--seconds N]\n"
+           "                       [--rate Hz] [--payload bytes] [--ping-ms N] [--port N]\n");
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    vector<uint32_t> sweep = { 100, 500, 1000 };
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--help" || arg == "-h" || !value) {
+            usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+
+        i++;
+        if (arg == "--backend") opt.backend = value;
+        else if (arg == "--seconds") opt.seconds = std::stof(value);
+        else if (arg == "--rate") opt.rate = std::stoul(value);
+        else if (arg == "--payload") opt.payload = std::max<uint32_t>(1, std::stoul(value));
+        else if (arg == "--ping-ms") opt.pingMs = std::max<uint32_t>(1, std::stoul(value));
+        else if (arg == "--port") opt.port = uint16_t(std::stoul(value));
+        else if (arg == "--conns") {
+            sweep.clear();
+            string list = value;
+            size_t from = 0;
+            while (from < list.size()) {
+                auto to = list.find(',', from);
+                if (to == string::npos) to = list.size();
+                sweep.push_back(std::stoul(list.substr(from, to - from)));
+                from = to + 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (opt.backend != "quic" && opt.backend != "tcp" && opt.backend != "udp") {
+        usage();
+        return 1;
+    }
+
+#ifndef _WIN32
+    // Both ends live in this process, 1000 tcp connections need 2000+ descriptors
+    rlimit limit;
+    if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+    if (opt.backend == "quic") {
+        // Needs server.cert & server.key in the working directory, same as the server
+        auto error = QuicServer::init();
+        if (error) return error;
+        error = QuicClient::init(true);
+        if (error) return error;
+    }
+
+    fprintf(stderr, "[bench] backend: %s, payload: %uB @ %uHz, ping every %ums, %.1fs per run\n",
+        opt.backend.c_str(), opt.payload, opt.rate, opt.pingMs, opt.seconds);
+
+    printf("backend,conns,connected,seconds,pings,rtt_p50,rtt_p90,rtt_p99,rtt_max,rx_mb_s,cpu_pct,cpu_us_per_conn_s\n");
+
+    int status = 0;
+    for (size_t i = 0; i < sweep.size(); i++) {
+        if (!run(opt, sweep[i], uint16_t(opt.port + i))) status = 1;
+    }
+
+    if (opt.backend == "quic") {
+        QuicClient::cleanup();
+        QuicServer::cleanup();
+    }
+
+    return status;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <cstdint>
+
+// Fixed bucket histogram of durations in nanoseconds, safe to add from one thread while
+// another prints. Buckets are upper bounds, the last one catches everything above
+class Histogram {
+public:
+    static constexpr size_t BUCKETS = 10;
+    static constexpr uint64_t BOUNDS[BUCKETS - 1] = {
+        10000, 50000, 100000, 250000, 500000, 1000000, 2000000, 5000000, 10000000
+    };
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> peak = 0;
+
+public:
+    void add(uint64_t nano) {
+        size_t i = 0;
+        while (i < BUCKETS - 1 && nano > BOUNDS[i]) i++;
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nano, std::memory_order_relaxed);
+
+        auto prev = peak.load(std::memory_order_relaxed);
+        while (nano > prev && !peak.compare_exchange_weak(prev, nano, std::memory_order_relaxed)) {}
+    }
+
+    void clear() {
+        for (auto& c : counts) c = 0;
+        total = sum = peak = 0;
+    }
+
+    uint64_t count() const { return total.load(); };
+    uint64_t max() const { return peak.load(); };
+    double mean() const { return total ? double(sum.load()) / total.load() : 0.0; };
+
+    void print(const char* tag, FILE* out = stdout) const {
+        auto n = total.load();
+        fprintf(out, "[%s] %lu samples, mean %.1fus, max %.1fus\n", tag, n, mean() / 1000.0, peak.load() / 1000.0);
+        if (!n) return;
+
+        for (size_t i = 0; i < BUCKETS; i++) {
+            auto c = counts[i].load();
+            if (i < BUCKETS - 1) fprintf(out, "[%s] %8s %6luus: ", tag, "<=", BOUNDS[i] / 1000);
+            else fprintf(out, "[%s] %8s %6luus: ", tag, ">", BOUNDS[i - 1] / 1000);
+            fprintf(out, "%9lu %6.2f%%\n", c, 100.0 * c / n);
+        }
+    }
+};
@@ -5,12 +5,17 @@
 #include <string_view>
 #include <uv.h>
 #include <memory>
+#include <functional>
 
 using std::string_view;
 
 static inline std::unique_ptr<char[]> pool(new char[65536]);
 
 class repl {
+public:
+    // Every line other than "exit" ends up here, called on the loop thread
+    static inline std::function<void(string_view)> onCommand;
+private:
 
     static inline bool closing;
     static inline uv_tty_t tty;
@@ -42,8 +47,8 @@ class repl {
             
             if (view == "exit") {
                 std::raise(SIGINT);
-            } else {
-                // process command
+            } else if (onCommand) {
+                onCommand(view);
             }
         }
     }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Single producer / single consumer bounded queue, allocated once up front (capacity is rounded
+// up to a power of two). Neither side blocks: push fails when the consumer has fallen a whole
+// ring behind, the caller decides whether that's worth counting
+template<typename T>
+class Ring {
+    std::unique_ptr<T[]> items;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head; // next write, producer only
+    alignas(64) std::atomic<size_t> tail; // next read, consumer only
+
+public:
+    Ring(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        items.reset(new T[size]);
+        mask = size - 1;
+    };
+
+    bool push(const T& value) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask) return false;
+        items[h & mask] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        out = items[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Hands everything pushed so far to fn in order, returns how many
+    template<typename F>
+    size_t drain(F&& fn) {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto h = head.load(std::memory_order_acquire);
+        for (auto i = t; i != h; i++) fn(static_cast<const T&>(items[i & mask]));
+        tail.store(h, std::memory_order_release);
+        return h - t;
+    }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); };
+    size_t capacity() const { return mask + 1; };
+};
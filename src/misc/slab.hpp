@@ -0,0 +1,92 @@
+#pragma once
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+// Pool of up to 65535 T's in chunks that are allocated once and never move, recycled through a
+// free list. Every slot has a generation that goes up when its T is destroyed, so a handle
+// (generation << 16 | index) to something destroyed stops resolving even after the slot is reused.
+// Index 0 is never handed out, handle 0 is "nothing". Not thread safe, the owner locks
+template<typename T, uint32_t CHUNK = 1024>
+class Slab {
+public:
+    static constexpr uint32_t CAPACITY = 65536;
+
+    static uint16_t indexOf(uint32_t handle) { return uint16_t(handle); };
+    static uint16_t generationOf(uint32_t handle) { return uint16_t(handle >> 16); };
+
+private:
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint16_t generation = 1;
+        bool live = false;
+    };
+
+    std::unique_ptr<Slot[]> chunks[CAPACITY / CHUNK];
+    std::vector<uint16_t> freeList;
+    uint32_t next = 1; // first index never handed out
+    uint32_t count = 0;
+
+    Slot& slot(uint32_t index) { return chunks[index / CHUNK][index % CHUNK]; };
+    static T* at(Slot& s) { return reinterpret_cast<T*>(s.storage); };
+
+public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    ~Slab() {
+        for (uint32_t i = 1; i < next; i++) {
+            auto& s = slot(i);
+            if (s.live) at(s)->~T();
+        }
+    }
+
+    // Constructs T(index, args...) in a free slot and sets handle, nullptr when all are taken
+    template<typename... Args>
+    T* create(uint32_t& handle, Args&&... args) {
+        uint32_t index;
+        if (!freeList.empty()) {
+            index = freeList.back();
+            freeList.pop_back();
+        } else if (next < CAPACITY) {
+            index = next++;
+            if (!chunks[index / CHUNK]) chunks[index / CHUNK].reset(new Slot[CHUNK]);
+        } else return nullptr;
+
+        auto& s = slot(index);
+        auto ptr = new (s.storage) T(uint16_t(index), std::forward<Args>(args)...);
+        s.live = true;
+        count++;
+        handle = uint32_t(s.generation) << 16 | index;
+        return ptr;
+    }
+
+    // Destroys what handle points to, false if it was already gone
+    bool destroy(uint32_t handle) {
+        auto ptr = get(handle);
+        if (!ptr) return false;
+
+        auto& s = slot(indexOf(handle));
+        ptr->~T();
+        s.live = false;
+        if (!++s.generation) s.generation = 1;
+        freeList.push_back(indexOf(handle));
+        count--;
+        return true;
+    }
+
+    // nullptr unless handle is still the one create handed out
+    T* get(uint32_t handle) {
+        auto index = indexOf(handle);
+        if (!index || index >= next) return nullptr;
+        auto& s = slot(index);
+        return s.live && s.generation == generationOf(handle) ? at(s) : nullptr;
+    }
+
+    uint32_t size() const { return count; };
+    uint32_t capacity() const { return CAPACITY - 1; };
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+using std::vector;
+using std::string;
+
+// Collects samples (ms by convention) and reports percentiles
+class Samples {
+    vector<float> values;
+    bool sorted = true;
+
+    void sort() {
+        if (sorted) return;
+        std::sort(values.begin(), values.end());
+        sorted = true;
+    }
+
+public:
+    string name;
+
+    Samples(string name = "", size_t reserve = 0) : name(name) { values.reserve(reserve); };
+
+    void add(float v) {
+        values.push_back(v);
+        sorted = false;
+    }
+
+    void merge(const Samples& other) {
+        values.insert(values.end(), other.values.begin(), other.values.end());
+        sorted = false;
+    }
+
+    void clear() {
+        values.clear();
+        sorted = true;
+    }
+
+    size_t count() { return values.size(); }
+
+    float percentile(float p) {
+        if (values.empty()) return 0.f;
+        sort();
+        auto index = size_t(p * 0.01f * (values.size() - 1) + 0.5f);
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    float mean() {
+        if (values.empty()) return 0.f;
+        double sum = 0;
+        for (auto v : values) sum += v;
+        return float(sum / values.size());
+    }
+
+    float max() {
+        if (values.empty()) return 0.f;
+        sort();
+        return values.back();
+    }
+
+    static void csvHeader(FILE* out = stdout) {
+        fprintf(out, "phase,count,mean,p50,p90,p99,max\n");
+    }
+
+    void csv(FILE* out = stdout) {
+        fprintf(out, "%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f\n", name.c_str(), count(),
+            mean(), percentile(50), percentile(90), percentile(99), max());
+    }
+
+    void json(FILE* out = stdout) {
+        fprintf(out, "\"%s\":{\"count\":%zu,\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f}",
+            name.c_str(), count(), mean(), percentile(50), percentile(90), percentile(99), max());
+    }
+};
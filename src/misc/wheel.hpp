@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Hashed timing wheel over ticks. An item due at tick t sits in slot t % SLOTS, delays longer
+// than the wheel wrap around and wait their round (the due tick is kept with the item).
+// Not thread safe, schedule and advance under the same lock
+template<typename T, size_t SLOTS = 256>
+class TimingWheel {
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+    struct Entry {
+        uint64_t due;
+        T item;
+    };
+
+    std::vector<Entry> slots[SLOTS];
+    std::vector<T> firing; // scratch, so fn can schedule into the slot being drained
+    uint64_t current = 0;
+    size_t count = 0;
+
+public:
+    // At least one tick from now
+    void schedule(const T& item, uint64_t delay) {
+        auto due = current + std::max<uint64_t>(1, delay);
+        slots[due & (SLOTS - 1)].push_back({ due, item });
+        count++;
+    }
+
+    // Moves the wheel up to tick, handing every item that came due on the way to fn in due
+    // order. Returns how many fired
+    template<typename F>
+    size_t advance(uint64_t tick, F&& fn) {
+        size_t fired = 0;
+        // Nothing can be due further than a whole turn away without coming round again
+        if (tick > current + SLOTS && !count) current = tick - SLOTS;
+
+        while (current < tick) {
+            current++;
+            auto& slot = slots[current & (SLOTS - 1)];
+
+            firing.clear();
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].due > current) { i++; continue; }
+                firing.push_back(slot[i].item);
+                slot[i] = slot.back();
+                slot.pop_back();
+            }
+
+            count -= firing.size();
+            fired += firing.size();
+            for (auto& item : firing) fn(item);
+        }
+        return fired;
+    }
+
+    uint64_t now() const { return current; };
+    size_t size() const { return count; };
+};
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "loopback.hpp"
+
+using std::scoped_lock;
+
+LoopbackHub::LoopbackHub(NetServer* server, LoopbackConfig config) :
+	server(server), config(config), gen(config.seed) {
+
+	if (!this->config.retransmitNano) {
+		this->config.retransmitNano = std::max<uint64_t>(3 * config.latencyNano, 1000000);
+	}
+}
+
+LoopbackHub::~LoopbackHub() {
+	{
+		scoped_lock lock(m);
+		for (auto pipe : pipes) pipe->closing = true;
+	}
+	pump(0);
+}
+
+bool LoopbackHub::connect(NetClient* client) {
+	auto pipe = new Pipe();
+
+	pipe->toServer.hub = this;
+	pipe->toServer.pipe = pipe;
+	pipe->toServer.toServer = true;
+
+	pipe->toClient.hub = this;
+	pipe->toClient.pipe = pipe;
+	pipe->toClient.toServer = false;
+
+	auto conn = server->client();
+	conn->server = server;
+	conn->link = &pipe->toClient;
+
+	pipe->conn = conn;
+	pipe->client = client;
+
+	{
+		scoped_lock lock(m);
+		pipes.push_back(pipe);
+	}
+
+	// Same order as quic: server accepts, then the client sees the handshake complete
+	server->attach(conn);
+	client->attach(&pipe->toServer);
+	return true;
+}
+
+uint64_t LoopbackHub::deliverTime(uint64_t& last) {
+	uint64_t delay = config.latencyNano;
+
+	if (config.jitterNano) {
+		delay += std::uniform_int_distribution<uint64_t>(0, config.jitterNano)(gen);
+	}
+
+	if (config.loss > 0.f && std::uniform_real_distribution<float>(0.f, 1.f)(gen) < config.loss) {
+		delay += config.retransmitNano;
+	}
+
+	last = std::max(last, now + delay);
+	return last;
+}
+
+bool LoopbackHub::End::send(string_view buffer, bool freeAfterSend, uint8_t compression) {
+	auto framed = Link::frame(buffer, compression);
+	if (freeAfterSend) free((void*) buffer.data());
+
+	scoped_lock lock(hub->m);
+	if (pipe->closing) {
+		free((void*) framed.data());
+		return false;
+	}
+
+	auto at = hub->deliverTime(toServer ? pipe->lastServer : pipe->lastClient);
+	hub->queue.push({ at, hub->order++, pipe, toServer, framed });
+	return true;
+}
+
+void LoopbackHub::End::close() {
+	NetClient* client = nullptr;
+
+	{
+		scoped_lock lock(hub->m);
+		pipe->closing = true;
+
+		// The client might be deleted right after disconnecting, let go of it now.
+		// Server side connections are detached on the next pump
+		if (toServer) {
+			client = pipe->client;
+			pipe->client = nullptr;
+		}
+	}
+
+	if (client) client->detach();
+}
+
+size_t LoopbackHub::pump(uint64_t time) {
+	vector<Packet> due;
+
+	{
+		scoped_lock lock(m);
+		now = std::max(now, time);
+		while (!queue.empty() && queue.top().deliverAt <= now) {
+			due.push_back(queue.top());
+			queue.pop();
+		}
+	}
+
+	size_t delivered = 0;
+
+	for (auto& packet : due) {
+		auto pipe = packet.pipe;
+		MessageProtocol* to = nullptr;
+
+		{
+			scoped_lock lock(m);
+			if (!pipe->closing) to = packet.toServer ?
+				static_cast<MessageProtocol*>(pipe->conn) : static_cast<MessageProtocol*>(pipe->client);
+		}
+
+		if (to) {
+			to->received_bytes += packet.data.size();
+			to->recv((uint8_t*) packet.data.data(), packet.data.size());
+			delivered++;
+		}
+
+		free((void*) packet.data.data());
+	}
+
+	vector<Pipe*> closed;
+
+	{
+		scoped_lock lock(m);
+
+		auto iter = std::partition(pipes.begin(), pipes.end(), [](Pipe* p) { return !p->closing; });
+		closed.assign(iter, pipes.end());
+		pipes.erase(iter, pipes.end());
+
+		// Drop whatever is still in flight on closed pipes
+		if (!closed.empty()) {
+			vector<Packet> keep;
+			while (!queue.empty()) {
+				auto packet = queue.top();
+				queue.pop();
+				if (packet.pipe->closing) free((void*) packet.data.data());
+				else keep.push_back(packet);
+			}
+			for (auto& packet : keep) queue.push(packet);
+		}
+	}
+
+	for (auto pipe : closed) {
+		if (pipe->conn) server->detach(pipe->conn);
+		if (pipe->client) pipe->client->detach();
+		delete pipe;
+	}
+
+	return delivered;
+}
+
+size_t LoopbackHub::pending() {
+	scoped_lock lock(m);
+	return queue.size();
+}
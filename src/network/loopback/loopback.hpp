@@ -0,0 +1,85 @@
+#pragma once
+
+#include <queue>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "../transport.hpp"
+
+using std::mutex;
+using std::vector;
+
+// Latency/jitter in nanoseconds. The link behaves like a reliable ordered stream, so a lost
+// message is delivered again after retransmitNano and holds back everything queued behind it
+struct LoopbackConfig {
+	uint64_t latencyNano = 0;
+	uint64_t jitterNano = 0;
+	float loss = 0.f;
+	uint64_t retransmitNano = 0; // 0 = 3x latency, at least 1ms
+	uint32_t seed = 0;
+};
+
+// In-process transport: pairs NetClients with connections of a NetServer and moves
+// framed messages between them on pump(). Every callback fires on the pumping thread
+class LoopbackHub {
+	struct Pipe;
+
+	class End : public Link {
+		friend LoopbackHub;
+		LoopbackHub* hub;
+		Pipe* pipe;
+		bool toServer;
+	public:
+		bool send(string_view buffer, bool freeAfterSend, uint8_t compression);
+		void close();
+		uint64_t rttMicro() { return 2 * hub->config.latencyNano / 1000; };
+	};
+
+	struct Pipe {
+		NetServer::Connection* conn = nullptr;
+		NetClient* client = nullptr;
+		End toServer;
+		End toClient;
+		// Deliver time of the last message in each direction, keeps the stream ordered
+		uint64_t lastServer = 0;
+		uint64_t lastClient = 0;
+		bool closing = false;
+	};
+
+	struct Packet {
+		uint64_t deliverAt;
+		uint64_t order;
+		Pipe* pipe;
+		bool toServer;
+		string_view data;
+
+		bool operator>(const Packet& other) const {
+			return deliverAt != other.deliverAt ? deliverAt > other.deliverAt : order > other.order;
+		}
+	};
+
+	NetServer* server;
+	LoopbackConfig config;
+
+	mutex m; // Guards everything below
+	std::mt19937 gen;
+	uint64_t now = 0;
+	uint64_t order = 0;
+	vector<Pipe*> pipes;
+	std::priority_queue<Packet, vector<Packet>, std::greater<Packet>> queue;
+
+	uint64_t deliverTime(uint64_t& last);
+public:
+	LoopbackHub(NetServer* server, LoopbackConfig config = LoopbackConfig());
+	~LoopbackHub();
+
+	// Connects the client right away (onConnect fires on both sides before returning)
+	bool connect(NetClient* client);
+
+	// Delivers every message due at time (ns, any monotonic clock as long as it's consistent),
+	// then finishes closing pipes. Returns number of delivered messages
+	size_t pump(uint64_t time);
+
+	size_t pending();
+};
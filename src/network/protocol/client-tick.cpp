@@ -2,13 +2,54 @@
 
 #include "../../client/base.hpp"
 #include "../util/bitmagic.hpp"
+#include "../util/writer.hpp"
 
 #include <chrono>
 using namespace std::chrono;
 
 using namespace bitmagic;
 
+uint32_t BaseClient::sendInput(const PlayerInput& input) {
+	uint32_t seq;
+
+	{
+		scoped_lock lock(m);
+		seq = predictor.push(input);
+	}
+
+	Writer w;
+	w.write<uint8_t>(MSG_INPUT);
+	w.write<uint32_t>(seq);
+	w.write<PlayerInput>(input);
+	send(w.finalize(), true);
+	return seq;
+}
+
+double BaseClient::renderTime() {
+	scoped_lock lock(m);
+	return playout.renderTime(uv_hrtime() / 1000000.0);
+}
+
+double BaseClient::transportRtt() {
+	auto l = link;
+	return l ? l->rttMicro() / 1000.0 : 0.0;
+}
+
 void BaseClient::onData(string_view buffer) {
+	if (buffer.empty()) return;
+
+	if (buffer[0] == MSG_PING) {
+		auto reply = ClockSync::pong(buffer, ClockSync::now());
+		if (reply.size()) send(reply, true);
+		return;
+	}
+
+	if (buffer[0] == MSG_PONG) {
+		scoped_lock lock(m);
+		if (!clock.onPong(buffer, ClockSync::now())) printf("Bad pong\n");
+		return;
+	}
+
 	uint64_t now = uv_hrtime();
 	auto dt = (now - last_packet) / 1000000.f;
 	// printf("dt = %5.5f ms, %lu bytes\n", dt, buffer.size());
@@ -17,6 +58,11 @@ void BaseClient::onData(string_view buffer) {
 	bool error = false;
 	Reader r(buffer, error);
 
+	if (r.read<uint8_t>() != MSG_SNAPSHOT) {
+		printf("Unknown message: %u\n", uint8_t(buffer[0]));
+		return;
+	}
+
 	uint8_t remote_ver[3] = { r.read<uint8_t>(), r.read<uint8_t>(), r.read<uint8_t>() };
 	if (remote_ver[0] != PROTO_VER[0] ||
 		remote_ver[1] != PROTO_VER[1] ||
@@ -29,30 +75,42 @@ void BaseClient::onData(string_view buffer) {
 	}
 
 	int64_t remote_now = r.read<int64_t>();
+	uint64_t server_tick = r.read<uint64_t>();
+	float server_step = r.read<float>();
 
-	int64_t local = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-	// printf("%lu bytes | ping %li ms\n", buffer.size(), local - remote_now);
+	// Wall clock stamp is only compared against other stamps from the same server (PlayoutClock),
+	// round trip and clock offset come from the ping exchange
 
 	// Deserialize lock
 	m.lock();
 
+	if (server_step > 0.f) predictor.dt = server_step;
+
+	double t = double(remote_now);
+	playout.onSnapshot(t, now / 1000000.0);
+
 	uint16_t playerSize = r.read<uint32_t>();
 
 	for (int i = 0; i < playerSize; i++) {
 		auto pid = r.read<uint32_t>();
 		auto state = r.read<PlayerState>();
 
-		if (!i && !my_pid) my_pid = pid;
+		if (!i) {
+			if (!my_pid) my_pid = pid;
+			predictor.reconcile(r.read<uint32_t>(), state, server_tick);
+		}
 
 		auto iter = player_map.find(pid);
 		if (iter == player_map.end()) {
 			auto player = addPlayer(pid, state);
 			if (!player) player = new NetworkedPlayer(pid, state);
+			player->poses.reset(t, state.position, PxQuat(PxIdentity));
 			player_map.insert({ pid, player });
 		} else {
 			auto player = iter->second;
 			player->onState(state);
 			player->state = state;
+			player->poses.push(t, state.position, PxQuat(PxIdentity));
 		}
 	}
 
@@ -60,8 +118,7 @@ void BaseClient::onData(string_view buffer) {
 	if (data.size() != cacheSize) {
 		m.unlock();
 		printf("Cache size mismatch: %lu != %lu\n", data.size(), cacheSize);
-		disconnect();
-		exit(1);
+		onDesync("cache size");
 		return;
 	}
 
@@ -132,6 +189,9 @@ void BaseClient::onData(string_view buffer) {
 		write_id++;
 	}
 
+	// Every surviving object gets a sample for this snapshot, sleeping ones included
+	for (size_t i = 0; i < write_id; i++) data[i].ctx->poses.push(t, data[i].pos, data[i].quat);
+
 	uint64_t adding = r.read<uint32_t>();
 
 	auto newSize = write_id + adding;
@@ -143,8 +203,8 @@ void BaseClient::onData(string_view buffer) {
 			printf("Adding %lu objects???\n", adding);
 			// Something must have gone very wrong
 			m.unlock();
-			disconnect();
-			exit(1);
+			onDesync("add count");
+			return;
 		}
 	}
 
@@ -172,6 +232,7 @@ void BaseClient::onData(string_view buffer) {
 		obj.ctx = addObj(obj.type, obj.state, obj.flags, r);
 		if (!obj.ctx) obj.ctx = new NetworkedObject();
 
+		obj.ctx->poses.reset(t, obj.pos, obj.quat);
 		obj.ctx->onAdd(obj.pos, obj.quat);
 	}
 
@@ -183,13 +244,20 @@ void BaseClient::onData(string_view buffer) {
 		printf("data.size() = %lu, expected = %u\n", data.size(), expectedCacheSize);
 		printf("eof = %s\n", r.eof() ? "true" : "false");
 		printf("error = %s\n", error ? "true" : "false");
-		disconnect();
-		exit(1);
+		m.unlock();
+		onDesync("integrity");
+		return;
 	}
 
+	// Snapshots drive the ping schedule, no timer needed
+	auto sent = ClockSync::now();
+	bool ping = clock.due(sent);
+
 	// Done writing to data array
 	m.unlock();
 
+	if (ping) send(ClockSync::ping(sent), true);
+
 	/*
 		auto end = uv_hrtime();
 		auto d = (end - start) / 1000000.f;
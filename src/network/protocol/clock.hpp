@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+
+#include "common.hpp"
+
+using std::string_view;
+
+// NTP style round trip and clock offset estimate for one connection. Either end pings with its
+// send time, the other answers right away with the ping time plus its own receive and send time.
+// Times are steady clock microseconds of whichever end took them, never wall clock
+class ClockSync {
+	static constexpr size_t WINDOW = 8;
+	static constexpr size_t PING_SIZE = 1 + sizeof(uint64_t);
+	static constexpr size_t PONG_SIZE = 1 + 3 * sizeof(uint64_t);
+
+	struct Sample {
+		int64_t rtt;
+		int64_t offset;
+	};
+
+	Sample window[WINDOW];
+	size_t count = 0;
+	uint64_t samples = 0;
+
+	double srtt = 0, rttvar = 0;
+	int64_t offset = 0;
+	int64_t minRtt = 0;
+
+	uint64_t nextPing = 0;
+
+public:
+	// Pings go out quickly until the window fills, then once a second
+	uint64_t warmupIntervalMicro = 200000;
+	uint64_t intervalMicro = 1000000;
+
+	static uint64_t now() {
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Buffers are malloc'd, send them with freeAfterSend
+	static string_view ping(uint64_t t0) {
+		auto buf = static_cast<char*>(malloc(PING_SIZE));
+		buf[0] = MSG_PING;
+		memcpy(buf + 1, &t0, sizeof(uint64_t));
+		return string_view(buf, PING_SIZE);
+	}
+
+	// Empty if the ping is malformed. t1 is when the ping arrived
+	static string_view pong(string_view ping, uint64_t t1) {
+		if (ping.size() != PING_SIZE || ping[0] != MSG_PING) return string_view();
+
+		auto buf = static_cast<char*>(malloc(PONG_SIZE));
+		auto t2 = now();
+		buf[0] = MSG_PONG;
+		memcpy(buf + 1, ping.data() + 1, sizeof(uint64_t));
+		memcpy(buf + 1 + sizeof(uint64_t), &t1, sizeof(uint64_t));
+		memcpy(buf + 1 + 2 * sizeof(uint64_t), &t2, sizeof(uint64_t));
+		return string_view(buf, PONG_SIZE);
+	}
+
+	// Whether a ping should be sent now, schedules the next one if so
+	bool due(uint64_t t) {
+		if (t < nextPing) return false;
+		nextPing = t + (samples < WINDOW ? warmupIntervalMicro : intervalMicro);
+		return true;
+	}
+
+	// t3 is when the pong arrived, false if malformed
+	bool onPong(string_view pong, uint64_t t3) {
+		if (pong.size() != PONG_SIZE || pong[0] != MSG_PONG) return false;
+
+		uint64_t t0, t1, t2;
+		memcpy(&t0, pong.data() + 1, sizeof(uint64_t));
+		memcpy(&t1, pong.data() + 1 + sizeof(uint64_t), sizeof(uint64_t));
+		memcpy(&t2, pong.data() + 1 + 2 * sizeof(uint64_t), sizeof(uint64_t));
+		if (t3 < t0 || t2 < t1) return false;
+
+		Sample s;
+		s.rtt = std::max<int64_t>(0, int64_t(t3 - t0) - int64_t(t2 - t1));
+		s.offset = ((int64_t(t1) - int64_t(t0)) + (int64_t(t2) - int64_t(t3))) / 2;
+
+		window[samples % WINDOW] = s;
+		count = std::min(count + 1, WINDOW);
+
+		// RFC 6298 smoothing for the round trip
+		if (!samples) {
+			srtt = double(s.rtt);
+			rttvar = s.rtt / 2.0;
+		} else {
+			rttvar += (fabs(srtt - s.rtt) - rttvar) / 4;
+			srtt += (s.rtt - srtt) / 8;
+		}
+		samples++;
+
+		// Clock filter: the fastest exchange in the window had the least queueing, trust its offset
+		auto best = window[0];
+		for (size_t i = 1; i < count; i++) if (window[i].rtt < best.rtt) best = window[i];
+		offset = best.offset;
+		minRtt = best.rtt;
+		return true;
+	}
+
+	bool synced() const { return samples > 0; };
+	uint64_t sampleCount() const { return samples; };
+
+	double rttMs() const { return srtt / 1000.0; };
+	double rttVarMs() const { return rttvar / 1000.0; };
+	double minRttMs() const { return minRtt / 1000.0; };
+
+	// Remote clock minus local clock
+	double offsetMs() const { return offset / 1000.0; };
+	uint64_t toRemote(uint64_t local) const { return uint64_t(int64_t(local) + offset); };
+	uint64_t toLocal(uint64_t remote) const { return uint64_t(int64_t(remote) - offset); };
+};
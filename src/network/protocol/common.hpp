@@ -7,7 +7,24 @@
 using namespace physx;
 
 // Flags
-constexpr uint8_t PROTO_VER[3] = { 0, 0, 3 };
+constexpr uint8_t PROTO_VER[3] = { 0, 0, 6 };
+
+// First byte of every message
+constexpr uint8_t MSG_SNAPSHOT = 0; // server -> client
+constexpr uint8_t MSG_INPUT = 1; // client -> server
+constexpr uint8_t MSG_PING = 2; // either way, see clock.hpp
+constexpr uint8_t MSG_PONG = 3;
+
+// Relay connections (see relay/relay.hpp) carry the players of the relay's clients by slot
+constexpr uint8_t MSG_RELAY_HELLO = 4;  // relay -> server, the connection stops being a player itself
+constexpr uint8_t MSG_RELAY_JOIN = 5;   // relay -> server, u32 slot
+constexpr uint8_t MSG_RELAY_LEAVE = 6;  // relay -> server, u32 slot
+constexpr uint8_t MSG_RELAY_INPUT = 7;  // relay -> server, u32 slot then the MSG_INPUT body
+constexpr uint8_t MSG_RELAY_STATES = 8; // server -> relay, u32 count of slot, pid, input seq, state. Before each snapshot
+
+// First byte of a shared memory bus frame (see server/bus.hpp)
+constexpr uint8_t BUS_FULL = 1;  // carries every object, for readers starting over
+constexpr uint8_t BUS_RESET = 2; // nothing else, a frame was lost and every reader starts over
 
 constexpr uint8_t ADD_OBJ_ST = 0 << 6;
 constexpr uint8_t ADD_OBJ_DY = 1 << 6;
@@ -0,0 +1,456 @@
+#include <chrono>
+#include <thread>
+
+#include "common.hpp"
+#include "../../relay/relay.hpp"
+#include "../util/reader.hpp"
+#include "../util/writer.hpp"
+#include "../util/bitmagic.hpp"
+
+using namespace bitmagic;
+using namespace std::chrono;
+
+void Relay::Upstream::onData(string_view buffer) {
+	if (buffer.empty()) return;
+	relay->stats.bytesIn += buffer.size();
+
+	if (buffer[0] == MSG_RELAY_STATES) {
+		relay->onStates(buffer);
+		return;
+	}
+
+	// Pings, pongs and anything unexpected are BaseClient's business
+	bool snapshot = buffer[0] == MSG_SNAPSHOT && relay->readHeader(buffer);
+	BaseClient::onData(buffer);
+	if (!snapshot) return;
+
+	relay->stats.snapshots++;
+	relay->fanOut();
+}
+
+BaseClient::NetworkedObject* Relay::Upstream::addObj(uint16_t type, uint16_t state, uint16_t flags, Reader& r) {
+	auto obj = new Object();
+	obj->type = uint8_t(type);
+	obj->fixed = state & STATIC_OBJ;
+
+	if (type == BOX_T) {
+		obj->extents = r.read<PxVec3>();
+	} else if (type == SPH_T) {
+		obj->dims[0] = r.read<float>();
+	} else if (type == CPS_T) {
+		obj->dims[0] = r.read<float>();
+		obj->dims[1] = r.read<float>();
+	} else if (type != PLN_T) {
+		printf("[relay] unknown object type: %u\n", type);
+	}
+
+	// Still decoded, just never passed on
+	if (relay->freeIds.empty()) {
+		delete obj;
+		return nullptr;
+	}
+
+	obj->id = relay->freeIds.back();
+	relay->freeIds.pop_back();
+	relay->objects.push_back(obj);
+	return new Mirror(relay, obj);
+}
+
+void Relay::Upstream::Mirror::onRemove() {
+	obj->removed = true;
+	relay->removed.push_back(obj);
+	delete this;
+}
+
+// Header and player list, BaseClient keeps neither in a form that can be sent on
+bool Relay::readHeader(string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+
+	r.skip(1);
+	if (r.read<uint8_t>() != PROTO_VER[0] || r.read<uint8_t>() != PROTO_VER[1] || r.read<uint8_t>() != PROTO_VER[2]) return false;
+
+	timestamp = r.read<int64_t>();
+	tick = r.read<uint64_t>();
+	step = r.read<float>();
+
+	auto count = r.read<uint32_t>();
+	players.clear();
+
+	// First one is the relay's own (parked) player
+	r.read<uint32_t>();
+	r.read<PlayerState>();
+	r.read<uint32_t>();
+
+	for (uint32_t i = 1; i < count && !error; i++) {
+		RemotePlayer p;
+		p.pid = r.read<uint32_t>();
+		p.state = r.read<PlayerState>();
+		players.push_back(p);
+	}
+
+	return !error;
+}
+
+void Relay::onStates(string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+
+	r.skip(1);
+	auto count = r.read<uint32_t>();
+
+	scoped_lock lock(relay_mutex);
+	for (uint32_t i = 0; i < count && !error; i++) {
+		auto slot = r.read<uint32_t>();
+		auto pid = r.read<uint32_t>();
+		auto seq = r.read<uint32_t>();
+		auto state = r.read<PlayerState>();
+		if (error) break;
+
+		auto it = slots.find(slot);
+		if (it == slots.end()) continue;
+
+		auto client = it->second;
+		client->pid = pid;
+		client->inputSeq = seq;
+		client->state = state;
+		client->ready = true;
+	}
+}
+
+void Relay::fanOut() {
+	vector<Downstream*> targets;
+	{
+		scoped_lock lock(relay_mutex);
+		closed.erase(std::remove_if(closed.begin(), closed.end(), [&](Closed& c) {
+			if (c.snapshot + 1 >= stats.snapshots) return false;
+			delete c.client;
+			return true;
+		}), closed.end());
+
+		for (auto& [slot, client] : slots) {
+			if (client->ready) targets.push_back(client);
+		}
+	}
+
+	auto start = steady_clock::now();
+
+	for (auto client : targets) {
+		auto buf = encode(client);
+		stats.bytesOut += buf.size();
+		client->send(buf, true, COMP_LZ4);
+
+		bool ping;
+		auto now = ClockSync::now();
+		{
+			scoped_lock lock(client->clock_mutex);
+			ping = client->clock.due(now);
+		}
+		if (ping) client->send(ClockSync::ping(now), true);
+	}
+
+	stats.encoded += targets.size();
+	stats.encodeNano += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+	// Every cache has seen these gone, their ids can go around again
+	if (removed.empty()) return;
+	objects.erase(std::remove_if(objects.begin(), objects.end(), [](Object* obj) { return obj->removed; }), objects.end());
+	for (auto obj : removed) {
+		freeIds.push_back(obj->id);
+		delete obj;
+	}
+	removed.clear();
+}
+
+// Same format as SnapshotEncoder::encode, from the decoded copy instead of the scene
+string_view Relay::encode(Downstream* client) {
+	auto& cache = client->cache;
+	auto& cache_set = client->cache_set;
+
+	Writer w;
+
+	w.write<uint8_t>(MSG_SNAPSHOT);
+	w.write<uint8_t>(PROTO_VER[0]);
+	w.write<uint8_t>(PROTO_VER[1]);
+	w.write<uint8_t>(PROTO_VER[2]);
+
+	// Upstream's stamp, clients only ever compare it against other stamps
+	w.write<int64_t>(timestamp);
+	w.write<uint64_t>(tick);
+	w.write<float>(step);
+
+	auto& count = w.ref<uint32_t>(1);
+
+	w.write<uint32_t>(client->pid);
+	w.write<PlayerState>(client->state);
+	w.write<uint32_t>(client->inputSeq);
+
+	for (auto& p : players) {
+		if (p.pid == client->pid) continue;
+
+		w.write<uint32_t>(p.pid);
+		w.write<PlayerState>(p.state);
+		count++;
+	}
+
+	uint32_t cacheSize = cache.size();
+	w.write<uint32_t>(cacheSize);
+
+	uint32_t write_id = 0;
+
+	for (uint32_t i = 0; i < cacheSize; i++) {
+		if (write_id < i) cache[write_id] = cache[i];
+		auto& entry = cache[write_id];
+		auto obj = entry.obj;
+
+		if (obj->removed) {
+			w.write<uint8_t>(UPD_STATE | OBJ_REMOVE);
+			cache_set[obj->id] = 0;
+			continue;
+		}
+		write_id++;
+
+		uint32_t newFlags = obj->fixed || obj->sleeping ? OBJ_SLEEP : 0;
+		bool sleepToggled = (entry.flags ^ newFlags) & OBJ_SLEEP;
+		entry.flags = newFlags;
+
+		if (sleepToggled) {
+			if (newFlags & OBJ_SLEEP) {
+				w.write<uint8_t>(UPD_STATE | OBJ_SLEEP);
+				w.write<PxVec3>(obj->pos);
+				w.write<PxQuat>(obj->quat);
+				entry.pos = obj->pos;
+			} else {
+				w.write<uint8_t>(UPD_STATE);
+				vec3_24_delta_encode(entry.pos, obj->pos, w.ref<uint8_t>(UPD_OBJ), w.ref<uint8_t>(), w.ref<uint8_t>(), w.ref<uint8_t>());
+				w.write<uint32_t>(quat_sm3_encode(obj->quat));
+			}
+		} else if (newFlags & OBJ_SLEEP) {
+			w.write<uint8_t>(UPD_STATE | OBJ_SLEEP);
+		} else {
+			auto& header = w.ref<uint8_t>(UPD_OBJ);
+			auto& x = w.ref<uint8_t>();
+			auto& y = w.ref<uint8_t>();
+			auto& z = w.ref<uint8_t>();
+			vec3_24_delta_encode(entry.pos, obj->pos, header, x, y, z);
+			w.write<uint32_t>(quat_sm3_encode(obj->quat));
+		}
+	}
+
+	cache.resize(write_id);
+
+	auto& adding = w.ref<uint32_t>();
+
+	for (auto obj : objects) {
+		if (obj->removed || cache_set[obj->id]) continue;
+		if (obj->remoteOf && obj->remoteOf == client->pid) continue;
+
+		auto& header = w.ref<uint8_t>(obj->fixed ? ADD_OBJ_ST : ADD_OBJ_DY);
+		header |= obj->type;
+
+		PxVec3 toCache;
+		vec3_48_encode_wb(toCache, obj->pos, w.ref<uint16_t>(), w.ref<uint16_t>(), w.ref<uint16_t>());
+		w.write<uint32_t>(quat_sm3_encode(obj->quat));
+
+		if (obj->type == BOX_T) {
+			w.write<PxVec3>(obj->extents);
+		} else if (obj->type == SPH_T) {
+			w.write<float>(obj->dims[0]);
+		} else if (obj->type == CPS_T) {
+			w.write<float>(obj->dims[0]);
+			w.write<float>(obj->dims[1]);
+		}
+
+		cache.push_back({ obj, 0, toCache });
+		cache_set[obj->id] = 1;
+
+		adding++;
+	}
+
+	w.write<uint32_t>(cache.size());
+
+	return w.lz4();
+}
+
+void Relay::pollBus() {
+	while (polling) {
+		if (!bus->heartbeat(lane)) {
+			printf("[relay] lost lane %d, the sim took it back\n", lane);
+			exit(1);
+		}
+
+		bool applied = false;
+		auto latest = bus->latest();
+		if (!nextFrame) nextFrame = latest + 1;
+
+		// Every frame in order, the journal doesn't skip. One fan-out for the lot
+		while (nextFrame <= latest) {
+			auto result = bus->read(nextFrame++, frame);
+			if (result != SnapshotBus::READ || !onFrame(frame)) {
+				startOver();
+				nextFrame = bus->latest() + 1;
+				break;
+			}
+			applied |= !syncing;
+		}
+
+		if (applied) {
+			stats.snapshots++;
+			fanOut();
+		} else {
+			std::this_thread::sleep_for(microseconds(500));
+		}
+	}
+}
+
+// Lapped or reset: clients see everything removed and added again with the next full frame
+void Relay::startOver() {
+	syncing = true;
+	for (auto& obj : byId) {
+		if (!obj) continue;
+		obj->removed = true;
+		removed.push_back(obj);
+		obj = nullptr;
+	}
+	bus->requestResync(lane);
+	stats.resyncs++;
+}
+
+// Frame layout in server/bus.hpp
+bool Relay::onFrame(string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+
+	auto flags = r.read<uint8_t>();
+	if (flags & BUS_RESET) return false;
+	if (syncing && !(flags & BUS_FULL)) return true;
+
+	timestamp = r.read<int64_t>();
+	tick = r.read<uint64_t>();
+	step = r.read<float>();
+
+	auto count = r.read<uint32_t>();
+	players.clear();
+	for (uint32_t i = 0; i < count && !error; i++) {
+		RemotePlayer p;
+		p.pid = r.read<uint32_t>();
+		p.state = r.read<PlayerState>();
+		players.push_back(p);
+	}
+
+	// Only this lane's players are ours
+	count = r.read<uint32_t>();
+	{
+		scoped_lock lock(relay_mutex);
+		for (uint32_t i = 0; i < count && !error; i++) {
+			auto key = r.read<uint32_t>();
+			auto pid = r.read<uint32_t>();
+			auto seq = r.read<uint32_t>();
+			auto state = r.read<PlayerState>();
+			if (error || (key >> 16) != uint32_t(lane + 1)) continue;
+
+			auto it = slots.find(key & 0xFFFF);
+			if (it == slots.end()) continue;
+
+			auto client = it->second;
+			client->pid = pid;
+			client->inputSeq = seq;
+			client->state = state;
+			client->ready = true;
+		}
+	}
+
+	count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && !error; i++) {
+		auto& obj = byId[r.read<uint16_t>()];
+		if (!obj) continue;
+		obj->removed = true;
+		removed.push_back(obj);
+		obj = nullptr;
+	}
+
+	count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && !error; i++) readEntry(r);
+
+	count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && !error; i++) {
+		auto obj = byId[r.read<uint16_t>()];
+		auto sleeping = r.read<uint8_t>();
+		auto pos = r.read<PxVec3>();
+		auto quat = r.read<PxQuat>();
+		if (!obj) continue;
+		obj->sleeping = sleeping;
+		obj->pos = pos;
+		obj->quat = quat;
+	}
+
+	// The rest of the world, only needed when starting over
+	if (syncing) {
+		count = r.read<uint32_t>();
+		for (uint32_t i = 0; i < count && !error; i++) readEntry(r);
+		syncing = false;
+	}
+
+	return !error;
+}
+
+void Relay::readEntry(Reader& r) {
+	auto id = r.read<uint16_t>();
+	auto obj = new Object();
+	obj->type = r.read<uint8_t>();
+	obj->fixed = r.read<uint8_t>();
+	obj->sleeping = r.read<uint8_t>();
+	obj->remoteOf = r.read<uint32_t>();
+	auto dims = r.read<PxVec3>();
+	obj->pos = r.read<PxVec3>();
+	obj->quat = r.read<PxQuat>();
+
+	if (obj->type == BOX_T) obj->extents = dims;
+	obj->dims[0] = dims.x;
+	obj->dims[1] = dims.y;
+
+	if (freeIds.empty()) {
+		delete obj;
+		return;
+	}
+
+	// Ids don't go around within a frame without a removal first, but don't leak one if they did
+	auto& slot = byId[id];
+	if (slot) {
+		slot->removed = true;
+		removed.push_back(slot);
+	}
+
+	obj->id = freeIds.back();
+	freeIds.pop_back();
+	objects.push_back(obj);
+	slot = obj;
+}
+
+void Relay::Downstream::onData(string_view buffer) {
+	if (buffer.empty()) return;
+
+	if (buffer[0] == MSG_PING) {
+		auto reply = ClockSync::pong(buffer, ClockSync::now());
+		if (reply.size()) send(reply, true);
+		return;
+	}
+
+	if (buffer[0] == MSG_PONG) {
+		scoped_lock lock(clock_mutex);
+		if (!clock.onPong(buffer, ClockSync::now())) printf("[relay] bad pong\n");
+		return;
+	}
+
+	if (buffer[0] != MSG_INPUT || buffer.size() != 1 + sizeof(uint32_t) + sizeof(PlayerInput)) {
+		printf("[relay] unknown message\n");
+		return;
+	}
+
+	// Passed straight on, tagged with the slot
+	Writer w;
+	w.write<uint8_t>(MSG_RELAY_INPUT);
+	w.write<uint32_t>(slot);
+	w.write(buffer.substr(1), false);
+	relay->upstreamSend(w.finalize());
+}
@@ -1,4 +1,5 @@
 #include "common.hpp"
+#include "snapshot.hpp"
 
 #include "../../server/game.hpp"
 #include "../util/reader.hpp"
@@ -8,40 +9,143 @@
 using namespace bitmagic;
 
 void PhysXServer::Handle::onData(string_view buffer) {
+	if (buffer.empty()) return;
+
+	if (buffer[0] == MSG_PING) {
+		auto reply = ClockSync::pong(buffer, ClockSync::now());
+		if (reply.size()) send(reply, true);
+		return;
+	}
+
+	if (buffer[0] == MSG_PONG) {
+		scoped_lock lock(clock_mutex);
+		if (!clock.onPong(buffer, ClockSync::now())) printf("[handle] bad pong\n");
+		return;
+	}
+
 	bool error = false;
 	Reader r(buffer, error);
 
-	{
-		scoped_lock lock(input_mutex);
-		r.read<PlayerInput>(input);
+	auto type = r.read<uint8_t>();
+	if (type >= MSG_RELAY_HELLO && type <= MSG_RELAY_INPUT) {
+		onRelay(type, r);
+		return;
 	}
 
+	if (type != MSG_INPUT) {
+		printf("[handle] unknown message\n");
+		return;
+	}
+
+	auto seq = r.read<uint32_t>();
+	PlayerInput next;
+	r.read<PlayerInput>(next);
+
 	if (error) {
 		printf("[handle] input error\n");
+	} else {
+		// Never waits on the tick thread, the world applies them in order, one per step
+		postInput(next, seq);
+	}
+}
+
+void PhysXServer::Handle::onRelay(uint8_t type, Reader& r) {
+	auto server = getServer();
+	auto slot = r.read<uint32_t>();
+
+	if (type == MSG_RELAY_HELLO) {
+		server->post([this] {
+			scoped_lock lock(relay_mutex);
+			if (relay || !getWorld()->park(this)) return;
+			relay = true;
+			printf("[handle] #%u is a relay\n", pid);
+		});
+	} else if (type == MSG_RELAY_JOIN) {
+		if (!slot || slot > 0xFFFF) return;
+		server->post([this, slot] {
+			scoped_lock lock(relay_mutex);
+			if (!relay || released || relayed.count(slot)) return;
+
+			auto world = getWorld();
+			auto player = new Relayed(pid << 16 | slot, slot);
+			world->spawn(player, world->spawner.center + PxVec3(25.f, 25.f, 25.f));
+			relayed[slot] = player;
+		});
+	} else if (type == MSG_RELAY_LEAVE) {
+		server->post([this, slot] {
+			scoped_lock lock(relay_mutex);
+			auto it = relayed.find(slot);
+			if (it == relayed.end()) return;
+			getWorld()->destroy(it->second);
+			relayed.erase(it);
+		});
+	} else if (type == MSG_RELAY_INPUT) {
+		auto seq = r.read<uint32_t>();
+		PlayerInput next;
+		r.read<PlayerInput>(next);
+		if (!r.eof()) return; // short or trailing bytes
+
+		scoped_lock lock(relay_mutex);
+		auto it = relayed.find(slot);
+		if (it != relayed.end()) it->second->postInput(next, seq);
 	}
 }
 
 void PhysXServer::Handle::updateState(World* world) {
+	// States of the relay's players first, its clients' snapshots are built from the one below.
+	// Only this part holds relay_mutex, relayed inputs never wait on the encode
+	{
+		scoped_lock relayLock(relay_mutex);
+		if (relay) {
+			Writer w;
+			w.write<uint8_t>(MSG_RELAY_STATES);
+			w.write<uint32_t>(relayed.size());
+			for (auto& [slot, player] : relayed) {
+				w.write<uint32_t>(slot);
+				w.write<uint32_t>(player->pid);
+				w.write<uint32_t>(player->inputSeq);
+				w.write<PlayerState>(player->state);
+			}
+			send(w.finalize(), true);
+		}
+	}
+
+	send(encoder.encode(world, this), true, COMP_LZ4);
+
+	bool ping;
+	auto now = ClockSync::now();
+	{
+		scoped_lock lock(clock_mutex);
+		ping = clock.due(now);
+	}
+	if (ping) send(ClockSync::ping(now), true);
+}
+
+string_view SnapshotEncoder::encode(World* world, Player* self) {
 	auto& players = world->players;
 	auto& curr = world->objects;
-	auto& masks = world->used_obj_masks;
 
 	Writer w;
 
+	w.write<uint8_t>(MSG_SNAPSHOT);
 	w.write<uint8_t>(PROTO_VER[0]);
 	w.write<uint8_t>(PROTO_VER[1]);
 	w.write<uint8_t>(PROTO_VER[2]);
 
 	int64_t timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 	w.write<int64_t>(timestamp);
+	w.write<uint64_t>(world->tick);
+	w.write<float>(world->getStep()); // seconds per input, the client predicts with it
 
-	w.write<uint32_t>(players.size());
+	// A parked self isn't in the list but still goes first
+	w.write<uint32_t>(players.size() + (self->parked ? 1 : 0));
 
-	w.write<uint32_t>(pid);
-	w.write<PlayerState>(state);
+	w.write<uint32_t>(self->pid);
+	w.write<PlayerState>(self->state);
+	w.write<uint32_t>(self->inputSeq); // last input simulated, for client side reconciliation
 
 	for (auto& p : players) {
-		if (p == this) continue;
+		if (p == self) continue;
 
 		w.write<uint32_t>(p->pid);
 		w.write<PlayerState>(p->state);
@@ -65,18 +169,18 @@ void PhysXServer::Handle::updateState(World* world) {
 		auto& prevFlags = entry->flags;
 		auto& prevPos = entry->pos;
 
-		// We need to make sure cached obj is still in memory at this point
-		if (!masks[entry->obj->id]) {
+		auto obj = world->resolve(entry->handle);
+		if (!obj) {
 			// remove
 			w.write<uint8_t>(UPD_STATE | OBJ_REMOVE);
-			cache_set[entry->obj->id] = 0;
+			cache_set[Slab<PrimitiveObject>::indexOf(entry->handle)] = 0;
 		} else {
 			write_id++; // Keep current cache in the array
 
-			auto actor = entry->obj->actor;
+			auto actor = obj->actor;
 
 			uint32_t newFlags = 0;
-			if (actor->is<PxRigidStatic>() ||
+			if (actor->is<PxRigidStatic>() || obj->frozen ||
 				actor->is<PxRigidDynamic>() &&
 				actor->is<PxRigidDynamic>()->isSleeping()) newFlags |= OBJ_SLEEP;
 
@@ -132,6 +236,8 @@ void PhysXServer::Handle::updateState(World* world) {
 	for (auto& obj : curr) {
 		// already cached or does not have an assigned ID
 		if (!obj->id || cache_set[obj->id]) continue;
+		// Their own body mirrored back from another shard
+		if (obj->remoteOf && obj->remoteOf == self->pid) continue;
 
 		auto actor = obj->actor;
 		if (actor->getShapes(&shape, 1) != 1) continue;
@@ -172,7 +278,7 @@ void PhysXServer::Handle::updateState(World* world) {
 		}
 
 		// Add to cache
-		cache.push_back({ obj, 0, toCache });
+		cache.push_back({ obj->handle, 0, toCache });
 		cache_set[obj->id] = 1;
 
 		adding++;
@@ -188,5 +294,5 @@ void PhysXServer::Handle::updateState(World* world) {
 
 	// LZ4 95%-99% but only takes ~0.05-0.07ms
 	// printf("Compression rate: %.2f%%, dt = %.10f\n", 100.f * buf.size() / og, dt);
-	send(buf, true, COMP_LZ4);
+	return buf;
 }
\ No newline at end of file
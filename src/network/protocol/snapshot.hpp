@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <bitset>
+#include <string_view>
+
+#include "../../world/world.hpp"
+
+using std::vector;
+using std::bitset;
+using std::string_view;
+
+// Delta encoder for one observer, remembers what the observer has already been sent
+class SnapshotEncoder {
+	// By handle, an object freed since the last snapshot no longer resolves (even if its id and
+	// memory went to a new one)
+	struct CacheItem {
+		uint32_t handle;
+		uint32_t flags;
+		PxVec3 pos;
+	};
+
+	vector<CacheItem> cache;
+	bitset<65536> cache_set;
+
+public:
+	// Implemented in network/protocol/server-tick.cpp. Needs the world thread (scene read lock
+	// and player list held, same as Player::updateState). Returns an lz4 buffer the caller frees
+	string_view encode(World* world, Player* self);
+};
@@ -4,20 +4,21 @@
 
 // The QUIC API/function table returned from MsQuicOpen. It contains all the
 // functions called by the app to interact with MsQuic.
-const QUIC_API_TABLE* MsQuic;
+static const QUIC_API_TABLE* MsQuic;
 
 // The QUIC handle to the registration object. This is the top level API object
 // that represents the execution context for all work done by MsQuic on behalf
 // of the app.
-HQUIC Registration;
+static HQUIC Registration;
 
 // The QUIC handle to the configuration object. This object abstracts the
 // connection configuration. This includes TLS configuration and any other
 // QUIC layer settings.
-HQUIC Configuration;
+static HQUIC Configuration;
 
 QUIC_STATUS ClientStreamCallback(HQUIC stream, void* self, QUIC_STREAM_EVENT* event) {
-    auto client = static_cast<QuicClient*>(self);
+    auto quic = static_cast<QuicClient*>(self);
+    auto client = quic->client;
 
     switch (event->Type) {
         case QUIC_STREAM_EVENT_START_COMPLETE:
@@ -57,7 +58,8 @@ QUIC_STATUS ClientStreamCallback(HQUIC stream, void* self, QUIC_STREAM_EVENT* ev
 }
 
 QUIC_STATUS ClientConnectionCallback(HQUIC conn, void* self, QUIC_CONNECTION_EVENT* event) {
-    auto client = static_cast<QuicClient*>(self);
+    auto quic = static_cast<QuicClient*>(self);
+    auto client = quic->client;
 
     switch (event->Type) {
         case QUIC_CONNECTION_EVENT_CONNECTED:
@@ -87,8 +89,8 @@ QUIC_STATUS ClientConnectionCallback(HQUIC conn, void* self, QUIC_CONNECTION_EVE
             if (!event->SHUTDOWN_COMPLETE.AppCloseInProgress) {
                 MsQuic->ConnectionClose(conn);
             }
-            client->onDisconnect();
-            client->cv.notify_all();
+            client->detach();
+            delete quic;
             break;
         case QUIC_CONNECTION_EVENT_RESUMPTION_TICKET_RECEIVED:
             // A resumption ticket (also called New Session Ticket or NST) was
@@ -106,8 +108,8 @@ QUIC_STATUS ClientConnectionCallback(HQUIC conn, void* self, QUIC_CONNECTION_EVE
         case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED:
             // The server has created a new stream. The app MUST set the callback handler before returning.
             printf("[strm][%p] Stream started by server \n", event->PEER_STREAM_STARTED.Stream);
-            client->stream = event->PEER_STREAM_STARTED.Stream;
-            MsQuic->SetCallbackHandler(event->PEER_STREAM_STARTED.Stream, (void*) ClientStreamCallback, client);
+            quic->stream = event->PEER_STREAM_STARTED.Stream;
+            MsQuic->SetCallbackHandler(event->PEER_STREAM_STARTED.Stream, (void*) ClientStreamCallback, quic);
             break;
         case QUIC_CONNECTION_EVENT_DATAGRAM_STATE_CHANGED:
             printf("[conn][%p] Datagram state changed: %u\n", conn, uint8_t(event->DATAGRAM_SEND_STATE_CHANGED.State));
@@ -186,14 +188,18 @@ int QuicClient::init(bool insecure) {
     return 0;
 }
 
-bool QuicClient::connect(string host, uint16_t port) {
+QuicClient* QuicClient::connect(NetClient* client, string host, uint16_t port) {
     QUIC_STATUS status = QUIC_STATUS_SUCCESS;
 
+    auto quic = new QuicClient(client);
+    auto& conn = quic->conn;
+
     // Allocate a new connection object.
-    status = MsQuic->ConnectionOpen(Registration, ClientConnectionCallback, this, &conn);
+    status = MsQuic->ConnectionOpen(Registration, ClientConnectionCallback, quic, &conn);
     if (QUIC_FAILED(status)) {
         printf("ConnectionOpen failed, 0x%x!\n", status);
-        return false;
+        delete quic;
+        return nullptr;
     }
 
     // Use resume ticket
@@ -204,36 +210,60 @@ bool QuicClient::connect(string host, uint16_t port) {
         status = MsQuic->SetParam(conn, QUIC_PARAM_LEVEL_CONNECTION, QUIC_PARAM_CONN_RESUMPTION_TICKET, TicketLength, ResumptionTicket);
         if (QUIC_FAILED(status)) {
             printf("SetParam(QUIC_PARAM_CONN_RESUMPTION_TICKET) failed, 0x%x!\n", status);
-            return 1;
+            MsQuic->ConnectionClose(conn);
+            delete quic;
+            return nullptr;
         }
     }
 
     printf("[conn][%p] Connecting...\n", conn);
 
-    MsQuic->ConnectionStart(conn, Configuration, QUIC_ADDRESS_FAMILY_UNSPEC, host.c_str(), port);
+    client->link = quic;
+
+    status = MsQuic->ConnectionStart(conn, Configuration, QUIC_ADDRESS_FAMILY_UNSPEC, host.c_str(), port);
     if (QUIC_FAILED(status)) {
         printf("ConnectionStart failed, 0x%x!\n", status);
-        return false;
+        client->link = nullptr;
+        MsQuic->ConnectionClose(conn);
+        delete quic;
+        return nullptr;
     }
 
-    return true;
+    return quic;
 }
 
-void QuicClient::disconnect() {
-    if (isConnected()) {
-        MsQuic->ConnectionShutdown(conn, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
+void QuicClient::close() {
+    if (!conn) return;
+
+    // This object is deleted by the shutdown callback, don't touch it after waiting
+    auto c = client;
+    MsQuic->ConnectionShutdown(conn, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
 
-        mutex m;
-        std::unique_lock<mutex> lk(m);
-        cv.wait_for(lk, std::chrono::seconds{ 10 });
-    };
+    std::unique_lock<mutex> lk(c->cv_mutex);
+    c->cv.wait_for(lk, std::chrono::seconds{ 10 }, [c] { return !c->link; });
 }
 
 bool QuicClient::send(string_view buffer, bool freeAfterSend, uint8_t compression) {
-    if (!stream) return false;
+    if (!stream) {
+        if (freeAfterSend) free((void*) buffer.data());
+        return false;
+    }
     auto req = new SendReq(buffer, freeAfterSend, compression);
     auto status = MsQuic->StreamSend(stream, req->buffers, 2, QUIC_SEND_FLAG_ALLOW_0_RTT, req);
-    return !QUIC_FAILED(status);
+    if (QUIC_FAILED(status)) {
+        delete req;
+        return false;
+    }
+    return true;
+}
+
+uint64_t QuicClient::rttMicro() {
+    if (!conn) return 0;
+
+    QUIC_STATISTICS stats;
+    uint32_t size = sizeof(stats);
+    auto status = MsQuic->GetParam(conn, QUIC_PARAM_LEVEL_CONNECTION, QUIC_PARAM_CONN_STATISTICS, &size, &stats);
+    return QUIC_FAILED(status) ? 0 : stats.Rtt;
 }
 
 void QuicClient::cleanup() {
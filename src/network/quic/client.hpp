@@ -14,16 +14,19 @@
 #include <mutex>
 #include <condition_variable>
 
-#include "message.hpp"
+#include "../transport.hpp"
 
 using std::mutex;
 using std::string;
 using std::condition_variable;
 
-class QuicClient : public MessageProtocol {
+// QUIC transport for a NetClient
+class QuicClient : public Link {
 	HQUIC conn;
+
+	QuicClient(NetClient* client) : conn(nullptr), client(client), stream(nullptr) {};
 public:
-	condition_variable cv;
+	NetClient* client;
 
 	struct SendReq {
 		bool freeAfterSend;
@@ -48,18 +51,11 @@ public:
 	static int init(bool insecure);
 	static void cleanup();
 
-	QuicClient() : MessageProtocol(2 * 1024 * 1024, 5 * 1024 * 1024), conn(nullptr), stream(nullptr) {};
-	~QuicClient() { disconnect(); };
-
-	bool connect(string host, uint16_t port);
-	void disconnect();
-
-	bool send(string_view buffer, bool freeAfterSend, uint8_t compression = COMP_NONE);
-
-	virtual void onConnect() {};
-	virtual void onDisconnect() { conn = nullptr; };
-	virtual void onError() {};
-	virtual void onData(string_view buffer) {};
+	// Not blocking, client->link is set right away and client->onConnect fires after the handshake.
+	// The link deletes itself once the connection is shut down
+	static QuicClient* connect(NetClient* client, string host, uint16_t port);
 
-	bool isConnected() { return !!conn; };
-};
\ No newline at end of file
+	bool send(string_view buffer, bool freeAfterSend, uint8_t compression);
+	void close();
+	uint64_t rttMicro();
+};
@@ -4,17 +4,17 @@
 
 // The QUIC API/function table returned from MsQuicOpen. It contains all the
 // functions called by the app to interact with MsQuic.
-const QUIC_API_TABLE* MsQuic;
+static const QUIC_API_TABLE* MsQuic;
 
 // The QUIC handle to the registration object. This is the top level API object
 // that represents the execution context for all work done by MsQuic on behalf
 // of the app.
-HQUIC Registration;
+static HQUIC Registration;
 
 // The QUIC handle to the configuration object. This object abstracts the
 // connection configuration. This includes TLS configuration and any other
 // QUIC layer settings.
-HQUIC Configuration;
+static HQUIC Configuration;
 
 typedef struct QUIC_CREDENTIAL_CONFIG_HELPER {
     QUIC_CREDENTIAL_CONFIG CredConfig;
@@ -29,7 +29,8 @@ typedef struct QUIC_CREDENTIAL_CONFIG_HELPER {
 // Terrifying microsoft dev code
 
 QUIC_STATUS ServerStreamCallback(HQUIC stream, void* ptr, QUIC_STREAM_EVENT* Event) {
-    auto ctx = static_cast<QuicServer::Connection*>(ptr);
+    auto link = static_cast<QuicServer::Link*>(ptr);
+    auto ctx = link->ctx;
 
     switch (Event->Type) {
         case QUIC_STREAM_EVENT_SEND_COMPLETE: {
@@ -72,7 +73,8 @@ QUIC_STATUS ServerStreamCallback(HQUIC stream, void* ptr, QUIC_STREAM_EVENT* Eve
 }
 
 QUIC_STATUS ServerConnectionCallback(HQUIC conn, void* ptr, QUIC_CONNECTION_EVENT* event) {
-    auto ctx = static_cast<QuicServer::Connection*>(ptr);
+    auto link = static_cast<QuicServer::Link*>(ptr);
+    auto ctx = link->ctx;
 
     switch (event->Type) {
         case QUIC_CONNECTION_EVENT_CONNECTED: {
@@ -81,22 +83,21 @@ QUIC_STATUS ServerConnectionCallback(HQUIC conn, void* ptr, QUIC_CONNECTION_EVEN
             printf("[conn][%p] Client Connected\n", conn);
             MsQuic->ConnectionSendResumptionTicket(conn, QUIC_SEND_RESUMPTION_FLAG_NONE, 0, NULL);
 
-            auto status = MsQuic->StreamOpen(conn, QUIC_STREAM_OPEN_FLAG_0_RTT, ServerStreamCallback, ctx, &ctx->stream);
+            auto status = MsQuic->StreamOpen(conn, QUIC_STREAM_OPEN_FLAG_0_RTT, ServerStreamCallback, link, &link->stream);
 
             if (QUIC_FAILED(status)) {
                 printf("[conn][%p] Failed to open stream\n", conn);
                 break;
             }
 
-            status = MsQuic->StreamStart(ctx->stream, QUIC_STREAM_START_FLAG_NONE);
+            status = MsQuic->StreamStart(link->stream, QUIC_STREAM_START_FLAG_NONE);
             if (QUIC_FAILED(status)) {
                 printf("[conn][%p] Failed to start stream\n", conn);
-                MsQuic->StreamClose(ctx->stream);
+                MsQuic->StreamClose(link->stream);
                 break;
             }
 
-            ctx->onConnect();
-            ctx->server->sync([&] { ctx->server->connections.push_back(ctx); });
+            link->server->target->attach(ctx);
 
             break;
         }
@@ -128,10 +129,10 @@ QUIC_STATUS ServerConnectionCallback(HQUIC conn, void* ptr, QUIC_CONNECTION_EVEN
 
             printf("[conn][%p] Client shutdown complete\n", conn);
 
-            ctx->server->sync([&] { ctx->server->connections.remove(ctx); });
-            ctx->onDisconnect();
+            link->server->target->detach(ctx);
 
             MsQuic->ConnectionClose(conn);
+            delete link;
             break;
         }
         case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED:
@@ -170,12 +171,14 @@ QUIC_STATUS ServerListenerCallback(HQUIC listener, void* self, QUIC_LISTENER_EVE
         case QUIC_LISTENER_EVENT_NEW_CONNECTION: {
             auto conn = Event->NEW_CONNECTION.Connection;
 
-            auto client = server->client();
-            client->conn = conn;
-            client->server = server;
-            client->stream = nullptr;
+            auto link = new QuicServer::Link();
+            link->server = server;
+            link->ctx = server->target->client();
+            link->ctx->server = server->target;
+            link->ctx->link = link;
+            link->conn = conn;
 
-            MsQuic->SetCallbackHandler(conn, (void*) ServerConnectionCallback, client);
+            MsQuic->SetCallbackHandler(conn, (void*) ServerConnectionCallback, link);
             status = MsQuic->ConnectionSetConfiguration(Event->NEW_CONNECTION.Connection, Configuration);
             break;
         }
@@ -288,7 +291,7 @@ bool QuicServer::stop() {
     } else return false;
 }
 
-void QuicServer::Connection::disconnect() {
+void QuicServer::Link::close() {
     if (!stream && !conn) return;
 
     MsQuic->StreamShutdown(stream, QUIC_STREAM_SHUTDOWN_FLAG_GRACEFUL, 0);
@@ -298,25 +301,27 @@ void QuicServer::Connection::disconnect() {
     conn = nullptr;
 }
 
-void QuicServer::Connection::send(string_view buffer, bool freeAfterSend, uint8_t compressionMethod) {
+bool QuicServer::Link::send(string_view buffer, bool freeAfterSend, uint8_t compressionMethod) {
     auto req = new SendReq(buffer, 1, freeAfterSend, compressionMethod);
+    if (!stream) {
+        delete req;
+        return false;
+    }
     auto status = MsQuic->StreamSend(stream, req->buffers, 2, QUIC_SEND_FLAG_ALLOW_0_RTT, req);
-    if (QUIC_FAILED(status)) delete req;
+    if (QUIC_FAILED(status)) {
+        delete req;
+        return false;
+    }
+    return true;
 }
 
-void QuicServer::broadcast(string_view buffer, bool freeAfterSend, bool compress) {
-    std::scoped_lock lock(m);
-    if (!connections.size()) return;
-
-    auto req = new SendReq(buffer, uint32_t(connections.size()), freeAfterSend, compress);
+uint64_t QuicServer::Link::rttMicro() {
+    if (!conn) return 0;
 
-    for (auto ctx : connections) {
-        auto status = MsQuic->StreamSend(ctx->stream, req->buffers, 2, QUIC_SEND_FLAG_ALLOW_0_RTT, req);
-        if (QUIC_FAILED(status)) {
-            req->ref--;
-            printf("Failed to send???\n");
-        }
-    }
+    QUIC_STATISTICS stats;
+    uint32_t size = sizeof(stats);
+    auto status = MsQuic->GetParam(conn, QUIC_PARAM_LEVEL_CONNECTION, QUIC_PARAM_CONN_STATISTICS, &size, &stats);
+    return QUIC_FAILED(status) ? 0 : stats.Rtt;
 }
 
 void QuicServer::cleanup() {
@@ -12,38 +12,28 @@
 #include <string>
 #include <string_view>
 #include <stdlib.h>
-#include <list>
-#include <mutex>
 #include <atomic>
 
-#include "message.hpp"
+#include "../transport.hpp"
 
 using std::string;
-using std::list;
 using std::string_view;
-using std::mutex;
 using std::atomic;
 
+// QUIC transport, accepts connections on behalf of a NetServer
 class QuicServer {
 public:
 
-	class Connection : public MessageProtocol {
+	class Link : public ::Link {
 	public:
-		QuicServer* server = nullptr; // terrible design but no other way around ):
+		QuicServer* server = nullptr;
+		NetServer::Connection* ctx = nullptr;
 		HQUIC conn = nullptr;
 		HQUIC stream = nullptr; // can be list of streams
 
-		Connection() : MessageProtocol(1024) {};
-
-		virtual ~Connection() {};
-
-		virtual void onError() {};
-		virtual void onConnect() {};
-		virtual void onData(string_view buffer) {};
-		virtual void onDisconnect() {};
-
-		void send(string_view buffer, bool freeAfterSend, uint8_t compressionMethod = COMP_NONE);
-		void disconnect();
+		bool send(string_view buffer, bool freeAfterSend, uint8_t compressionMethod);
+		void close();
+		uint64_t rttMicro();
 	};
 
 	struct RefCounter {
@@ -72,42 +62,17 @@ public:
 		}
 	};
 
-	QuicServer() : listener(nullptr) {};
-	~QuicServer() { stop(); };
+	NetServer* target;
 
-	template<typename SyncCallback>
-	inline void sync(const SyncCallback& cb) {
-		m.lock();
-		cb();
-		m.unlock();
-	}
-
-	template<typename T, typename SyncCallback>
-	inline void syncPerConn(const SyncCallback& cb) {
-		m.lock();
-		for (auto& conn : connections) cb((T*&) conn);
-		m.unlock();
-	}
-
-	size_t count() {
-		m.lock();
-		auto size = connections.size();
-		m.unlock();
-		return size;
-	}
+	QuicServer(NetServer* target) : target(target), listener(nullptr) {};
+	~QuicServer() { stop(); };
 
 	bool listen(uint16_t port);
 	bool stop();
 
-	void broadcast(string_view buffer, bool freeAfterSend, bool compress);
-	virtual Connection* client() { return new Connection(); };
-
 	static int init();
 	static void cleanup();
 
-	list<Connection*> connections;
-
 private:
 	HQUIC listener;
-	mutex m; // Guards connections
-};
\ No newline at end of file
+};
@@ -0,0 +1,213 @@
+#include <new>
+#include <cstdio>
+#include <cstring>
+#include <uv.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "bus.hpp"
+
+bool SnapshotBus::map(bool create) {
+	size_t size = sizeof(Layout);
+#ifdef _WIN32
+	auto path = "Local\\" + name;
+	HANDLE handle;
+	if (create) {
+		handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			DWORD(uint64_t(size) >> 32), DWORD(size), path.c_str());
+	} else {
+		handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+	}
+	if (!handle) return false;
+
+	auto ptr = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!ptr) {
+		CloseHandle(handle);
+		return false;
+	}
+	mapping = handle;
+#else
+	auto path = "/" + name;
+	if (create) shm_unlink(path.c_str());
+
+	int fd = shm_open(path.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+	if (fd < 0) return false;
+	if (create && ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(path.c_str());
+		return false;
+	}
+
+	auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		if (create) shm_unlink(path.c_str());
+		return false;
+	}
+#endif
+	layout = static_cast<Layout*>(ptr);
+	owner = create;
+	return true;
+}
+
+SnapshotBus::~SnapshotBus() {
+	if (!layout) return;
+#ifdef _WIN32
+	UnmapViewOfFile(layout);
+	CloseHandle(mapping);
+#else
+	munmap(layout, sizeof(Layout));
+	if (owner) shm_unlink(("/" + name).c_str());
+#endif
+}
+
+SnapshotBus* SnapshotBus::create(const string& name) {
+	auto bus = new SnapshotBus(name);
+	if (!bus->map(true)) {
+		printf("[bus] failed to create %s\n", name.c_str());
+		delete bus;
+		return nullptr;
+	}
+
+	// Fresh pages are zeroed, the atomics still get constructed in place
+	auto layout = new (bus->layout) Layout;
+	for (auto& lane : layout->lanes) {
+		lane.state = FREE;
+		lane.alive = 0;
+		lane.resync = false;
+		lane.head = 0;
+		lane.tail = 0;
+	}
+	for (auto& frame : layout->frames) frame.number = 0;
+	layout->latest = 0;
+	layout->version = VERSION;
+	std::atomic_thread_fence(std::memory_order_release);
+	layout->magic = MAGIC;
+
+	printf("[bus] created %s (%.1fMB)\n", name.c_str(), sizeof(Layout) / 1048576.0);
+	return bus;
+}
+
+SnapshotBus* SnapshotBus::open(const string& name) {
+	auto bus = new SnapshotBus(name);
+	if (!bus->map(false)) {
+		printf("[bus] no bus named %s\n", name.c_str());
+		delete bus;
+		return nullptr;
+	}
+
+	if (bus->layout->magic != MAGIC || bus->layout->version != VERSION) {
+		printf("[bus] %s is not a version %u bus\n", name.c_str(), VERSION);
+		delete bus;
+		return nullptr;
+	}
+	return bus;
+}
+
+bool SnapshotBus::publish(string_view frame) {
+	if (frame.size() > FRAME_BYTES) return false;
+
+	auto number = layout->latest.load(std::memory_order_relaxed) + 1;
+	auto& slot = layout->frames[number % FRAME_SLOTS];
+
+	// Readers copying the old frame see the number change and drop their copy
+	slot.number.store(UINT64_MAX, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(slot.data, frame.data(), frame.size());
+	slot.size = uint32_t(frame.size());
+	slot.number.store(number, std::memory_order_release);
+
+	layout->latest.store(number, std::memory_order_release);
+	return true;
+}
+
+bool SnapshotBus::attached(uint32_t lane) {
+	return layout->lanes[lane].state.load(std::memory_order_acquire) == ATTACHED;
+}
+
+uint64_t SnapshotBus::aliveAt(uint32_t lane) {
+	return layout->lanes[lane].alive.load(std::memory_order_acquire);
+}
+
+void SnapshotBus::detach(uint32_t lane) {
+	auto& l = layout->lanes[lane];
+	l.tail.store(l.head.load(std::memory_order_acquire), std::memory_order_release);
+	l.resync = false;
+	l.state.store(FREE, std::memory_order_release);
+}
+
+bool SnapshotBus::takeResync() {
+	bool any = false;
+	for (auto& lane : layout->lanes) any |= lane.resync.exchange(false, std::memory_order_acq_rel);
+	return any;
+}
+
+bool SnapshotBus::pending() {
+	for (auto& lane : layout->lanes) {
+		if (lane.state.load(std::memory_order_acquire) != ATTACHED) continue;
+		if (lane.head.load(std::memory_order_acquire) != lane.tail.load(std::memory_order_relaxed)) return true;
+	}
+	return false;
+}
+
+int32_t SnapshotBus::attach() {
+	for (uint32_t i = 0; i < MAX_LANES; i++) {
+		auto& lane = layout->lanes[i];
+		uint32_t expected = FREE;
+		if (!lane.state.compare_exchange_strong(expected, ATTACHED, std::memory_order_acq_rel)) continue;
+
+		lane.alive.store(uv_hrtime(), std::memory_order_release);
+		lane.resync.store(true, std::memory_order_release);
+		return int32_t(i);
+	}
+	return -1;
+}
+
+bool SnapshotBus::heartbeat(uint32_t lane) {
+	auto& l = layout->lanes[lane];
+	l.alive.store(uv_hrtime(), std::memory_order_release);
+	return l.state.load(std::memory_order_acquire) == ATTACHED;
+}
+
+void SnapshotBus::leave(uint32_t lane) {
+	layout->lanes[lane].state.store(FREE, std::memory_order_release);
+}
+
+void SnapshotBus::requestResync(uint32_t lane) {
+	layout->lanes[lane].resync.store(true, std::memory_order_release);
+}
+
+bool SnapshotBus::push(uint32_t lane, string_view record) {
+	if (record.size() > sizeof(Record::data)) return false;
+
+	auto& l = layout->lanes[lane];
+	auto h = l.head.load(std::memory_order_relaxed);
+	if (h - l.tail.load(std::memory_order_acquire) >= LANE_RECORDS) return false;
+
+	auto& r = l.records[h % LANE_RECORDS];
+	r.size = uint8_t(record.size());
+	memcpy(r.data, record.data(), record.size());
+	l.head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+SnapshotBus::Read SnapshotBus::read(uint64_t number, string& out) {
+	if (!number || number > latest()) return NONE;
+
+	auto& slot = layout->frames[number % FRAME_SLOTS];
+	if (slot.number.load(std::memory_order_acquire) != number) return LAPPED;
+
+	out.assign(slot.data, slot.size);
+
+	// Still the same frame after the copy, otherwise the writer came around in the middle of it
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.number.load(std::memory_order_relaxed) != number) return LAPPED;
+	return READ;
+}
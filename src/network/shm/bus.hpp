@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+using std::atomic;
+using std::string;
+using std::string_view;
+
+// Shared memory between one simulating process (the writer) and up to MAX_LANES network
+// processes (readers). Frames go one way through a ring of fixed size slots: each reader follows
+// at its own pace and finds out it was lapped from the frame number in the slot. Every reader
+// has a lane back, a single producer / single consumer ring of small records (inputs, joins).
+// Neither side ever waits for the other
+class SnapshotBus {
+public:
+	static constexpr uint32_t MAGIC = 0x50487362;
+	static constexpr uint32_t VERSION = 2;
+	static constexpr uint32_t MAX_LANES = 8;
+	static constexpr uint32_t FRAME_SLOTS = 16;
+	static constexpr size_t FRAME_BYTES = 4 << 20; // a full frame of 65535 objects is ~3.3MB
+	static constexpr uint32_t LANE_RECORDS = 4096;
+	static constexpr size_t RECORD_BYTES = 64;
+
+	// Readers that haven't polled for this long are considered gone, their lane is freed
+	static constexpr uint64_t LANE_TIMEOUT_NANO = 2000000000;
+
+	enum Read { NONE, READ, LAPPED };
+private:
+	enum LaneState : uint32_t { FREE, ATTACHED };
+
+	struct Frame {
+		alignas(64) atomic<uint64_t> number; // frame in the slot, UINT64_MAX while it's written
+		uint32_t size;
+		char data[FRAME_BYTES];
+	};
+
+	struct Record {
+		uint8_t size;
+		char data[RECORD_BYTES - 1];
+	};
+
+	struct Lane {
+		alignas(64) atomic<uint32_t> state;
+		atomic<uint64_t> alive;  // uv_hrtime of the reader's last poll
+		atomic<bool> resync;     // the reader lost its place, wants a full frame
+		alignas(64) atomic<uint64_t> head; // next record written, reader only
+		alignas(64) atomic<uint64_t> tail; // next record read, writer only
+		Record records[LANE_RECORDS];
+	};
+
+	struct Layout {
+		uint32_t magic;
+		uint32_t version;
+		alignas(64) atomic<uint64_t> latest; // last frame published, frames count from 1
+		Lane lanes[MAX_LANES];
+		Frame frames[FRAME_SLOTS];
+	};
+
+	Layout* layout = nullptr;
+	string name;
+	bool owner = false;
+#ifdef _WIN32
+	void* mapping = nullptr;
+#endif
+
+	SnapshotBus(const string& name) : name(name) {};
+	bool map(bool create);
+public:
+	~SnapshotBus();
+
+	// Writer: a fresh bus under name, replacing whatever a crashed writer left behind
+	static SnapshotBus* create(const string& name);
+	// Reader: the bus a writer created, nullptr if there is none (or it's another version)
+	static SnapshotBus* open(const string& name);
+
+	// Writer
+	bool publish(string_view frame); // false if it doesn't fit a slot
+	bool attached(uint32_t lane);
+	uint64_t aliveAt(uint32_t lane);
+	void detach(uint32_t lane);
+	bool takeResync(); // any lane asked for a full frame since the last call
+
+	// Writer, hands every record pushed on the lane so far to fn
+	template<typename F>
+	size_t drain(uint32_t lane, F&& fn) {
+		auto& l = layout->lanes[lane];
+		auto t = l.tail.load(std::memory_order_relaxed);
+		auto h = l.head.load(std::memory_order_acquire);
+		for (auto i = t; i != h; i++) {
+			auto& record = l.records[i % LANE_RECORDS];
+			fn(string_view(record.data, record.size));
+		}
+		l.tail.store(h, std::memory_order_release);
+		return h - t;
+	}
+
+	// Writer, records waiting on any attached lane
+	bool pending();
+
+	// Reader. attach claims a free lane (-1 if all are taken) and asks for a full frame
+	int32_t attach();
+	bool heartbeat(uint32_t lane); // false once the writer freed the lane
+	void leave(uint32_t lane);
+	void requestResync(uint32_t lane);
+	bool push(uint32_t lane, string_view record); // false if it's too big or the lane is full
+
+	// Reader. Copies frame number into out, LAPPED if it was overwritten before (or while) it was copied
+	uint64_t latest() { return layout->latest.load(std::memory_order_acquire); };
+	Read read(uint64_t number, string& out);
+};
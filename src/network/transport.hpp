@@ -0,0 +1,167 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string_view>
+#include <condition_variable>
+#include <stdlib.h>
+#include <string.h>
+
+#include "message.hpp"
+
+using std::list;
+using std::mutex;
+using std::atomic;
+using std::string_view;
+using std::condition_variable;
+
+// Wire side of a connection. Created and owned by a transport (quic, loopback, ...),
+// the protocol side (MessageProtocol) only ever talks to it through this interface
+class Link {
+public:
+	virtual ~Link() {};
+
+	// Same contract for every transport: buffer is framed with the 8 byte message header
+	// and, if freeAfterSend is set, released by the transport once it's done with it
+	virtual bool send(string_view buffer, bool freeAfterSend, uint8_t compression) = 0;
+	virtual void close() = 0;
+
+	// Smoothed RTT as seen by the transport itself, 0 if it doesn't track one
+	virtual uint64_t rttMicro() { return 0; };
+
+	// Frames a buffer with the message header into one allocation
+	static string_view frame(string_view buffer, uint8_t compression) {
+		uint64_t header = buffer.size() | (uint64_t(compression) << (64 - COMP_PROFILE_BITS));
+		auto out = static_cast<char*>(malloc(sizeof(uint64_t) + buffer.size()));
+		memcpy(out, &header, sizeof(uint64_t));
+		memcpy(out + sizeof(uint64_t), buffer.data(), buffer.size());
+		return string_view(out, sizeof(uint64_t) + buffer.size());
+	}
+};
+
+// Transport agnostic server: keeps track of connections handed to it by transports
+class NetServer {
+public:
+
+	class Connection : public MessageProtocol {
+	public:
+		NetServer* server = nullptr; // terrible design but no other way around ):
+		Link* link = nullptr;
+
+		Connection() : MessageProtocol(1024) {};
+
+		virtual ~Connection() {};
+
+		virtual void onError() {};
+		virtual void onConnect() {};
+		virtual void onData(string_view buffer) {};
+		virtual void onDisconnect() {};
+
+		void send(string_view buffer, bool freeAfterSend, uint8_t compressionMethod = COMP_NONE) {
+			if (link) link->send(buffer, freeAfterSend, compressionMethod);
+			else if (freeAfterSend) free((void*) buffer.data());
+		}
+
+		void disconnect() {
+			if (link) link->close();
+		}
+	};
+
+	virtual ~NetServer() {};
+
+	template<typename SyncCallback>
+	inline void sync(const SyncCallback& cb) {
+		m.lock();
+		cb();
+		m.unlock();
+	}
+
+	template<typename T, typename SyncCallback>
+	inline void syncPerConn(const SyncCallback& cb) {
+		m.lock();
+		for (auto& conn : connections) cb((T*&) conn);
+		m.unlock();
+	}
+
+	size_t count() {
+		m.lock();
+		auto size = connections.size();
+		m.unlock();
+		return size;
+	}
+
+	// Called by transports once the connection is usable / after it's gone
+	void attach(Connection* conn) {
+		conn->server = this;
+		conn->onConnect();
+		sync([&] { connections.push_back(conn); });
+	}
+
+	void detach(Connection* conn) {
+		sync([&] { connections.remove(conn); });
+		conn->onDisconnect();
+		conn->link = nullptr;
+	}
+
+	void broadcast(string_view buffer, bool freeAfterSend, uint8_t compress) {
+		std::scoped_lock lock(m);
+		for (auto ctx : connections) {
+			auto copy = static_cast<char*>(malloc(buffer.size()));
+			memcpy(copy, buffer.data(), buffer.size());
+			ctx->send(string_view(copy, buffer.size()), true, compress);
+		}
+		if (freeAfterSend) free((void*) buffer.data());
+	}
+
+	virtual Connection* client() { return new Connection(); };
+
+	list<Connection*> connections;
+
+private:
+	mutex m; // Guards connections
+};
+
+// Transport agnostic client, connected by handing it to a transport (e.g. QuicClient::connect)
+class NetClient : public MessageProtocol {
+public:
+	Link* link = nullptr;
+
+	mutex cv_mutex;
+	condition_variable cv;
+
+	NetClient() : MessageProtocol(2 * 1024 * 1024, 5 * 1024 * 1024) {};
+	virtual ~NetClient() { disconnect(); };
+
+	bool send(string_view buffer, bool freeAfterSend, uint8_t compression = COMP_NONE) {
+		if (link) return link->send(buffer, freeAfterSend, compression);
+		if (freeAfterSend) free((void*) buffer.data());
+		return false;
+	}
+
+	void disconnect() {
+		if (link) link->close();
+	}
+
+	// Called by transports
+	void attach(Link* l) {
+		link = l;
+		onConnect();
+	}
+
+	void detach() {
+		{
+			std::scoped_lock lock(cv_mutex);
+			link = nullptr;
+		}
+		onDisconnect();
+		cv.notify_all();
+	}
+
+	virtual void onConnect() {};
+	virtual void onDisconnect() {};
+	virtual void onError() {};
+	virtual void onData(string_view buffer) {};
+
+	bool isConnected() { return !!link; };
+};
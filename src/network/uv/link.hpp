@@ -0,0 +1,90 @@
+#pragma once
+
+#include <uv.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../transport.hpp"
+
+using std::mutex;
+using std::vector;
+using std::scoped_lock;
+
+// Base for libuv transports. libuv handles are only touched on the loop thread, so sends
+// and closes from other threads (tick thread, client threads) go through an async outbox
+class UvLink : public Link {
+protected:
+	uv_loop_t* loop;
+	uv_async_t async;
+
+	mutex m; // Guards outbox & closing
+	vector<string_view> outbox; // framed buffers
+	bool closing = false;
+	bool shut = false;
+
+	// Last thread a loop callback ran on, close() from the loop thread can't wait on itself
+	std::thread::id owner;
+
+	static void async_cb(uv_async_t* handle) {
+		auto self = static_cast<UvLink*>(handle->data);
+		self->owner = std::this_thread::get_id();
+
+		vector<string_view> buffers;
+		bool close;
+
+		{
+			scoped_lock lock(self->m);
+			buffers.swap(self->outbox);
+			close = self->closing;
+		}
+
+		if (!buffers.empty()) self->flush(buffers);
+		if (close) self->shutdown();
+	}
+
+	void openAsync() {
+		uv_async_init(loop, &async, async_cb);
+		async.data = this;
+	}
+
+	bool onLoopThread() { return owner == std::this_thread::get_id(); }
+
+	// Loop thread, takes ownership of the framed buffers
+	virtual void flush(vector<string_view>& buffers) = 0;
+
+	// Loop thread, detaches the protocol side and closes every handle
+	virtual void shutdown() = 0;
+
+public:
+	UvLink(uv_loop_t* loop) : loop(loop), owner(std::this_thread::get_id()) {};
+
+	bool send(string_view buffer, bool freeAfterSend, uint8_t compression) {
+		auto framed = Link::frame(buffer, compression);
+		if (freeAfterSend) free((void*) buffer.data());
+
+		{
+			scoped_lock lock(m);
+			if (closing) {
+				free((void*) framed.data());
+				return false;
+			}
+			outbox.push_back(framed);
+		}
+
+		uv_async_send(&async);
+		return true;
+	}
+
+	void close() {
+		{
+			scoped_lock lock(m);
+			if (closing) return;
+			closing = true;
+		}
+
+		if (onLoopThread()) shutdown();
+		else uv_async_send(&async);
+	}
+};
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <chrono>
+
+#include "tcp.hpp"
+
+struct WriteReq {
+	uv_write_t req;
+	string_view buffer;
+};
+
+void TcpLink::alloc_cb(uv_handle_t* handle, size_t, uv_buf_t* buf) {
+	auto self = static_cast<TcpLink*>(handle->data);
+	*buf = uv_buf_init(self->readBuffer, sizeof(self->readBuffer));
+}
+
+void TcpLink::read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	auto self = static_cast<TcpLink*>(stream->data);
+	self->owner = std::this_thread::get_id();
+
+	if (nread < 0) {
+		if (nread != UV_EOF) printf("[tcp][%p] read error: %s\n", self, uv_strerror(int(nread)));
+		{
+			scoped_lock lock(self->m);
+			self->closing = true;
+		}
+		self->shutdown();
+		return;
+	}
+
+	if (!nread || !self->proto) return;
+
+	self->proto->received_bytes += nread;
+	self->proto->recv((uint8_t*) buf->base, nread);
+}
+
+void TcpLink::write_cb(uv_write_t* req, int) {
+	auto write = reinterpret_cast<WriteReq*>(req);
+	free((void*) write->buffer.data());
+	delete write;
+}
+
+void TcpLink::close_cb(uv_handle_t* handle) {
+	auto self = static_cast<TcpLink*>(handle->data);
+	if (!--self->handles) delete self;
+}
+
+void TcpLink::open() {
+	uv_tcp_init(loop, &handle);
+	handle.data = this;
+	openAsync();
+	handles = 2;
+}
+
+void TcpLink::start() {
+	uv_tcp_nodelay(&handle, 1);
+	uv_read_start((uv_stream_t*) &handle, alloc_cb, read_cb);
+}
+
+void TcpLink::flush(vector<string_view>& buffers) {
+	for (auto& buffer : buffers) {
+		auto write = new WriteReq();
+		write->buffer = buffer;
+
+		auto buf = uv_buf_init((char*) buffer.data(), (unsigned int) buffer.size());
+		if (uv_write(&write->req, (uv_stream_t*) &handle, &buf, 1, write_cb)) {
+			free((void*) buffer.data());
+			delete write;
+		}
+	}
+}
+
+void TcpLink::shutdown() {
+	if (shut) return;
+	shut = true;
+
+	uv_read_stop((uv_stream_t*) &handle);
+	detach();
+	proto = nullptr;
+
+	{
+		// Nothing will be flushed anymore
+		scoped_lock lock(m);
+		for (auto& buffer : outbox) free((void*) buffer.data());
+		outbox.clear();
+	}
+
+	// Pending writes are cancelled and still go through write_cb
+	uv_close((uv_handle_t*) &handle, close_cb);
+	uv_close((uv_handle_t*) &async, close_cb);
+}
+
+void TcpServer::Link::detach() {
+	if (ctx) server->target->detach(ctx);
+	ctx = nullptr;
+}
+
+void TcpServer::connection_cb(uv_stream_t* stream, int status) {
+	auto server = static_cast<TcpServer*>(stream->data);
+
+	if (status < 0) {
+		printf("[tcp] connection error: %s\n", uv_strerror(status));
+		return;
+	}
+
+	auto link = new Link(server);
+	link->open();
+	link->owner = std::this_thread::get_id();
+
+	if (uv_accept(stream, (uv_stream_t*) &link->handle)) {
+		link->detach();
+		{
+			scoped_lock lock(link->m);
+			link->closing = true;
+		}
+		link->shutdown();
+		return;
+	}
+
+	link->ctx = server->target->client();
+	link->ctx->server = server->target;
+	link->ctx->link = link;
+	link->proto = link->ctx;
+
+	link->start();
+	server->target->attach(link->ctx);
+}
+
+bool TcpServer::listen(uint16_t port) {
+	sockaddr_in addr;
+	uv_ip4_addr("0.0.0.0", port, &addr);
+
+	uv_tcp_init(loop, &listener);
+	listener.data = this;
+
+	auto error = uv_tcp_bind(&listener, (const sockaddr*) &addr, 0);
+	if (!error) error = uv_listen((uv_stream_t*) &listener, 1024, connection_cb);
+
+	if (error) {
+		printf("[tcp] listen failed: %s\n", uv_strerror(error));
+		uv_close((uv_handle_t*) &listener, nullptr);
+		return false;
+	}
+
+	listening = true;
+	printf("[tcp] open on port: %u\n", port);
+	return true;
+}
+
+void TcpServer::stop() {
+	if (!listening) return;
+	listening = false;
+	uv_close((uv_handle_t*) &listener, nullptr);
+}
+
+void TcpClient::detach() {
+	if (client) client->detach();
+	client = nullptr;
+}
+
+void TcpClient::connect_cb(uv_connect_t* req, int status) {
+	auto self = static_cast<TcpClient*>(req->data);
+	self->owner = std::this_thread::get_id();
+
+	if (status < 0) {
+		printf("[tcp] connect failed: %s\n", uv_strerror(status));
+		{
+			scoped_lock lock(self->m);
+			self->closing = true;
+		}
+		self->shutdown();
+		return;
+	}
+
+	self->start();
+	if (self->client) self->client->onConnect();
+}
+
+TcpClient* TcpClient::connect(NetClient* client, uv_loop_t* loop, string host, uint16_t port) {
+	sockaddr_in addr;
+	if (uv_ip4_addr(host == "localhost" ? "127.0.0.1" : host.c_str(), port, &addr)) {
+		printf("[tcp] invalid address: %s\n", host.c_str());
+		return nullptr;
+	}
+
+	auto link = new TcpClient(client, loop);
+	link->open();
+	link->proto = client;
+	link->req.data = link;
+
+	client->link = link;
+
+	auto error = uv_tcp_connect(&link->req, &link->handle, (const sockaddr*) &addr, connect_cb);
+	if (error) {
+		printf("[tcp] connect failed: %s\n", uv_strerror(error));
+		{
+			scoped_lock lock(link->m);
+			link->closing = true;
+		}
+		link->shutdown();
+		return nullptr;
+	}
+
+	return link;
+}
+
+void TcpClient::close() {
+	auto c = client;
+	bool wait = !onLoopThread();
+
+	UvLink::close();
+
+	// Same as quic: block until the loop let go of the client, it's usually deleted right after
+	if (wait && c) {
+		std::unique_lock<mutex> lk(c->cv_mutex);
+		c->cv.wait_for(lk, std::chrono::seconds{ 10 }, [c] { return !c->link; });
+	}
+}
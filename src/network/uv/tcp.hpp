@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+
+#include "link.hpp"
+
+using std::string;
+
+// Plain TCP carrying the same framed message stream as the quic transport, no TLS
+class TcpLink : public UvLink {
+protected:
+	uv_tcp_t handle;
+	MessageProtocol* proto = nullptr;
+	int handles = 0;
+
+	char readBuffer[65536]; // own one, links of one process can be on different loop threads
+
+	static void alloc_cb(uv_handle_t* handle, size_t suggested, uv_buf_t* buf);
+	static void read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+	static void write_cb(uv_write_t* req, int status);
+	static void close_cb(uv_handle_t* handle);
+
+	void open();
+	void start();
+	void flush(vector<string_view>& buffers);
+	void shutdown();
+
+	// Loop thread, called by shutdown before the handles go away
+	virtual void detach() = 0;
+public:
+	TcpLink(uv_loop_t* loop) : UvLink(loop) {};
+	virtual ~TcpLink() {};
+};
+
+class TcpServer {
+	class Link : public TcpLink {
+		friend TcpServer;
+		TcpServer* server;
+		NetServer::Connection* ctx;
+		void detach();
+	public:
+		Link(TcpServer* server) : TcpLink(server->loop), server(server), ctx(nullptr) {};
+	};
+
+	uv_loop_t* loop;
+	uv_tcp_t listener;
+	bool listening = false;
+
+	static void connection_cb(uv_stream_t* stream, int status);
+public:
+	NetServer* target;
+
+	TcpServer(NetServer* target, uv_loop_t* loop = uv_default_loop()) : loop(loop), target(target) {};
+
+	// Loop thread (or before the loop runs)
+	bool listen(uint16_t port);
+	void stop();
+};
+
+class TcpClient : public TcpLink {
+	NetClient* client;
+	uv_connect_t req;
+
+	static void connect_cb(uv_connect_t* req, int status);
+	void detach();
+
+	TcpClient(NetClient* client, uv_loop_t* loop) : TcpLink(loop), client(client) {};
+public:
+	// Loop thread (or before the loop runs). client->link is set right away,
+	// onConnect fires once the socket is connected
+	static TcpClient* connect(NetClient* client, uv_loop_t* loop, string host, uint16_t port);
+
+	void close();
+};
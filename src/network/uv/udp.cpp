@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <chrono>
+
+#include "udp.hpp"
+
+using namespace udp;
+
+struct UdpLink::Chunked {
+	string_view buffer;
+	uint32_t ref;
+};
+
+struct UdpLink::SendReq {
+	uv_udp_send_t req;
+	udp::Header header;
+	Chunked* owner;
+};
+
+static inline uint64_t addrKey(const sockaddr_in* addr) {
+	return (uint64_t(addr->sin_addr.s_addr) << 16) | addr->sin_port;
+}
+
+void UdpLink::send_cb(uv_udp_send_t* req, int) {
+	auto send = reinterpret_cast<SendReq*>(req);
+	auto owner = send->owner;
+	if (!--owner->ref) {
+		free((void*) owner->buffer.data());
+		delete owner;
+	}
+	delete send;
+}
+
+void UdpLink::sendControl(uint8_t type) {
+	Header header = { type, { 0, 0, 0 }, 0 };
+	auto buf = uv_buf_init((char*) &header, sizeof(Header));
+	uv_udp_try_send(socket, &buf, 1, (const sockaddr*) &peer);
+}
+
+void UdpLink::flush(vector<string_view>& buffers) {
+	for (auto& buffer : buffers) {
+		auto chunks = uint32_t((buffer.size() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		auto owner = new Chunked({ buffer, chunks });
+
+		for (uint32_t i = 0; i < chunks; i++) {
+			auto offset = i * CHUNK_SIZE;
+			auto size = std::min(CHUNK_SIZE, buffer.size() - offset);
+
+			auto send = new SendReq();
+			send->header = { DATA, { 0, 0, 0 }, sendSeq++ };
+			send->owner = owner;
+
+			uv_buf_t bufs[2] = {
+				uv_buf_init((char*) &send->header, sizeof(Header)),
+				uv_buf_init((char*) buffer.data() + offset, (unsigned int) size)
+			};
+
+			if (uv_udp_send(&send->req, socket, bufs, 2, (const sockaddr*) &peer, send_cb)) {
+				send_cb(&send->req, -1);
+			}
+		}
+	}
+}
+
+bool UdpLink::receive(const Header& header, const char* data, size_t size) {
+	if (header.seq != recvSeq) {
+		printf("[udp][%p] lost datagram: expected #%u, got #%u\n", this, recvSeq, header.seq);
+		return false;
+	}
+
+	recvSeq++;
+	if (!proto || !size) return true;
+
+	proto->received_bytes += size;
+	proto->recv((uint8_t*) data, size);
+	return true;
+}
+
+void UdpServer::Link::close_cb(uv_handle_t* handle) {
+	delete static_cast<UdpServer::Link*>(handle->data);
+}
+
+void UdpServer::Link::shutdown() {
+	if (shut) return;
+	shut = true;
+
+	sendControl(BYE);
+	server->links.erase(key);
+
+	if (ctx) server->target->detach(ctx);
+	ctx = nullptr;
+	proto = nullptr;
+
+	{
+		scoped_lock lock(m);
+		for (auto& buffer : outbox) free((void*) buffer.data());
+		outbox.clear();
+	}
+
+	// Socket is shared, only the async handle belongs to this link
+	uv_close((uv_handle_t*) &async, close_cb);
+}
+
+void UdpServer::alloc_cb(uv_handle_t* handle, size_t, uv_buf_t* buf) {
+	auto server = static_cast<UdpServer*>(handle->data);
+	*buf = uv_buf_init(server->readBuffer, sizeof(server->readBuffer));
+}
+
+void UdpServer::recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const sockaddr* addr, unsigned flags) {
+	auto server = static_cast<UdpServer*>(handle->data);
+
+	if (nread < 0) {
+		printf("[udp] recv error: %s\n", uv_strerror(int(nread)));
+		return;
+	}
+
+	if (!addr || size_t(nread) < sizeof(Header)) return;
+
+	if (flags & UV_UDP_PARTIAL) {
+		printf("[udp] truncated datagram\n");
+		return;
+	}
+
+	auto peer = reinterpret_cast<const sockaddr_in*>(addr);
+	auto key = addrKey(peer);
+	auto header = *reinterpret_cast<const Header*>(buf->base);
+
+	auto iter = server->links.find(key);
+	auto link = iter == server->links.end() ? nullptr : iter->second;
+
+	if (link) link->owner = std::this_thread::get_id();
+
+	if (header.type == HELLO) {
+		// Client retries hellos until it sees a welcome
+		if (link) {
+			link->sendControl(WELCOME);
+			return;
+		}
+
+		link = new Link(server);
+		link->socket = &server->socket;
+		link->peer = *peer;
+		link->key = key;
+		link->openAsync();
+
+		link->ctx = server->target->client();
+		link->ctx->server = server->target;
+		link->ctx->link = link;
+		link->proto = link->ctx;
+
+		server->links.insert({ key, link });
+
+		link->sendControl(WELCOME);
+		server->target->attach(link->ctx);
+	} else if (header.type == DATA && link) {
+		if (!link->receive(header, buf->base + sizeof(Header), nread - sizeof(Header))) {
+			link->close();
+		}
+	} else if (header.type == BYE && link) {
+		link->close();
+	}
+}
+
+bool UdpServer::listen(uint16_t port) {
+	sockaddr_in addr;
+	uv_ip4_addr("0.0.0.0", port, &addr);
+
+	uv_udp_init(loop, &socket);
+	socket.data = this;
+
+	auto error = uv_udp_bind(&socket, (const sockaddr*) &addr, 0);
+	if (!error) error = uv_udp_recv_start(&socket, alloc_cb, recv_cb);
+
+	if (error) {
+		printf("[udp] listen failed: %s\n", uv_strerror(error));
+		uv_close((uv_handle_t*) &socket, nullptr);
+		return false;
+	}
+
+	// Nothing is retransmitted, a bigger kernel buffer is the only thing between us and loss
+	int size = 8 * 1024 * 1024;
+	uv_recv_buffer_size((uv_handle_t*) &socket, &size);
+	size = 8 * 1024 * 1024;
+	uv_send_buffer_size((uv_handle_t*) &socket, &size);
+
+	listening = true;
+	printf("[udp] open on port: %u\n", port);
+	return true;
+}
+
+void UdpServer::stop() {
+	if (!listening) return;
+	listening = false;
+
+	vector<Link*> all;
+	for (auto& [_, link] : links) all.push_back(link);
+	for (auto link : all) link->close();
+
+	uv_udp_recv_stop(&socket);
+	uv_close((uv_handle_t*) &socket, nullptr);
+}
+
+void UdpClient::alloc_cb(uv_handle_t* handle, size_t, uv_buf_t* buf) {
+	auto self = static_cast<UdpClient*>(handle->data);
+	*buf = uv_buf_init(self->readBuffer, sizeof(self->readBuffer));
+}
+
+void UdpClient::recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const sockaddr* addr, unsigned flags) {
+	auto self = static_cast<UdpClient*>(handle->data);
+	self->owner = std::this_thread::get_id();
+
+	if (nread < 0) {
+		printf("[udp] recv error: %s\n", uv_strerror(int(nread)));
+		return;
+	}
+
+	if (!addr || size_t(nread) < sizeof(Header) || (flags & UV_UDP_PARTIAL)) return;
+
+	auto header = *reinterpret_cast<const Header*>(buf->base);
+
+	if (header.type == WELCOME) {
+		if (self->connected) return;
+		self->connected = true;
+		uv_timer_stop(&self->hello);
+		if (self->client) self->client->onConnect();
+	} else if (header.type == DATA) {
+		if (!self->receive(header, buf->base + sizeof(Header), nread - sizeof(Header))) self->close();
+	} else if (header.type == BYE) {
+		self->close();
+	}
+}
+
+void UdpClient::hello_cb(uv_timer_t* timer) {
+	auto self = static_cast<UdpClient*>(timer->data);
+	self->owner = std::this_thread::get_id();
+
+	if (self->connected) {
+		uv_timer_stop(timer);
+	} else if (++self->attempts > 20) {
+		printf("[udp][%p] no response from server\n", self);
+		self->close();
+	} else {
+		self->sendControl(HELLO);
+	}
+}
+
+void UdpClient::close_cb(uv_handle_t* handle) {
+	auto self = static_cast<UdpClient*>(handle->data);
+	if (!--self->handles) delete self;
+}
+
+void UdpClient::shutdown() {
+	if (shut) return;
+	shut = true;
+
+	if (connected) sendControl(BYE);
+
+	uv_udp_recv_stop(&own);
+	uv_timer_stop(&hello);
+
+	if (client) client->detach();
+	client = nullptr;
+	proto = nullptr;
+
+	{
+		scoped_lock lock(m);
+		for (auto& buffer : outbox) free((void*) buffer.data());
+		outbox.clear();
+	}
+
+	uv_close((uv_handle_t*) &own, close_cb);
+	uv_close((uv_handle_t*) &async, close_cb);
+	uv_close((uv_handle_t*) &hello, close_cb);
+}
+
+UdpClient* UdpClient::connect(NetClient* client, uv_loop_t* loop, string host, uint16_t port) {
+	auto link = new UdpClient(client, loop);
+
+	if (uv_ip4_addr(host == "localhost" ? "127.0.0.1" : host.c_str(), port, &link->peer)) {
+		printf("[udp] invalid address: %s\n", host.c_str());
+		delete link;
+		return nullptr;
+	}
+
+	sockaddr_in any;
+	uv_ip4_addr("0.0.0.0", 0, &any);
+
+	uv_udp_init(loop, &link->own);
+	link->own.data = link;
+	link->socket = &link->own;
+
+	uv_timer_init(loop, &link->hello);
+	link->hello.data = link;
+
+	link->openAsync();
+	link->handles = 3;
+	link->proto = client;
+
+	client->link = link;
+
+	auto error = uv_udp_bind(&link->own, (const sockaddr*) &any, 0);
+	if (!error) error = uv_udp_recv_start(&link->own, alloc_cb, recv_cb);
+
+	if (error) {
+		printf("[udp] connect failed: %s\n", uv_strerror(error));
+		link->close();
+		return nullptr;
+	}
+
+	int size = 4 * 1024 * 1024;
+	uv_recv_buffer_size((uv_handle_t*) &link->own, &size);
+
+	link->sendControl(HELLO);
+	uv_timer_start(&link->hello, hello_cb, 250, 250);
+	return link;
+}
+
+void UdpClient::close() {
+	auto c = client;
+	bool wait = !onLoopThread();
+
+	UvLink::close();
+
+	if (wait && c) {
+		std::unique_lock<mutex> lk(c->cv_mutex);
+		c->cv.wait_for(lk, std::chrono::seconds{ 10 }, [c] { return !c->link; });
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "link.hpp"
+
+using std::string;
+using std::unordered_map;
+
+// Raw UDP carrying the framed message stream in sequenced chunks. There is no retransmission:
+// a missing chunk corrupts the stream so the connection is dropped. Trusted LAN only, IPv4 only
+namespace udp {
+	constexpr uint8_t HELLO = 1;
+	constexpr uint8_t WELCOME = 2;
+	constexpr uint8_t DATA = 3;
+	constexpr uint8_t BYE = 4;
+
+	constexpr size_t CHUNK_SIZE = 1200;
+
+	struct Header {
+		uint8_t type;
+		uint8_t reserved[3];
+		uint32_t seq;
+	};
+}
+
+class UdpLink : public UvLink {
+protected:
+	uv_udp_t* socket = nullptr;
+	sockaddr_in peer;
+	MessageProtocol* proto = nullptr;
+
+	uint32_t sendSeq = 0;
+	uint32_t recvSeq = 0;
+
+	struct Chunked;
+	struct SendReq;
+
+	static void send_cb(uv_udp_send_t* req, int status);
+
+	void sendControl(uint8_t type);
+	void flush(vector<string_view>& buffers);
+
+	// Loop thread, false if the stream is broken
+	bool receive(const udp::Header& header, const char* data, size_t size);
+public:
+	UdpLink(uv_loop_t* loop) : UvLink(loop) {};
+	virtual ~UdpLink() {};
+};
+
+class UdpServer {
+	class Link : public UdpLink {
+		friend UdpServer;
+		UdpServer* server;
+		NetServer::Connection* ctx = nullptr;
+		uint64_t key;
+
+		static void close_cb(uv_handle_t* handle);
+		void shutdown();
+	public:
+		Link(UdpServer* server) : UdpLink(server->loop), server(server) {};
+	};
+
+	uv_loop_t* loop;
+	uv_udp_t socket;
+	bool listening = false;
+
+	unordered_map<uint64_t, Link*> links; // loop thread only
+
+	char readBuffer[65536]; // per socket, sockets of one process can be on different loop threads
+
+	static void alloc_cb(uv_handle_t* handle, size_t suggested, uv_buf_t* buf);
+	static void recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const sockaddr* addr, unsigned flags);
+public:
+	NetServer* target;
+
+	UdpServer(NetServer* target, uv_loop_t* loop = uv_default_loop()) : loop(loop), target(target) {};
+
+	// Loop thread (or before the loop runs)
+	bool listen(uint16_t port);
+	void stop();
+};
+
+class UdpClient : public UdpLink {
+	NetClient* client;
+	uv_udp_t own;
+	uv_timer_t hello;
+	int handles = 0;
+	int attempts = 0;
+	bool connected = false;
+
+	char readBuffer[65536]; // per socket, sockets of one process can be on different loop threads
+
+	static void alloc_cb(uv_handle_t* handle, size_t suggested, uv_buf_t* buf);
+	static void recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const sockaddr* addr, unsigned flags);
+	static void hello_cb(uv_timer_t* timer);
+	static void close_cb(uv_handle_t* handle);
+
+	void shutdown();
+
+	UdpClient(NetClient* client, uv_loop_t* loop) : UdpLink(loop), client(client) {};
+public:
+	// Loop thread (or before the loop runs). client->link is set right away,
+	// onConnect fires once the server answered the hello
+	static UdpClient* connect(NetClient* client, uv_loop_t* loop, string host, uint16_t port);
+
+	void close();
+};
@@ -0,0 +1,129 @@
+#include "relay.hpp"
+#include "../network/util/writer.hpp"
+
+Relay::Relay(SnapshotBus* bus) : bus(bus) {
+	if (bus) byId.resize(65536);
+	else upstream = new Upstream(this);
+
+	freeIds.reserve(65535);
+	for (int i = 65535; i > 0; i--) freeIds.push_back(uint16_t(i));
+}
+
+Relay::~Relay() {
+	if (busThread.joinable()) {
+		polling = false;
+		busThread.join();
+		bus->leave(lane);
+	}
+	for (auto obj : objects) delete obj;
+	for (auto& c : closed) delete c.client;
+}
+
+bool Relay::start() {
+	if (!bus) return false;
+
+	lane = bus->attach();
+	if (lane < 0) {
+		printf("[relay] every lane of the bus is taken\n");
+		return false;
+	}
+
+	// Anything a crashed process left on this lane goes first
+	Writer w;
+	w.write<uint8_t>(MSG_RELAY_HELLO);
+	upstreamSend(w.finalize());
+
+	polling = true;
+	busThread = std::thread([this] { pollBus(); });
+	printf("[relay] on lane %d of the bus\n", lane);
+	return true;
+}
+
+NetClient* Relay::upstreamClient() {
+	return upstream;
+}
+
+bool Relay::upstreamSend(string_view buffer) {
+	if (!bus) return upstream->send(buffer, true);
+
+	bool pushed;
+	{
+		scoped_lock lock(lane_mutex);
+		pushed = bus->push(lane, buffer);
+	}
+	if (!pushed) stats.lost++;
+	free((void*) buffer.data());
+	return pushed;
+}
+
+void Relay::Upstream::onConnect() {
+	Writer w;
+	w.write<uint8_t>(MSG_RELAY_HELLO);
+	send(w.finalize(), true);
+	printf("[relay] connected upstream\n");
+}
+
+// Nothing to serve without it, same as a desync
+void Relay::Upstream::onDisconnect() {
+	printf("[relay] upstream is gone\n");
+	exit(1);
+}
+
+NetServer::Connection* Relay::client() {
+	return new Downstream(this);
+}
+
+void Relay::Downstream::onConnect() {
+	{
+		scoped_lock lock(relay->relay_mutex);
+		if (relay->slots.size() >= 0xFFFF) {
+			printf("[relay] out of slots\n");
+			disconnect();
+			return;
+		}
+
+		auto& next = relay->nextSlot;
+		while (!next || relay->slots.count(next)) next = (next + 1) & 0xFFFF;
+		slot = next;
+		next = (next + 1) & 0xFFFF;
+		relay->slots[slot] = this;
+	}
+
+	Writer w;
+	w.write<uint8_t>(MSG_RELAY_JOIN);
+	w.write<uint32_t>(slot);
+	relay->upstreamSend(w.finalize());
+
+	printf("[relay] client joined in slot %u\n", slot);
+}
+
+void Relay::Downstream::onDisconnect() {
+	if (!slot) return;
+
+	{
+		scoped_lock lock(relay->relay_mutex);
+		relay->slots.erase(slot);
+		relay->closed.push_back({ this, relay->stats.snapshots.load() });
+	}
+
+	Writer w;
+	w.write<uint8_t>(MSG_RELAY_LEAVE);
+	w.write<uint32_t>(slot);
+	relay->upstreamSend(w.finalize());
+
+	printf("[relay] client left slot %u\n", slot);
+}
+
+size_t Relay::clientCount() {
+	scoped_lock lock(relay_mutex);
+	return slots.size();
+}
+
+void Relay::print() {
+	uint64_t snapshots = stats.snapshots, encoded = stats.encoded;
+	printf("[relay] %zu clients, %lu snapshots in (%.1fMB), %lu out (%.1fMB)\n", clientCount(),
+		snapshots, stats.bytesIn / 1e6, encoded, stats.bytesOut / 1e6);
+	printf("[relay] %.3fms per fan-out, %.1fus per client encode\n",
+		snapshots ? stats.encodeNano / 1e6 / snapshots : 0.0, encoded ? stats.encodeNano / 1e3 / encoded : 0.0);
+	if (bus) printf("[relay] lane %d, %lu resyncs, %lu records lost\n", lane, stats.resyncs.load(), stats.lost.load());
+}
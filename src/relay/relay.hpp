@@ -0,0 +1,182 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <unordered_map>
+
+#include "../client/base.hpp"
+#include "../network/transport.hpp"
+#include "../network/protocol/clock.hpp"
+#include "../network/shm/bus.hpp"
+
+using std::mutex;
+using std::atomic;
+using std::vector;
+using std::bitset;
+using std::unordered_map;
+
+// Edge server for the snapshot fan-out. One upstream connection to the simulating server carries
+// every client of the relay as a player of its own (MSG_RELAY_*), the world decoded from it is
+// re-encoded here for each client with its own delta cache. The sim host encodes one snapshot per
+// relay instead of one per client, and the clients' TLS ends on the relay. Pings are answered by
+// the relay, so clients measure their round trip to it, not to the sim host
+class Relay : public NetServer {
+	class Upstream;
+public:
+	// Decoded copy of an upstream object, with a relay side id for the downstream caches
+	struct Object {
+		uint16_t id;
+		uint8_t type;
+		bool fixed;
+		bool sleeping = false;
+		bool removed = false;
+		uint32_t remoteOf = 0; // hidden from that player, bus only
+		float dims[2] = {}; // radius, or half height and radius, boxes use extents
+		PxVec3 extents = PxVec3(PxZero);
+		PxVec3 pos = PxVec3(PxZero);
+		PxQuat quat = PxQuat(PxIdentity);
+	};
+
+private:
+	class Upstream : public BaseClient {
+		Relay* relay;
+
+		class Mirror : public NetworkedObject {
+		public:
+			Relay* relay;
+			Object* obj;
+
+			Mirror(Relay* relay, Object* obj) : relay(relay), obj(obj) {};
+
+			void onWake() { obj->sleeping = false; };
+			void onSleep() { obj->sleeping = true; };
+			void onAdd(const PxVec3& pos, const PxQuat& quat) { obj->pos = pos; obj->quat = quat; };
+			void onUpdate(const PxVec3& pos, const PxQuat& quat) { obj->pos = pos; obj->quat = quat; };
+
+			// Freed after the fan-out, every downstream cache has to see it gone first
+			void onRemove();
+		};
+
+		// Implemented in network/protocol/relay-tick.cpp
+		void onData(string_view buffer);
+		NetworkedObject* addObj(uint16_t type, uint16_t state, uint16_t flags, Reader& r);
+
+		void onConnect();
+		void onDisconnect();
+	public:
+		Upstream(Relay* relay) : relay(relay) {};
+	};
+
+	// One client of the relay, slot is how upstream knows its player
+	class Downstream : public Connection {
+	public:
+		Relay* relay;
+		uint32_t slot = 0;
+
+		// Set once upstream reported the player, nothing is sent before that
+		bool ready = false;
+		uint32_t pid = 0;
+		uint32_t inputSeq = 0;
+		PlayerState state;
+
+		struct CacheItem {
+			Object* obj;
+			uint32_t flags;
+			PxVec3 pos;
+		};
+		vector<CacheItem> cache;
+		bitset<65536> cache_set;
+
+		mutex clock_mutex;
+		ClockSync clock;
+
+		Downstream(Relay* relay) : relay(relay) {};
+
+		void onConnect();
+		void onData(string_view buffer); // in network/protocol/relay-tick.cpp
+		void onDisconnect();
+	};
+
+	struct RemotePlayer {
+		uint32_t pid;
+		PlayerState state;
+	};
+
+	Upstream* upstream = nullptr;
+
+	// Bus mode, polled on its own thread. Until a full frame arrives the others are skipped
+	SnapshotBus* bus = nullptr;
+	int32_t lane = -1;
+	std::thread busThread;
+	atomic<bool> polling = false;
+	bool syncing = true;
+	uint64_t nextFrame = 0;
+	std::string frame;
+	vector<Object*> byId; // by the sim's object id
+
+	// Written while decoding a snapshot, read by the fan-out right after (upstream's thread)
+	int64_t timestamp = 0;
+	uint64_t tick = 0;
+	float step = 0.f; // upstream's, passed on to the clients' predictors
+	vector<RemotePlayer> players; // everyone but the relay's own parked player
+	vector<Object*> objects;
+	vector<Object*> removed;
+	vector<uint16_t> freeIds;
+
+	// Guards the downstream list, slots and their states
+	mutex relay_mutex;
+	unordered_map<uint32_t, Downstream*> slots;
+	uint32_t nextSlot = 1; // not reused right away, a state for the old one may be in flight
+	// Transports still touch a connection right after onDisconnect, it's deleted a snapshot later
+	struct Closed {
+		Downstream* client;
+		uint64_t snapshot;
+	};
+	vector<Closed> closed;
+
+	// Upstream's thread, after a snapshot was decoded
+	void fanOut();
+	string_view encode(Downstream* client);
+	void onStates(string_view buffer);
+	bool readHeader(string_view buffer);
+
+	// Bus thread
+	void pollBus();
+	void startOver();
+	bool onFrame(string_view buffer);
+	void readEntry(Reader& r);
+
+	// Any thread. The bus lane takes a single producer, downstream callbacks come from several
+	// transport threads at once (msquic workers), lane_mutex lines them up
+	mutex lane_mutex;
+	bool upstreamSend(string_view buffer);
+public:
+	struct {
+		atomic<uint64_t> snapshots = 0; // from upstream
+		atomic<uint64_t> encoded = 0;   // to clients
+		atomic<uint64_t> encodeNano = 0;
+		atomic<uint64_t> bytesIn = 0;
+		atomic<uint64_t> bytesOut = 0;
+		atomic<uint64_t> resyncs = 0; // bus only
+		atomic<uint64_t> lost = 0;    // lane records that didn't fit
+	} stats;
+
+	// Without a bus the world comes from upstreamClient()
+	Relay(SnapshotBus* bus = nullptr);
+	~Relay();
+
+	// The client to hand to a transport (QuicClient::connect etc.), nullptr on a bus
+	NetClient* upstreamClient();
+
+	// Bus mode, before the transports listen: claims a lane and starts polling
+	bool start();
+
+	size_t clientCount();
+	void print();
+
+	Connection* client();
+};
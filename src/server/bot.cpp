@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "bot.hpp"
+
+BotPlayer::BotPlayer(uint32_t index, Behavior behavior, uint32_t seed, bool encode) :
+	behavior(behavior), gen(seed) {
+	pid = PID_BIT | index;
+	holdInput = true; // thinks once per snapshot, keeps walking in between
+	if (encode) encoder.reset(new SnapshotEncoder());
+}
+
+bool BotPlayer::parse(const char* name, Behavior& out) {
+	if (!strcmp(name, "wander")) out = WANDER;
+	else if (!strcmp(name, "jump")) out = JUMP;
+	else if (!strcmp(name, "follow")) out = FOLLOW;
+	else return false;
+	return true;
+}
+
+PlayerInput BotPlayer::think(World* world) {
+	std::uniform_int_distribution<int> coin(0, 7);
+	std::uniform_real_distribution<float> angle(0.f, 2 * PxPi);
+
+	if (behavior == FOLLOW) {
+		// Chase the closest real player, wander if there's nobody around
+		Player* target = nullptr;
+		float best = PX_MAX_F32;
+		for (auto p : world->players) {
+			if (isBot(p)) continue;
+			auto d = (p->state.position - state.position).magnitudeSquared();
+			if (d < best) {
+				best = d;
+				target = p;
+			}
+		}
+
+		if (target) {
+			PlayerInput input;
+			auto to = target->state.position - state.position;
+			input.movF = best > 4.f;
+			input.jump = to.y > 1.f && !coin(gen);
+			input.dir = PxVec2(to.x, to.z);
+			return input;
+		}
+	}
+
+	// Keep walking the same way for a few ticks so the controller actually goes somewhere
+	if (ticksLeft) {
+		ticksLeft--;
+		current.jump = behavior == JUMP && coin(gen) < 4;
+		return current;
+	}
+
+	ticksLeft = std::uniform_int_distribution<uint32_t>(5, 30)(gen);
+
+	PlayerInput input;
+	input.movF = coin(gen) < 6;
+	input.movL = coin(gen) == 1;
+	input.movR = coin(gen) == 2;
+	input.jump = behavior == JUMP ? coin(gen) < 4 : !coin(gen);
+	auto a = angle(gen);
+	input.dir = PxVec2(cosf(a), sinf(a));
+
+	current = input;
+	return input;
+}
+
+void BotPlayer::updateState(World* world) {
+	postInput(think(world), ++thoughts);
+
+	if (encoder) {
+		auto buf = encoder->encode(world, this);
+		encodedBytes += buf.size();
+		free((void*) buf.data());
+	}
+}
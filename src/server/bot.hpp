@@ -0,0 +1,35 @@
+#pragma once
+
+#include <random>
+#include <memory>
+
+#include "../world/world.hpp"
+#include "../network/protocol/snapshot.hpp"
+
+// Server side synthetic player, drives itself on the world thread without any connection
+struct BotPlayer : Player {
+	enum Behavior : uint8_t { WANDER, JUMP, FOLLOW };
+
+	static constexpr uint32_t PID_BIT = 0x80000000;
+
+	Behavior behavior;
+	std::mt19937 gen;
+
+	// Optional, runs the real snapshot encoder every net tick and throws the result away
+	std::unique_ptr<SnapshotEncoder> encoder;
+	uint64_t encodedBytes = 0;
+
+	BotPlayer(uint32_t index, Behavior behavior, uint32_t seed, bool encode = false);
+
+	// Picks the next input, then encodes if enabled
+	void updateState(World* world);
+
+	static bool isBot(const Player* p) { return p->pid & PID_BIT; };
+	static bool parse(const char* name, Behavior& out);
+
+private:
+	PlayerInput think(World* world);
+	uint32_t ticksLeft = 0;
+	uint32_t thoughts = 0;
+	PlayerInput current;
+};
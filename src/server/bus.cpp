@@ -0,0 +1,268 @@
+#include "bus.hpp"
+#include "../network/util/reader.hpp"
+#include "../network/util/writer.hpp"
+
+SimBus::SimBus(PhysXServer* server, SnapshotBus* bus, uv_loop_t* loop) :
+	server(server), world(server->world), bus(bus), loop(loop), published(65536) {}
+
+SimBus::~SimBus() {
+	if (server->bus == this) server->bus = nullptr;
+}
+
+void SimBus::start() {
+	server->bus = this;
+
+	uv_timer_init(loop, &poll_timer);
+	poll_timer.data = this;
+	uv_timer_start(&poll_timer, SimBus::poll_timer_cb, 5, 5);
+}
+
+// Nothing drains the lanes while the world sleeps, a join has to wake it
+void SimBus::poll_timer_cb(uv_timer_t* handle) {
+	auto self = static_cast<SimBus*>(handle->data);
+	if (self->server->asleep() && self->bus->pending()) self->server->wake();
+}
+
+void SimBus::receive() {
+	auto now = uv_hrtime();
+
+	for (uint32_t i = 0; i < SnapshotBus::MAX_LANES; i++) {
+		bool attached = bus->attached(i);
+		if (attached && now > bus->aliveAt(i) + SnapshotBus::LANE_TIMEOUT_NANO) {
+			printf("[bus] lane %u timed out\n", i);
+			bus->detach(i);
+			attached = false;
+		}
+
+		if (lanes[i] != attached) {
+			lanes[i] = attached;
+			if (!attached) drop(i);
+			printf("[bus] lane %u %s\n", i, attached ? "attached" : "detached");
+		}
+
+		if (attached) stats.records += bus->drain(i, [&](string_view buffer) { record(i, buffer); });
+	}
+}
+
+void SimBus::record(uint32_t lane, string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+
+	auto type = r.read<uint8_t>();
+	if (type == MSG_RELAY_HELLO) {
+		// A new reader on the lane, whatever the last one left is gone
+		drop(lane);
+		return;
+	}
+
+	auto slot = r.read<uint32_t>();
+	if (error || !slot || slot > 0xFFFF) return;
+	auto key = (lane + 1) << 16 | slot;
+
+	if (type == MSG_RELAY_JOIN) {
+		if (players.count(key)) return;
+		auto player = new BusPlayer(key);
+		world->spawn(player, world->spawner.center + PxVec3(25.f, 25.f, 25.f));
+		players[key] = player;
+	} else if (type == MSG_RELAY_LEAVE) {
+		auto it = players.find(key);
+		if (it == players.end()) return;
+		world->destroy(it->second);
+		players.erase(it);
+	} else if (type == MSG_RELAY_INPUT) {
+		auto seq = r.read<uint32_t>();
+		PlayerInput input;
+		r.read<PlayerInput>(input);
+		if (!r.eof()) return;
+
+		auto it = players.find(key);
+		if (it != players.end()) it->second->postInput(input, seq);
+	} else {
+		printf("[bus] unknown record on lane %u\n", lane);
+	}
+}
+
+void SimBus::drop(uint32_t lane) {
+	for (auto it = players.begin(); it != players.end();) {
+		if ((it->first >> 16) != lane + 1) {
+			it++;
+			continue;
+		}
+		world->destroy(it->second);
+		it = players.erase(it);
+	}
+}
+
+static bool shapeOf(PxRigidActor* actor, uint8_t& type, PxVec3& dims) {
+	PxShape* shape;
+	if (actor->getShapes(&shape, 1) != 1) return false;
+
+	auto geo = shape->getGeometry();
+	dims = PxVec3(PxZero);
+	switch (geo.getType()) {
+	case PxGeometryType::eBOX:
+		type = BOX_T;
+		dims = geo.box().halfExtents;
+		break;
+	case PxGeometryType::eSPHERE:
+		type = SPH_T;
+		dims.x = geo.sphere().radius;
+		break;
+	case PxGeometryType::eCAPSULE:
+		type = CPS_T;
+		dims = PxVec3(geo.capsule().halfHeight, geo.capsule().radius, 0.f);
+		break;
+	case PxGeometryType::ePLANE:
+		type = PLN_T;
+		break;
+	default:
+		type = UNK_T;
+	}
+	return true;
+}
+
+void SimBus::writeEntry(Writer& w, WorldObject* obj, uint8_t type, const PxVec3& dims, bool sleeping) {
+	auto t = obj->actor->getGlobalPose();
+	w.write<uint16_t>(obj->id);
+	w.write<uint8_t>(type);
+	w.write<uint8_t>(obj->actor->is<PxRigidStatic>() ? 1 : 0);
+	w.write<uint8_t>(sleeping);
+	w.write<uint32_t>(obj->remoteOf);
+	w.write<PxVec3>(dims);
+	w.write<PxVec3>(t.p);
+	w.write<PxQuat>(t.q);
+}
+
+// Everything gone, added or moved since the last frame (and with full, everything else too)
+void SimBus::journal(Writer& w, bool full) {
+	auto now = stamp;
+	World::RegionLock sl(*world, false);
+	scoped_lock ol(world->object_mutex);
+
+	gone.clear();
+	added.clear();
+	moved.clear();
+
+	for (auto obj : world->objects) {
+		auto actor = obj->actor;
+		if (!obj->id || !actor || obj->released) continue;
+
+		auto dynamic = actor->is<PxRigidDynamic>();
+		bool sleeping = !dynamic || obj->frozen || dynamic->isSleeping();
+
+		auto& p = published[obj->id];
+		if (p.handle != obj->handle) {
+			// The id went around within one frame
+			if (p.handle) gone.push_back(obj->id);
+			else tracked.push_back(obj->id);
+			p.handle = obj->handle;
+			p.obj = obj;
+			p.added = now;
+			p.sleeping = sleeping;
+			added.push_back(obj);
+		} else if (!sleeping || !p.sleeping) {
+			p.sleeping = sleeping;
+			moved.push_back(obj);
+		}
+		p.stamp = now;
+	}
+
+	for (size_t i = 0; i < tracked.size();) {
+		auto& p = published[tracked[i]];
+		if (p.stamp == now) {
+			i++;
+			continue;
+		}
+		gone.push_back(tracked[i]);
+		p.handle = 0;
+		p.obj = nullptr;
+		tracked[i] = tracked.back();
+		tracked.pop_back();
+	}
+
+	w.write<uint32_t>(gone.size());
+	for (auto id : gone) w.write<uint16_t>(id);
+
+	uint8_t type;
+	PxVec3 dims;
+	auto& addCount = w.ref<uint32_t>();
+	for (auto obj : added) {
+		if (!shapeOf(obj->actor, type, dims)) continue;
+		writeEntry(w, obj, type, dims, published[obj->id].sleeping);
+		addCount++;
+	}
+
+	w.write<uint32_t>(moved.size());
+	for (auto obj : moved) {
+		auto t = obj->actor->getGlobalPose();
+		w.write<uint16_t>(obj->id);
+		w.write<uint8_t>(published[obj->id].sleeping);
+		w.write<PxVec3>(t.p);
+		w.write<PxQuat>(t.q);
+	}
+
+	if (full) {
+		auto& count = w.ref<uint32_t>();
+		for (auto id : tracked) {
+			auto& p = published[id];
+			if (p.added == now || !shapeOf(p.obj->actor, type, dims)) continue;
+			writeEntry(w, p.obj, type, dims, p.sleeping);
+			count++;
+		}
+		stats.full++;
+	}
+}
+
+void SimBus::publish(bool net) {
+	if (!net) return;
+
+	bool full = bus->takeResync();
+	stamp++;
+
+	Writer w;
+	w.write<uint8_t>(full ? BUS_FULL : 0);
+	w.write<int64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+	w.write<uint64_t>(world->getTick());
+	w.write<float>(world->getStep());
+
+	{
+		scoped_lock pl(world->player_mutex);
+		w.write<uint32_t>(world->players.size());
+		for (auto p : world->players) {
+			w.write<uint32_t>(p->pid);
+			w.write<PlayerState>(p->state);
+		}
+	}
+
+	w.write<uint32_t>(players.size());
+	for (auto& [key, player] : players) {
+		w.write<uint32_t>(key);
+		w.write<uint32_t>(player->pid);
+		w.write<uint32_t>(player->inputSeq);
+		w.write<PlayerState>(player->state);
+	}
+
+	journal(w, full);
+
+	auto frame = w.buffer();
+	if (bus->publish(frame)) {
+		stats.frames++;
+		stats.bytes += frame.size();
+		return;
+	}
+
+	// Readers can't follow the journal past a missing frame, they start over from a full one
+	printf("[bus] frame of %zu bytes doesn't fit\n", frame.size());
+	stats.dropped++;
+	Writer reset;
+	reset.write<uint8_t>(BUS_RESET);
+	bus->publish(reset.buffer());
+}
+
+void SimBus::print() {
+	uint32_t attached = 0;
+	for (auto lane : lanes) attached += lane;
+	printf("[bus] %u lanes attached, %zu players, %zu objects published\n", attached, players.size(), tracked.size());
+	printf("[bus] %lu frames (%lu full, %lu dropped), %.1fMB, %lu records in\n", stats.frames.load(),
+		stats.full.load(), stats.dropped.load(), stats.bytes.load() / 1e6, stats.records.load());
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "game.hpp"
+#include "../network/shm/bus.hpp"
+
+class Writer;
+
+// Stand-in for a client of a network process, driven by the inputs on that process's lane
+struct BusPlayer : Player {
+	uint32_t key; // (lane + 1) << 16 | slot
+
+	BusPlayer(uint32_t key) : key(key) { pid = 0x80000000 | key; };
+
+	// The network process sends the snapshots
+	void updateState(World*) {};
+};
+
+// Sim side of a SnapshotBus. Every net step the world goes out as one frame, the network
+// processes attached to the bus (relay --bus) encode and send the snapshots of their own clients,
+// so the encoders don't compete with PhysX for this process's cores. Frames are journals
+// against the previous one, a reader that falls a ring behind asks for a full frame. Layout:
+//   u8 BUS_* flags, i64 timestamp, u64 tick, f32 step (seconds per input)
+//   u32 count, per player: u32 pid, PlayerState
+//   u32 count, per bus player: u32 key, u32 pid, u32 input seq, PlayerState
+//   u32 count, per object gone: u16 id
+//   u32 count, per object added: entry
+//   u32 count, per object moved (awake, or just fell asleep): u16 id, u8 sleeping, PxVec3, PxQuat
+//   BUS_FULL only: u32 count, per object not added in this frame: entry
+// where an entry is u16 id, u8 type, u8 static, u8 sleeping, u32 remoteOf, PxVec3 dims, PxVec3, PxQuat
+// (dims as in ShardNode exports). Lane records are MSG_RELAY_HELLO / JOIN / LEAVE / INPUT, the
+// same messages a relay sends over its connection
+class SimBus {
+	PhysXServer* server;
+	World* world;
+	SnapshotBus* bus;
+	uv_loop_t* loop;
+	uv_timer_t poll_timer;
+
+	// What the readers know about, by object id. Tick thread only
+	struct Published {
+		uint32_t handle = 0; // an id that went around within one frame has a new one
+		WorldObject* obj = nullptr;
+		uint64_t stamp = 0;
+		uint64_t added = 0;
+		bool sleeping = false;
+	};
+	vector<Published> published;
+	vector<uint16_t> tracked;
+	uint64_t stamp = 0;
+
+	bool lanes[SnapshotBus::MAX_LANES] = {};
+	std::unordered_map<uint32_t, BusPlayer*> players; // by key
+
+	vector<uint16_t> gone;
+	vector<WorldObject*> added;
+	vector<WorldObject*> moved;
+
+	static void poll_timer_cb(uv_timer_t* handle);
+
+	// Tick thread
+	void record(uint32_t lane, string_view buffer);
+	void drop(uint32_t lane);
+	void journal(Writer& w, bool full);
+	void writeEntry(Writer& w, WorldObject* obj, uint8_t type, const PxVec3& dims, bool sleeping);
+public:
+	struct {
+		atomic<uint64_t> frames = 0;
+		atomic<uint64_t> bytes = 0;
+		atomic<uint64_t> full = 0;
+		atomic<uint64_t> dropped = 0; // didn't fit a slot
+		atomic<uint64_t> records = 0;
+	} stats;
+
+	SimBus(PhysXServer* server, SnapshotBus* bus, uv_loop_t* loop = uv_default_loop());
+	~SimBus();
+
+	// Before the loop runs, wakes the server when a hibernating world gets lane records
+	void start();
+
+	// Tick thread (PhysXServer::tick). receive applies the lanes before players move, publish
+	// writes the frame after a net step
+	void receive();
+	void publish(bool net);
+
+	// Tick thread (post)
+	void print();
+};
@@ -88,15 +88,18 @@ void ServerDebugRenderer::renderActors(const vector<PxRigidActor*>& actors, bool
 
 void ServerDebugRenderer::render() {
 	if (!currentWorld) return;
-	auto scene = currentWorld->getScene();
-	PxSceneReadLock lock(*scene);
-
-	auto QFlags = PxActorTypeFlag::eRIGID_DYNAMIC | PxActorTypeFlag::eRIGID_STATIC;
-	auto nbActors = scene->getNbActors(QFlags);
-	if (nbActors) {
-		std::vector<PxRigidActor*> actors(nbActors);
-		scene->getActors(QFlags, reinterpret_cast<PxActor**>(actors.data()), nbActors);
-		renderActors(actors);
+	// Every region, ghosts and static copies included
+	for (size_t i = 0; i < currentWorld->regionCount(); i++) {
+		auto scene = currentWorld->getScene(i);
+		PxSceneReadLock lock(*scene);
+
+		auto QFlags = PxActorTypeFlag::eRIGID_DYNAMIC | PxActorTypeFlag::eRIGID_STATIC;
+		auto nbActors = scene->getNbActors(QFlags);
+		if (nbActors) {
+			std::vector<PxRigidActor*> actors(nbActors);
+			scene->getActors(QFlags, reinterpret_cast<PxActor**>(actors.data()), nbActors);
+			renderActors(actors);
+		}
 	}
 }
 
@@ -1,12 +1,24 @@
 #include "game.hpp"
+#include "rooms.hpp"
+#include "shard.hpp"
+#include "bus.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#endif
 
 using std::scoped_lock;
 
-PhysXServer::PhysXServer(uv_loop_t* loop) : QuicServer(), loop(loop), 
-	world(new World()), running(false) {
+PhysXServer::PhysXServer(uv_loop_t* loop, PxDefaultCpuDispatcher* shared) : NetServer(), running(false),
+	loop(loop), botGen(6969), world(new World(shared)) {
+	if (!loop) return;
 
 	uv_timer_init(loop, &tick_timer);
 	tick_timer.data = this;
+
+	uv_async_init(loop, &wake_async, PhysXServer::wake_async_cb);
+	wake_async.data = this;
 }
 
 PhysXServer::~PhysXServer() {
@@ -17,66 +29,244 @@ PhysXServer::~PhysXServer() {
 void PhysXServer::tick_timer_cb(uv_timer_t* handle) {
 	auto server = static_cast<PhysXServer*>(handle->data);
 	auto now = uv_hrtime();
-	auto dt = now - server->last_tick;
+	auto step = server->stepNano;
+	auto seen = server->wakeups.load();
+
+	server->clock.jitter.add(now > server->deadline ? now - server->deadline : server->deadline - now);
+	server->runPosted();
+
+	server->accumulator += now - server->lastWake;
+	server->lastWake = now;
+
+	// Whole steps only, the remainder carries over to the next wakeup
+	uint32_t steps = 0;
+	auto limit = server->substepLimit();
+	while (server->accumulator >= step && steps < limit) {
+		server->accumulator -= step;
+		steps++;
+
+		// Snapshots go out with the last step of a wakeup, there's no point in sending older state.
+		// Clients that came due on the earlier steps are caught up there
+		bool last = server->accumulator < step || steps == limit;
+		server->tick(last);
+	}
+
+	if (server->accumulator >= step) {
+		auto behind = server->accumulator - server->accumulator % step;
+		server->clock.droppedNano += behind;
+		server->accumulator -= behind;
+	}
+
+	// Timer stays off until wake_async_cb
+	if (server->hibernate(seen)) return;
 
-	server->tick(now, dt / 1000000.f);
+	// Timer granularity is 1ms, round up and let the accumulator absorb the lateness
+	auto waited = uv_hrtime() - now + server->accumulator;
+	uint64_t timeout = waited >= step ? 0 : (step - waited + MS_TO_NANO - 1) / MS_TO_NANO;
+	server->deadline = uv_hrtime() + timeout * MS_TO_NANO;
+	uv_timer_start(&server->tick_timer, PhysXServer::tick_timer_cb, timeout, 0);
+}
+
+void PhysXServer::run(uint64_t stepInterval, uint64_t netInterval, bool dedicated) {
+	if (running || !loop) return;
+	running = true;
+
+	this->dedicated = dedicated;
+	configure(stepInterval, netInterval);
+
+	lastWake = uv_hrtime();
+	deadline = lastWake;
+	accumulator = 0;
 
-	auto busyNano = uv_hrtime() - now;
-	server->last_tick = now;
+	printf("[game] step: %.3fms, net: %.3fms (every %u steps)%s\n", stepNano / float(MS_TO_NANO),
+		netIntervalNano / float(MS_TO_NANO), world->netEvery.load(), dedicated ? ", dedicated tick thread" : "");
 
-	if (busyNano > server->tickIntervalNano) {
-		// printf("Busy time: %.2f, interval: %.2f\n", busyNano / 1000000.f, server->intervalNano / 1000000.f);
-		uv_timer_start(&server->tick_timer, PhysXServer::tick_timer_cb, 1, 0);
+	if (dedicated) {
+		tickThread = std::thread([this] { tickLoop(); });
+		uv_run(loop, UV_RUN_DEFAULT);
+
+		running = false;
+		wake();
+		tickThread.join();
 	} else {
-		uint64_t timeLeft = (server->tickIntervalNano - busyNano) / 1000000.f;
-		// printf("Time left: %lu\n", timeLeft);
-		uv_timer_start(&server->tick_timer, PhysXServer::tick_timer_cb, timeLeft, 0);
+		uv_timer_start(&tick_timer, PhysXServer::tick_timer_cb, 0, 0);
+		uv_run(loop, UV_RUN_DEFAULT);
 	}
 }
 
-const int MS_TO_NANO = 1000000;
+void PhysXServer::configure(uint64_t stepInterval, uint64_t netInterval) {
+	stepNano = std::max<uint64_t>(1, stepInterval);
+	netIntervalNano = netInterval;
+	world->netEvery = uint32_t(std::max<uint64_t>(1, (netIntervalNano + stepNano / 2) / stepNano));
+}
 
-void PhysXServer::run(uint64_t msTickInterval, uint64_t msNetInterval) {
-	if (running) return;
-	running = true;
+void PhysXServer::post(std::function<void()> fn) {
+	{
+		scoped_lock lock(posted_mutex);
+		posted.push_back(std::move(fn));
+	}
+	wake();
+}
+
+void PhysXServer::wake() {
+	wakeups++;
+	if (!hibernating.exchange(false)) return;
+
+	if (host) host->resume(this);
+	else if (dedicated) {
+		{ scoped_lock lock(wake_mutex); }
+		wake_cv.notify_all();
+	} else uv_async_send(&wake_async);
+}
+
+bool PhysXServer::hibernate(uint64_t seen) {
+	if (!hibernation.enabled || idleSteps < hibernation.afterSteps) return false;
+	idleSteps = 0;
+
+	hibernatedAt = uv_hrtime();
+	hibernating = true;
+	// Someone woke us since the step began but found us awake, stay up. If they got here
+	// first the exchange fails and their signal resumes us instead
+	if (wakeups != seen && hibernating.exchange(false)) return false;
+
+	clock.hibernations++;
+	printf("[game] hibernating at tick %lu\n", world->getTick());
+	return true;
+}
+
+// Wall time asleep is neither simulated nor dropped
+void PhysXServer::resume() {
+	auto now = uv_hrtime();
+	clock.hibernatedNano += now - hibernatedAt;
+	lastWake = deadline = now;
+	accumulator = 0;
+
+	printf("[game] woke up after %.1fs\n", (now - hibernatedAt) / 1e9);
+}
+
+void PhysXServer::wake_async_cb(uv_async_t* handle) {
+	auto server = static_cast<PhysXServer*>(handle->data);
+	if (!server->running || server->dedicated) return;
+
+	server->resume();
+	uv_timer_start(&server->tick_timer, PhysXServer::tick_timer_cb, 0, 0);
+}
+
+void PhysXServer::runPosted() {
+	vector<std::function<void()>> work;
+	{
+		scoped_lock lock(posted_mutex);
+		if (posted.empty()) return;
+		work.swap(posted);
+	}
+	for (auto& fn : work) fn();
+}
+
+// Sleep most of the way on an absolute deadline, then spin off the scheduler's wakeup latency
+static void waitUntil(uint64_t deadline, uint64_t spinNano) {
+	auto now = uv_hrtime();
+	if (deadline > now + spinNano) {
+#ifdef _WIN32
+		std::this_thread::sleep_for(nanoseconds(deadline - spinNano - now));
+#else
+		// uv_hrtime is CLOCK_MONOTONIC
+		auto wake = deadline - spinNano;
+		timespec ts = { time_t(wake / 1000000000), long(wake % 1000000000) };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#endif
+	}
+	while (uv_hrtime() < deadline) std::this_thread::yield();
+}
+
+void PhysXServer::tickLoop() {
+	deadline = uv_hrtime();
+
+	while (running) {
+		waitUntil(deadline, spinNano);
 
-	tickIntervalNano = msTickInterval * MS_TO_NANO;
-	netIntervalNano = msNetInterval * MS_TO_NANO;
+		auto now = uv_hrtime();
+		auto seen = wakeups.load();
+		clock.jitter.add(now - deadline);
+		runPosted();
 
-	last_net = uv_hrtime();
-	last_tick = uv_hrtime();
+		tick(true);
 
-	printf("[game] tick: %lums, net: %lums\n", msTickInterval, msNetInterval);
-	uv_timer_start(&tick_timer, PhysXServer::tick_timer_cb, 0, 0);
+		if (hibernate(seen)) {
+			std::unique_lock lock(wake_mutex);
+			wake_cv.wait(lock, [this] { return !hibernating || !running; });
+			resume();
+			continue;
+		}
+
+		// Next deadline is absolute, late steps run back to back until caught up (within the clamp)
+		deadline += stepNano;
+		auto after = uv_hrtime();
+		if (after > deadline + substepLimit() * stepNano) {
+			auto behind = (after - deadline) / stepNano * stepNano;
+			clock.droppedNano += behind;
+			deadline += behind;
+		}
+	}
+}
+
+uint32_t PhysXServer::netScale() {
+	auto level = overload.level.load();
+	if (level >= OverloadLadder::NET_QUARTER) return 4;
+	if (level >= OverloadLadder::NET_HALF) return 2;
+	return 1;
+}
 
-	uv_run(loop, UV_RUN_DEFAULT);
+uint32_t PhysXServer::substepLimit() {
+	return overload.level >= OverloadLadder::NO_CATCH_UP ? 1 : maxSubsteps;
 }
 
-void PhysXServer::tick(uint64_t now, float realDelay) {
+void PhysXServer::tick(bool net) {
 	if (!world) return;
+	auto begin = uv_hrtime();
 
-	world->updatePlayers(realDelay * 0.001f);
+	// Same dt every step, no matter how late the wakeup was
+	float dt = stepNano / 1000000000.f;
+	clock.steps++;
 
-	auto start = high_resolution_clock::now();
-	world->step(tickIntervalNano / 1000000000.f, false);
+	// Nobody to spawn cubes for
+	bool empty = !world->playerCount() && !(shard && shard->remoteCount());
+	world->housekeeping = !(hibernation.enabled && empty) && overload.level < OverloadLadder::SKIP_HOUSEKEEPING;
+
+	// Border mirrors, handoffs and forwarded inputs from the other shards
+	if (shard) shard->receive();
+	// Joins, leaves and inputs from the network processes
+	if (bus) bus->receive();
 
-	if (now > last_net + netIntervalNano) {
-		last_net = last_net + netIntervalNano;
+	world->updatePlayers(dt);
 
-		world->updateNet(realDelay);
+	auto start = high_resolution_clock::now();
+	world->step(dt, false);
+
+	if (net) {
+		world->updateNet(dt);
 		world->syncSim();
+		world->recordHistory();
+		world->runQueries();
 		world->gc();
 		world->timing.update.store(duration<float, std::milli>(high_resolution_clock::now() - start).count());
 	}
 	else {
 		world->syncSim();
+		world->recordHistory();
+		world->runQueries();
 	}
 	
 	world->timing.sim.store(duration<float, std::milli>(high_resolution_clock::now() - start).count());
 
-	// printf("Sim    : %4.4fms\n", world->timing.sim);
-	// printf("Update : %4.4fms\n", world->timing.update);
-	// printf("Objects: %u\n", world->objects->size());
+	if (shard) shard->publish(net);
+	if (bus) bus->publish(net);
+
+	// Substep limit and housekeeping are read fresh every step, the rest goes to the world
+	if (overload.update(uv_hrtime() - begin, stepNano)) {
+		world->netScale = netScale();
+	}
+
+	idleSteps = hibernation.enabled && empty && world->settled() ? idleSteps + 1 : 0;
 }
 
 
@@ -90,6 +280,11 @@ void PhysXServer::addHandle(Handle* handle) {
 	printf("[server] added handle#%u\n", handle->pid);
 }
 
+size_t PhysXServer::handleCount() {
+	scoped_lock lock(handle_mutex);
+	return allHandles.size();
+}
+
 void PhysXServer::removeHandle(Handle* handle) {
 	scoped_lock lock(handle_mutex);
 	allHandles.erase(handle->pid);
@@ -97,16 +292,67 @@ void PhysXServer::removeHandle(Handle* handle) {
 	printf("[server] removed handle#%u\n", handle->pid);
 }
 
+void PhysXServer::printClients() {
+	scoped_lock lock(handle_mutex);
+	printf("[server] %zu clients\n", allHandles.size());
+
+	for (auto& [pid, handle] : allHandles) {
+		scoped_lock clockLock(handle->clock_mutex);
+		auto& clock = handle->clock;
+		auto transport = handle->link ? handle->link->rttMicro() / 1000.0 : 0.0;
+		printf("[server] #%u rtt %.2fms (var %.2fms, min %.2fms) offset %+.2fms | transport rtt %.2fms\n",
+			pid, clock.rttMs(), clock.rttVarMs(), clock.minRttMs(), clock.offsetMs(), transport);
+	}
+}
+
 void PhysXServer::Handle::onConnect() {
 	getServer()->addHandle(this);
+	getServer()->wake();
 
 	scoped_lock lock(world_mutex);
-	getWorld()->spawn(this);
+	getWorld()->spawn(this, getWorld()->spawner.center + PxVec3(25.f, 25.f, 25.f));
 }
 
 void PhysXServer::Handle::onDisconnect() {
 	getServer()->removeHandle(this);
 
+	// Slots posted before this never spawn now. Destroyed outside the lock, updateNet
+	// takes it with the player list held
+	unordered_map<uint32_t, Relayed*> players;
+	{
+		scoped_lock lock(relay_mutex);
+		players.swap(relayed);
+		relay = false;
+	}
+
 	scoped_lock lock(world_mutex);
+	for (auto& [slot, player] : players) getWorld()->destroy(player);
 	getWorld()->destroy(this);
-}
\ No newline at end of file
+}
+
+void PhysXServer::addBots(uint32_t count, BotPlayer::Behavior behavior, bool encode) {
+	std::uniform_real_distribution<float> spread(-20.f, 20.f);
+
+	for (uint32_t i = 0; i < count; i++) {
+		auto bot = new BotPlayer(nextBot++, behavior, botGen(), encode);
+		world->spawn(bot, world->spawner.center + PxVec3(spread(botGen), 5.f, spread(botGen)));
+		bots.push_back(bot);
+	}
+
+	printf("[server] %zu bots\n", bots.size());
+}
+
+void PhysXServer::removeBots(uint32_t count) {
+	while (count-- && !bots.empty()) {
+		world->destroy(bots.back());
+		bots.pop_back();
+	}
+
+	printf("[server] %zu bots\n", bots.size());
+}
+
+uint64_t PhysXServer::botEncodedBytes() {
+	uint64_t total = 0;
+	for (auto bot : bots) total += bot->encodedBytes;
+	return total;
+}
@@ -2,6 +2,9 @@
 
 #include <map>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include <vector>
 #include <chrono>
 #include <bitset>
@@ -13,7 +16,14 @@
 #include <PxPhysics.h>
 
 #include "../world/world.hpp"
-#include "../network/quic/server.hpp"
+#include "../network/protocol/snapshot.hpp"
+#include "../network/protocol/clock.hpp"
+#include "bot.hpp"
+#include "../network/transport.hpp"
+#include "../misc/histogram.hpp"
+#include "overload.hpp"
+
+class Reader;
 
 using std::mutex;
 using std::vector;
@@ -22,31 +32,89 @@ using std::scoped_lock;
 using std::unordered_map;
 using namespace std::chrono;
 
-class PhysXServer : public QuicServer {
-	bool running;
+constexpr uint64_t MS_TO_NANO = 1000000;
+
+class RoomManager;
+class ShardNode;
+class SimBus;
+
+class PhysXServer : public NetServer {
+	friend RoomManager;
+	friend ShardNode;
+
+	atomic<bool> running;
+	bool dedicated = false;
 
 	uv_loop_t* loop;
-	uint64_t last_net = 0;
-	uint64_t last_tick = 0;
 
-	uint64_t tickIntervalNano = 0;
+	// Fixed timestep: wall time piles up in the accumulator and is simulated in whole steps
+	uint64_t stepNano = 0;
 	uint64_t netIntervalNano = 0;
+	uint64_t lastWake = 0;
+	uint64_t accumulator = 0;
+	uint64_t deadline = 0; // when the current wakeup was due
+
+	// Hosted rooms are stepped by the manager's workers instead of run()
+	RoomManager* host = nullptr;
+	uint32_t roomId = 0;
+
+	void configure(uint64_t stepInterval, uint64_t netInterval);
+
+	// Work for the tick thread (REPL commands), runs between steps
+	mutex posted_mutex;
+	vector<std::function<void()>> posted;
+	void runPosted();
+
+	// Current limits, depending on the overload level
+	uint32_t netScale();
+	uint32_t substepLimit();
+
+	// Dedicated mode: steps on their own thread against absolute deadlines
+	std::thread tickThread;
+	void tickLoop();
 
 	uv_timer_t tick_timer;
 
+	// Hibernation: an empty, fully asleep world stops stepping until wake(). Wakeups are
+	// counted so one racing the decision to sleep is never lost
+	atomic<bool> hibernating = false;
+	atomic<uint64_t> wakeups = 0;
+	uint32_t idleSteps = 0;
+	uint64_t hibernatedAt = 0;
+	uv_async_t wake_async;
+	mutex wake_mutex;
+	std::condition_variable wake_cv;
+
+	// Tick thread, after a step. True if it's asleep now (seen: wakeups before the step)
+	bool hibernate(uint64_t seen);
+	void resume();
+	static void wake_async_cb(uv_async_t* handle);
+
+	// Player of a relay's client, its snapshots go out through the relay's connection
+	struct Relayed : Player {
+		uint32_t slot;
+
+		Relayed(uint32_t pid, uint32_t slot) : slot(slot) { this->pid = pid; };
+		void updateState(World*) {};
+	};
+
 	class Handle : public Connection, Player {
 		friend PhysXServer;
+		friend ShardNode;
 
-		struct CacheItem {
-			WorldObject* obj;
-			uint32_t flags;
-			PxVec3 pos;
-		};
+		SnapshotEncoder encoder;
 
-		vector<CacheItem> cache;
-		bitset<65536> cache_set;
+		// After MSG_RELAY_HELLO the handle is parked and speaks for its relay's clients, one
+		// Relayed player per slot. Slots are added and removed on the tick thread, inputs
+		// arrive on the network thread
+		bool relay = false;
+		mutex relay_mutex;
+		unordered_map<uint32_t, Relayed*> relayed;
+		void onRelay(uint8_t type, Reader& r);
 
-		static const size_t cache_size = sizeof(CacheItem);
+		// Pongs arrive on the network thread, pings go out from the tick thread
+		mutex clock_mutex;
+		ClockSync clock;
 
 		// Implemented in network/protocol/server-tick.cpp
 		virtual void updateState(World* world);
@@ -55,7 +123,10 @@ class PhysXServer : public QuicServer {
 		virtual void onData(string_view buffer);
 		virtual void onDisconnect();
 
-		PhysXServer* getServer() { return static_cast<PhysXServer*>(server);  };
+		// Not necessarily the NetServer it's attached to, that may be a RoomManager
+		PhysXServer* room = nullptr;
+
+		PhysXServer* getServer() { return room; };
 		World* getWorld() { return getServer()->world; }
 	};
 
@@ -63,17 +134,87 @@ class PhysXServer : public QuicServer {
 
 	mutex handle_mutex;
 	unordered_map<uint32_t, Handle*> allHandles;
+
+	// Tick thread only
+	vector<BotPlayer*> bots;
+	uint32_t nextBot = 0;
+	std::mt19937 botGen;
 public:
-	World* world; // TODO: multi world
+	World* world; // one per server, a RoomManager hosts many servers for many worlds
 
-	PhysXServer(uv_loop_t* loop = uv_default_loop());
+	// Without a loop it can only be hosted by a RoomManager, shared is passed on to the World
+	PhysXServer(uv_loop_t* loop = uv_default_loop(), PxDefaultCpuDispatcher* shared = nullptr);
 	~PhysXServer();
 
-	void run(uint64_t tickInterval, uint64_t netInterval);
-	void tick(uint64_t now, float realDelay);
+	// Steps allowed per wakeup to catch up, anything beyond is dropped so a stall
+	// can't snowball into ever longer wakeups
+	uint32_t maxSubsteps = 4;
+
+	OverloadLadder overload;
+
+	// Shard mode (see ShardNode), set before run. Synced at the start of every step and after it
+	ShardNode* shard = nullptr;
+
+	// Shared memory bus to network processes (see SimBus), set before run. Same hooks as shard
+	SimBus* bus = nullptr;
+
+	// No players and nothing awake for afterSteps in a row puts the world to sleep, no steps
+	// and no timer until someone connects or a command is posted. Without players the spawner
+	// and sleep sweep are off as well, so the scene can actually settle
+	struct {
+		bool enabled = true;
+		uint32_t afterSteps = 50;
+	} hibernation;
+
+	struct {
+		atomic<uint64_t> steps = 0;
+		atomic<uint64_t> droppedNano = 0; // wall time never simulated because of the clamp
+		Histogram jitter; // wakeup time minus when it was due
+		atomic<uint64_t> hibernations = 0;
+		atomic<uint64_t> hibernatedNano = 0; // finished hibernations only
+	} clock;
+
+	// Dedicated mode sleeps until this long before the deadline, then spins
+#ifdef _WIN32
+	uint64_t spinNano = 2000000;
+#else
+	uint64_t spinNano = 200000;
+#endif
+
+	// Both intervals in nanoseconds, netInterval is the default snapshot rate (see World::netEvery).
+	// Steps run from a libuv timer on the loop (1ms resolution), or with dedicated on their own
+	// thread while the calling thread runs the loop
+	void run(uint64_t stepInterval, uint64_t netInterval, bool dedicated = false);
+
+	// Runs fn on the thread that steps the world, before the next step (wakes it up)
+	void post(std::function<void()> fn);
+
+	// Any thread, resumes stepping right away if the world is hibernating
+	void wake();
+	bool asleep() { return hibernating; };
+
+	// One fixed step, net also sends snapshots to whoever is due (overlapping the simulation)
+	void tick(bool net);
+
+	uint64_t stepInterval() { return stepNano; };
 
 	void addHandle(Handle* handle);
 	void removeHandle(Handle* handle);
 
-	Connection* client() { return new Handle(); };
+	// Round trip / clock offset of every connection, with the transport's own RTT next to it
+	void printClients();
+
+	// Tick thread (see post) or before run, bots are freed by world gc once removed
+	void addBots(uint32_t count, BotPlayer::Behavior behavior, bool encode);
+	void removeBots(uint32_t count);
+	size_t botCount() { return bots.size(); };
+	uint64_t botEncodedBytes();
+
+	size_t handleCount();
+
+	Connection* client() {
+		auto handle = new Handle();
+		handle->room = this;
+		return handle;
+	};
 };
\ No newline at end of file
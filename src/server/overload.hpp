@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <cstdint>
+
+using std::atomic;
+
+// Degradation ladder for sustained tick overrun. Load is step cost over step budget, smoothed.
+// Staying above high for escalateSteps goes one rung down the ladder, staying below low for
+// recoverSteps goes one back up. Every change is logged
+struct OverloadConfig {
+	bool enabled = true;
+	float high = 0.9f;
+	float low = 0.6f;
+	uint32_t escalateSteps = 25; // 0.5s at 20ms steps
+	uint32_t recoverSteps = 250; // 5s, recovering too eagerly just oscillates
+};
+
+class OverloadLadder {
+public:
+	enum Level : uint32_t {
+		NORMAL,
+		SKIP_HOUSEKEEPING, // no cube spawner or sleeping cube sweep
+		NET_HALF,          // snapshots at half rate
+		NET_QUARTER,       // quarter rate
+		NO_CATCH_UP,       // one step per wakeup, late time is dropped instead of simulated
+		LEVELS
+	};
+
+	static const char* name(uint32_t level) {
+		static const char* names[LEVELS] = {
+			"normal", "skip housekeeping", "net rate 1/2", "net rate 1/4", "no catch-up"
+		};
+		return level < LEVELS ? names[level] : "?";
+	}
+
+private:
+	float load = 0.f;
+	uint32_t over = 0;
+	uint32_t under = 0;
+
+public:
+	OverloadConfig config;
+
+	// Metrics, readable from any thread
+	atomic<uint32_t> level = NORMAL;
+	atomic<uint32_t> peakLevel = NORMAL;
+	atomic<uint64_t> changes = 0;
+	atomic<uint64_t> steps[LEVELS] = {};
+	atomic<float> smoothedLoad = 0.f;
+
+	// Once per step, true if the level changed
+	bool update(uint64_t costNano, uint64_t budgetNano) {
+		load += (float(costNano) / budgetNano - load) * 0.1f;
+		smoothedLoad.store(load, std::memory_order_relaxed);
+
+		auto current = level.load(std::memory_order_relaxed);
+		steps[current].fetch_add(1, std::memory_order_relaxed);
+		if (!config.enabled) return false;
+
+		over = load > config.high ? over + 1 : 0;
+		under = load < config.low ? under + 1 : 0;
+
+		auto next = current;
+		if (over >= config.escalateSteps && current + 1 < LEVELS) next = current + 1;
+		else if (under >= config.recoverSteps && current > NORMAL) next = current - 1;
+		if (next == current) return false;
+
+		over = under = 0;
+		level = next;
+		if (next > peakLevel) peakLevel = next;
+		changes++;
+
+		printf("[overload] %s -> %s (load %.2f)\n", name(current), name(next), load);
+		return true;
+	}
+
+	void print() {
+		printf("[overload] level: %s, load %.2f, peak: %s, %lu changes\n",
+			name(level), smoothedLoad.load(), name(peakLevel), changes.load());
+		for (uint32_t i = 0; i < LEVELS; i++) {
+			printf("[overload] %18s: %lu steps\n", name(i), steps[i].load());
+		}
+	}
+};
@@ -0,0 +1,158 @@
+#include "rooms.hpp"
+
+RoomManager::RoomManager(uint32_t count, uint32_t capacity, uint32_t threads, uv_loop_t* loop) :
+	loop(loop), capacity(std::max(1u, capacity)) {
+
+	dispatcher = PxDefaultCpuDispatcherCreate(threads);
+
+	for (uint32_t i = 0; i < count; i++) {
+		auto room = new Room();
+		room->server = new PhysXServer(nullptr, dispatcher);
+		room->server->host = this;
+		room->server->roomId = i;
+		room->server->world->initScene();
+		rooms.emplace_back(room);
+	}
+
+	printf("[rooms] %u rooms of %u, %u physx threads\n", count, this->capacity, threads);
+}
+
+RoomManager::~RoomManager() {
+	for (auto& room : rooms) delete room->server;
+	dispatcher->release();
+}
+
+void RoomManager::run(uint64_t stepInterval, uint64_t netInterval, uint32_t workerCount) {
+	if (running) return;
+	running = true;
+
+	stepNano = std::max<uint64_t>(1, stepInterval);
+	for (auto& room : rooms) room->server->configure(stepInterval, netInterval);
+
+	// First deadlines spread over one step, so rooms don't all come due at once
+	auto start = uv_hrtime();
+	{
+		scoped_lock lock(queue_mutex);
+		for (uint32_t i = 0; i < rooms.size(); i++) {
+			queue.push({ start + stepNano * i / rooms.size(), i });
+		}
+	}
+
+	workerCount = std::max(1u, workerCount);
+	printf("[rooms] step: %.3fms, %u workers\n", stepNano / float(MS_TO_NANO), workerCount);
+	for (uint32_t i = 0; i < workerCount; i++) workers.emplace_back([this] { work(); });
+
+	uv_async_init(loop, &keepAlive, nullptr);
+	uv_run(loop, UV_RUN_DEFAULT);
+
+	{
+		scoped_lock lock(queue_mutex);
+		running = false;
+	}
+	queue_cv.notify_all();
+	for (auto& w : workers) w.join();
+	workers.clear();
+}
+
+void RoomManager::work() {
+	std::unique_lock lock(queue_mutex);
+
+	while (running) {
+		if (queue.empty()) {
+			queue_cv.wait(lock);
+			continue;
+		}
+
+		// Waiting on the cv lets a resumed room with an earlier deadline cut in
+		auto due = queue.top();
+		auto now = uv_hrtime();
+		if (due.deadline > now) {
+			queue_cv.wait_for(lock, nanoseconds(due.deadline - now));
+			continue;
+		}
+		queue.pop();
+
+		lock.unlock();
+		step(due, now);
+		lock.lock();
+	}
+}
+
+// Same as one wakeup of PhysXServer::tickLoop, for whichever room came due
+void RoomManager::step(Due due, uint64_t now) {
+	auto& room = *rooms[due.room];
+	auto server = room.server;
+
+	auto seen = server->wakeups.load();
+	server->clock.jitter.add(now - due.deadline);
+	server->runPosted();
+	server->tick(true);
+
+	auto after = uv_hrtime();
+	room.steps++;
+	room.busyNano += after - now;
+	room.lateNano += now - due.deadline;
+
+	// Back in the queue through resume
+	if (server->hibernate(seen)) return;
+
+	auto next = due.deadline + stepNano;
+	if (after > next + server->substepLimit() * stepNano) {
+		auto behind = (after - next) / stepNano * stepNano;
+		server->clock.droppedNano += behind;
+		room.droppedNano += behind;
+		next += behind;
+	}
+
+	{
+		scoped_lock lock(queue_mutex);
+		queue.push({ next, due.room });
+	}
+	queue_cv.notify_one();
+}
+
+void RoomManager::resume(PhysXServer* room) {
+	room->resume();
+
+	{
+		scoped_lock lock(queue_mutex);
+		queue.push({ uv_hrtime(), room->roomId });
+	}
+	queue_cv.notify_one();
+}
+
+void RoomManager::print() {
+	uint64_t total = 0;
+	for (auto& room : rooms) total += room->busyNano;
+
+	for (auto& room : rooms) {
+		auto server = room->server;
+		uint64_t steps = room->steps, busy = room->busyNano;
+		printf("[rooms] #%u %2zu players%s: %lu steps, %.3fms avg, %.1f%% of the time, %.3fms late avg, %.1fms dropped\n",
+			server->roomId, server->world->playerCount(), server->asleep() ? " (hibernating)" : "",
+			steps, steps ? busy / 1e6 / steps : 0.0, total ? 100.0 * busy / total : 0.0,
+			steps ? room->lateNano / 1e6 / steps : 0.0, room->droppedNano / 1e6);
+	}
+
+	uv_rusage_t usage;
+	uv_getrusage(&usage);
+	auto cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	printf("[rooms] %zu rooms, %.2fs stepping, process cpu %.2fs\n", rooms.size(), total / 1e9, cpu);
+}
+
+NetServer::Connection* RoomManager::client() {
+	// First room with space keeps matches together, everything full goes to the emptiest
+	PhysXServer* emptiest = nullptr;
+	size_t fewest = SIZE_MAX;
+
+	for (auto& room : rooms) {
+		auto count = room->server->handleCount();
+		if (count < capacity) return room->server->client();
+		if (count < fewest) {
+			fewest = count;
+			emptiest = room->server;
+		}
+	}
+
+	return emptiest ? emptiest->client() : new Connection();
+}
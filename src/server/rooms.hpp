@@ -0,0 +1,67 @@
+#pragma once
+
+#include <queue>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+
+#include "game.hpp"
+
+// Many small rooms (a PhysXServer and its World each) in one process. Every world shares one
+// physx dispatcher, and a few workers step the rooms earliest deadline first, so a room costs a
+// scene and its connections instead of a process and 4+ threads. Transports listen on the
+// manager, new connections fill the rooms in order
+class RoomManager : public NetServer {
+	friend PhysXServer;
+
+	struct Due {
+		uint64_t deadline;
+		uint32_t room;
+
+		bool operator>(const Due& other) const { return deadline > other.deadline; };
+	};
+
+	uv_loop_t* loop;
+	PxDefaultCpuDispatcher* dispatcher;
+	atomic<bool> running = false;
+	uint64_t stepNano = 0;
+	uv_async_t keepAlive; // quic doesn't keep the loop busy on its own
+
+	// Rooms waiting for their next step (hibernating ones aren't in here)
+	mutex queue_mutex;
+	std::condition_variable queue_cv;
+	std::priority_queue<Due, vector<Due>, std::greater<Due>> queue;
+	vector<std::thread> workers;
+
+	void work();
+	void step(Due due, uint64_t now);
+
+	// Any thread, from PhysXServer::wake
+	void resume(PhysXServer* room);
+public:
+	struct Room {
+		PhysXServer* server;
+
+		// Accounting, written by whichever worker steps the room
+		atomic<uint64_t> steps = 0;
+		atomic<uint64_t> busyNano = 0;  // time spent in its steps
+		atomic<uint64_t> lateNano = 0;  // summed start lateness
+		atomic<uint64_t> droppedNano = 0;
+	};
+
+	// Fixed once constructed
+	vector<std::unique_ptr<Room>> rooms;
+	uint32_t capacity; // players per room before the next one starts filling
+
+	// World::init first. threads is the shared physx pool, the workers are set in run
+	RoomManager(uint32_t count, uint32_t capacity, uint32_t threads, uv_loop_t* loop = uv_default_loop());
+	~RoomManager();
+
+	// Same intervals as PhysXServer::run, the calling thread runs the loop
+	void run(uint64_t stepInterval, uint64_t netInterval, uint32_t workerCount);
+
+	// Per room players, steps, cost and share of the total, plus the process CPU time
+	void print();
+
+	Connection* client();
+};
@@ -0,0 +1,537 @@
+#include <cmath>
+
+#include "shard.hpp"
+#include "../network/util/reader.hpp"
+#include "../network/util/writer.hpp"
+
+ShardNode::ShardNode(PhysXServer* server, const ShardConfig& config, uv_loop_t* loop) :
+	server(server), world(server->world), loop(loop), listener(this, loop), config(config) {
+	peers.resize(config.count);
+	pendingGhosts.resize(config.count);
+	for (uint32_t i = 0; i < config.index && i < config.count; i++) peers[i].out = new PeerClient(this, i);
+}
+
+ShardNode::~ShardNode() {
+	if (server->shard == this) server->shard = nullptr;
+	listener.stop();
+}
+
+bool ShardNode::start() {
+	if (config.count < 2 || config.count > 64 || config.index >= config.count) {
+		printf("[shard] invalid shard %u of %u\n", config.index, config.count);
+		return false;
+	}
+
+	if (!listener.listen(uint16_t(config.basePort + config.index))) return false;
+
+	server->shard = this;
+	world->spawner.center = PxVec3(lo(config.index) + config.width * 0.5f, 0.f, 0.f);
+
+	// Shards below may not be up yet, keep trying
+	uv_timer_init(loop, &connect_timer);
+	connect_timer.data = this;
+	uv_timer_start(&connect_timer, ShardNode::connect_timer_cb, 0, 1000);
+
+	printf("[shard] %u of %u, x from %.0f to %.0f (%.0fm mirrored)\n", config.index, config.count,
+		config.index ? lo(config.index) : -INFINITY, config.index + 1 < config.count ? hi(config.index) : INFINITY, config.margin);
+	return true;
+}
+
+void ShardNode::connect_timer_cb(uv_timer_t* handle) {
+	auto node = static_cast<ShardNode*>(handle->data);
+	auto& c = node->config;
+
+	for (uint32_t i = 0; i < c.index; i++) {
+		auto out = node->peers[i].out;
+		if (!out->isConnected()) TcpClient::connect(out, node->loop, c.host, uint16_t(c.basePort + i));
+	}
+}
+
+uint32_t ShardNode::shardAt(float x) {
+	return uint32_t(std::clamp(floorf(x / config.width + config.count * 0.5f), 0.f, float(config.count - 1)));
+}
+
+float ShardNode::outside(uint32_t shard, float x) {
+	if (shard > 0 && x < lo(shard)) return lo(shard) - x;
+	if (shard + 1 < config.count && x > hi(shard)) return x - hi(shard);
+	return 0.f;
+}
+
+NetServer::Connection* ShardNode::client() {
+	return new PeerConnection(this);
+}
+
+void ShardNode::PeerConnection::onData(string_view buffer) {
+	if (peer >= 0) {
+		node->post(peer, buffer);
+		return;
+	}
+
+	bool error = false;
+	Reader r(buffer, error);
+	auto type = r.read<uint8_t>();
+	auto index = r.read<uint32_t>();
+
+	if (error || type != SHARD_HELLO || index <= node->config.index || index >= node->config.count) {
+		printf("[shard] unexpected peer\n");
+		disconnect();
+		return;
+	}
+
+	peer = int32_t(index);
+	node->link(index, this);
+}
+
+void ShardNode::PeerConnection::onDisconnect() {
+	if (peer >= 0) node->unlink(peer, this);
+}
+
+void ShardNode::PeerClient::onConnect() {
+	Writer w;
+	w.write<uint8_t>(SHARD_HELLO);
+	w.write<uint32_t>(node->config.index);
+	send(w.finalize(), true);
+
+	node->link(peer, nullptr);
+}
+
+void ShardNode::PeerClient::onData(string_view buffer) {
+	node->post(peer, buffer);
+}
+
+void ShardNode::PeerClient::onDisconnect() {
+	node->unlink(peer, nullptr);
+}
+
+void ShardNode::link(uint32_t peer, PeerConnection* in) {
+	{
+		scoped_lock lock(peer_mutex);
+		auto& p = peers[peer];
+		if (in) p.in = in;
+		p.up = true;
+	}
+	printf("[shard] linked with shard %u\n", peer);
+}
+
+void ShardNode::unlink(uint32_t peer, PeerConnection* in) {
+	{
+		scoped_lock lock(peer_mutex);
+		auto& p = peers[peer];
+		if (in && p.in != in) return;
+		p.in = nullptr;
+		if (!p.up) return;
+		p.up = false;
+	}
+	printf("[shard] lost shard %u\n", peer);
+
+	{
+		scoped_lock lock(inbox_mutex);
+		pendingGhosts[peer].clear();
+		inbox.push_back({ peer, string() });
+	}
+	server->wake();
+}
+
+bool ShardNode::isUp(uint32_t peer) {
+	if (peer >= config.count || peer == config.index) return false;
+	scoped_lock lock(peer_mutex);
+	return peers[peer].up;
+}
+
+bool ShardNode::send(uint32_t peer, string_view buffer) {
+	scoped_lock lock(peer_mutex);
+	auto& p = peers[peer];
+	if (p.up) {
+		stats.bytes += buffer.size();
+		if (p.in) {
+			p.in->send(buffer, true);
+			return true;
+		}
+		if (p.out) return p.out->send(buffer, true);
+	}
+	free((void*) buffer.data());
+	return false;
+}
+
+// Loop thread. A handoff might be for a hibernating shard, mirrors never wake it
+void ShardNode::post(uint32_t peer, string_view buffer) {
+	if (buffer.empty()) return;
+
+	bool wake = buffer[0] == SHARD_HANDOFF;
+	{
+		scoped_lock lock(inbox_mutex);
+		if (buffer[0] == SHARD_GHOSTS) pendingGhosts[peer].assign(buffer);
+		else inbox.push_back({ peer, string(buffer) });
+	}
+	if (wake) server->wake();
+}
+
+// Ticks differ between shards, the ground tick travels as an age
+void ShardNode::writeState(Writer& w, const PlayerState& state) {
+	auto copy = state;
+	auto now = world->getTick();
+	copy.lastGroundTick = now - std::min(state.lastGroundTick, now);
+	w.write<PlayerState>(copy);
+}
+
+PlayerState ShardNode::readState(Reader& r) {
+	PlayerState state;
+	r.read<PlayerState>(state);
+	auto now = world->getTick();
+	state.lastGroundTick = now - std::min(state.lastGroundTick, now);
+	return state;
+}
+
+void ShardNode::receive() {
+	vector<Message> messages;
+	vector<string> ghosts(config.count);
+	{
+		scoped_lock lock(inbox_mutex);
+		messages.swap(inbox);
+		for (uint32_t i = 0; i < config.count; i++) ghosts[i].swap(pendingGhosts[i]);
+	}
+
+	for (auto& m : messages) {
+		if (m.data.empty()) lost(m.peer);
+		else handle(m.peer, m.data);
+	}
+
+	for (uint32_t i = 0; i < config.count; i++) {
+		if (!ghosts[i].empty()) mirror(i, ghosts[i]);
+	}
+
+	// Whatever the client sent since the last step goes to whoever simulates it
+	for (auto it = remotes.begin(); it != remotes.end();) {
+		auto handle = it->second.handle;
+		auto owner = it->second.owner;
+		uint32_t id = it->first;
+
+		if (handle->released) {
+			Writer w;
+			w.write<uint8_t>(SHARD_DROP);
+			w.write<uint32_t>(id);
+			send(owner, w.finalize());
+			it = remotes.erase(it);
+			continue;
+		}
+
+		// Every input, in order, the owner applies them one per step like we would
+		handle->inputs.drain([&](const Player::QueuedInput& queued) {
+			Writer w;
+			w.write<uint8_t>(SHARD_INPUT);
+			w.write<uint32_t>(id);
+			w.write<uint32_t>(queued.seq);
+			w.write<PlayerInput>(queued.input);
+			send(owner, w.finalize());
+		});
+		it++;
+	}
+}
+
+void ShardNode::handle(uint32_t peer, string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+	auto type = r.read<uint8_t>();
+	auto id = r.read<uint32_t>();
+
+	if (type == SHARD_HANDOFF) {
+		auto home = r.read<uint32_t>();
+		auto seq = r.read<uint32_t>();
+		PlayerInput input;
+		r.read<PlayerInput>(input);
+		auto state = readState(r);
+		if (error) return;
+
+		if (home == config.index) {
+			// One of ours walked back in
+			auto it = remotes.find(id);
+			if (it == remotes.end()) return;
+
+			auto handle = it->second.handle;
+			remotes.erase(it);
+			handle->state = state;
+			if (world->unpark(handle)) printf("[shard] #%u is back from shard %u\n", handle->pid, peer);
+		} else if (!proxies.count(id)) {
+			auto proxy = new ShardProxy(id, home);
+			world->spawn(proxy, state.position);
+			proxy->state = state;
+			// Starts from the last input applied, what's still queued follows as SHARD_INPUT
+			proxy->inputSeq = seq;
+			proxy->postedSeq = seq;
+			proxy->lastInput = input;
+			proxies[id] = proxy;
+			printf("[shard] simulating 0x%x from shard %u for shard %u\n", id, peer, home);
+		}
+	} else if (type == SHARD_INPUT) {
+		auto seq = r.read<uint32_t>();
+		PlayerInput input;
+		r.read<PlayerInput>(input);
+
+		// Could be in flight to whoever had it before
+		auto it = proxies.find(id);
+		if (!error && it != proxies.end()) it->second->postInput(input, seq);
+	} else if (type == SHARD_STATE) {
+		auto seq = r.read<uint32_t>();
+		auto state = readState(r);
+
+		// Also how home learns it moved on to another shard
+		auto it = remotes.find(id);
+		if (error || it == remotes.end()) return;
+		it->second.owner = peer;
+		it->second.handle->state = state;
+		it->second.handle->inputSeq = seq;
+	} else if (type == SHARD_DROP) {
+		auto it = proxies.find(id);
+		if (it == proxies.end()) return;
+		world->destroy(it->second);
+		proxies.erase(it);
+	} else {
+		printf("[shard] unknown message from shard %u\n", peer);
+	}
+}
+
+// The full set of what peer mirrors to us, anything missing from it is gone
+void ShardNode::mirror(uint32_t peer, string_view buffer) {
+	bool error = false;
+	Reader r(buffer, error);
+	r.read<uint8_t>();
+	auto count = r.read<uint32_t>();
+	auto now = ++stamp;
+
+	vector<std::pair<uint32_t, PxTransform>> moves;
+
+	for (uint32_t i = 0; i < count && !error; i++) {
+		auto key = r.read<uint64_t>();
+		auto gpid = r.read<uint32_t>();
+		auto type = r.read<uint8_t>();
+		auto dims = r.read<PxVec3>();
+		auto pose = r.read<PxTransform>();
+		if (error || !pose.isValid()) break;
+
+		auto& m = mirrors[mirrorKey(peer, key)];
+		m.stamp = now;
+		if (m.handle) {
+			moves.push_back({ m.handle, pose });
+			continue;
+		}
+
+		PrimitiveObject* obj;
+		if (type == SPH_T) obj = world->addRemote(PxSphereGeometry(dims.x), pose);
+		else if (type == CPS_T) obj = world->addRemote(PxCapsuleGeometry(dims.y, dims.x), pose);
+		else obj = world->addRemote(PxBoxGeometry(dims), pose);
+
+		// Out of object ids, try again with the next set
+		if (!obj) m.stamp = 0;
+		else {
+			m.handle = obj->handle;
+			if (homeOf(gpid)) obj->remoteOf = gpid & 0xFFFFFF;
+		}
+	}
+
+	if (!moves.empty()) {
+		World::RegionLock sl(*world, true);
+		scoped_lock ol(world->object_mutex);
+		for (auto& [handle, pose] : moves) {
+			auto obj = world->resolve(handle);
+			if (obj && !obj->released) static_cast<PxRigidDynamic*>(obj->actor)->setKinematicTarget(pose);
+		}
+	}
+
+	for (auto it = mirrors.begin(); it != mirrors.end();) {
+		if (it->first >> 40 != peer || it->second.stamp == now) it++;
+		else {
+			if (auto obj = world->resolve(it->second.handle)) obj->release();
+			it = mirrors.erase(it);
+		}
+	}
+}
+
+// Peer is gone (or restarting): its mirrors go, our clients over there come back where they
+// were last seen and players we simulated for it are dropped
+void ShardNode::lost(uint32_t peer) {
+	for (auto it = mirrors.begin(); it != mirrors.end();) {
+		if (it->first >> 40 != peer) it++;
+		else {
+			if (auto obj = world->resolve(it->second.handle)) obj->release();
+			it = mirrors.erase(it);
+		}
+	}
+
+	for (auto it = remotes.begin(); it != remotes.end();) {
+		if (it->second.owner != peer) it++;
+		else {
+			world->unpark(it->second.handle);
+			it = remotes.erase(it);
+		}
+	}
+
+	for (auto it = proxies.begin(); it != proxies.end();) {
+		if (it->second->home != peer) it++;
+		else {
+			world->destroy(it->second);
+			it = proxies.erase(it);
+		}
+	}
+}
+
+void ShardNode::handoff(uint32_t to, uint32_t gpid, uint32_t home, Player* player) {
+	// Last input applied rides along, whatever is still queued follows it in order
+	Writer w;
+	w.write<uint8_t>(SHARD_HANDOFF);
+	w.write<uint32_t>(gpid);
+	w.write<uint32_t>(home);
+	w.write<uint32_t>(player->inputSeq);
+	w.write<PlayerInput>(player->lastInput);
+	writeState(w, player->state);
+	send(to, w.finalize());
+
+	player->inputs.drain([&](const Player::QueuedInput& queued) {
+		Writer in;
+		in.write<uint8_t>(SHARD_INPUT);
+		in.write<uint32_t>(gpid);
+		in.write<uint32_t>(queued.seq);
+		in.write<PlayerInput>(queued.input);
+		send(to, in.finalize());
+	});
+
+	stats.handoffs++;
+}
+
+// Players past the border (by more than the hysteresis) go to the shard they're in now
+void ShardNode::handoffs() {
+	vector<PhysXServer::Handle*> leaving;
+	{
+		scoped_lock lock(server->handle_mutex);
+		for (auto& [pid, handle] : server->allHandles) {
+			if (handle->parked || handle->released) continue;
+			if (outside(config.index, handle->state.position.x) > config.hysteresis) leaving.push_back(handle);
+		}
+	}
+
+	for (auto handle : leaving) {
+		auto to = shardAt(handle->state.position.x);
+		if (!isUp(to) || !world->park(handle)) continue;
+
+		auto id = gpid(handle->pid);
+		handoff(to, id, config.index, handle);
+		remotes[id] = { handle, to };
+		printf("[shard] #%u handed off to shard %u\n", handle->pid, to);
+	}
+
+	for (auto it = proxies.begin(); it != proxies.end();) {
+		auto proxy = it->second;
+		auto x = proxy->state.position.x;
+		auto to = shardAt(x);
+		if (outside(config.index, x) <= config.hysteresis || !isUp(to)) {
+			it++;
+			continue;
+		}
+
+		// Straight back home, or on to a third shard that reports to home from now on
+		handoff(to, proxy->pid, proxy->home, proxy);
+		world->destroy(proxy);
+		it = proxies.erase(it);
+	}
+}
+
+void ShardNode::publish(bool net) {
+	handoffs();
+	if (!net) return;
+
+	// States of everyone simulated here for another shard, for their clients' snapshots
+	vector<vector<PxVec3>> interest(config.count);
+	for (auto& [id, proxy] : proxies) {
+		Writer w;
+		w.write<uint8_t>(SHARD_STATE);
+		w.write<uint32_t>(id);
+		w.write<uint32_t>(proxy->inputSeq);
+		writeState(w, proxy->state);
+		send(proxy->home, w.finalize());
+
+		interest[proxy->home].push_back(proxy->state.position);
+	}
+
+	exports.clear();
+	{
+		World::RegionLock sl(*world, false);
+		scoped_lock ol(world->object_mutex);
+
+		for (auto obj : world->objects) {
+			auto actor = obj->actor;
+			if (!actor || obj->remote || obj->released || actor->is<PxRigidStatic>()) continue;
+
+			PxShape* shape;
+			if (actor->getShapes(&shape, 1) != 1) continue;
+
+			Export e;
+			auto geo = shape->getGeometry();
+			auto type = geo.getType();
+			if (type == PxGeometryType::eBOX) {
+				e.type = BOX_T;
+				e.dims = geo.box().halfExtents;
+			} else if (type == PxGeometryType::eSPHERE) {
+				e.type = SPH_T;
+				e.dims = PxVec3(geo.sphere().radius, 0.f, 0.f);
+			} else if (type == PxGeometryType::eCAPSULE) {
+				e.type = CPS_T;
+				e.dims = PxVec3(geo.capsule().halfHeight, geo.capsule().radius, 0.f);
+			} else continue;
+
+			// Controllers' capsules are turned upright by the shape pose
+			e.pose = actor->getGlobalPose() * shape->getLocalPose();
+			e.key = obj->id;
+			e.gpid = 0;
+			if (obj->isPlayer()) {
+				auto pid = static_cast<Player*>(obj)->pid;
+				e.key = uint64_t(1) << 32 | pid;
+				if (!BotPlayer::isBot(static_cast<Player*>(obj))) e.gpid = pid >> 24 ? pid : gpid(pid);
+			}
+			exports.push_back(e);
+		}
+	}
+
+	// Every linked shard gets a set, even an empty one clears what it had
+	for (uint32_t i = 0; i < config.count; i++) {
+		if (isUp(i)) exportTo(i, interest[i]);
+	}
+}
+
+void ShardNode::exportTo(uint32_t peer, const vector<PxVec3>& interest) {
+	bool neighbour = peer + 1 == config.index || config.index + 1 == peer;
+	auto border = peer > config.index ? hi(config.index) : lo(config.index);
+	auto radius = config.interest * config.interest;
+
+	Writer w;
+	w.write<uint8_t>(SHARD_GHOSTS);
+	auto& count = w.ref<uint32_t>();
+
+	for (auto& e : exports) {
+		bool near = neighbour && fabsf(e.pose.p.x - border) <= config.margin;
+		for (size_t i = 0; !near && i < interest.size(); i++) near = (e.pose.p - interest[i]).magnitudeSquared() <= radius;
+		if (!near) continue;
+
+		w.write<uint64_t>(e.key);
+		w.write<uint32_t>(e.gpid);
+		w.write<uint8_t>(e.type);
+		w.write<PxVec3>(e.dims);
+		w.write<PxTransform>(e.pose);
+		count++;
+	}
+
+	stats.mirrored += count;
+	send(peer, w.finalize());
+}
+
+void ShardNode::print() {
+	printf("[shard] %u of %u:", config.index, config.count);
+	{
+		scoped_lock lock(peer_mutex);
+		for (uint32_t i = 0; i < config.count; i++) {
+			if (i != config.index) printf(" #%u %s", i, peers[i].up ? "up" : "down");
+		}
+	}
+	printf("\n[shard] %zu objects mirrored here, %zu clients playing elsewhere, %zu players simulated for others\n",
+		mirrors.size(), remotes.size(), proxies.size());
+	printf("[shard] %lu handoffs, %lu objects mirrored out, %.1fMB sent\n",
+		stats.handoffs.load(), stats.mirrored.load(), stats.bytes.load() / 1e6);
+}
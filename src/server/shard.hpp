@@ -0,0 +1,186 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "game.hpp"
+#include "../network/uv/tcp.hpp"
+
+using std::string;
+
+class Reader;
+class Writer;
+
+// Shard link messages, only ever sent between server processes
+constexpr uint8_t SHARD_HELLO = 0x40;   // u32 index, first message on every link
+constexpr uint8_t SHARD_GHOSTS = 0x41;  // every object mirrored to the receiver, the full set each time
+constexpr uint8_t SHARD_HANDOFF = 0x42; // a player is simulated by the receiver from now on
+constexpr uint8_t SHARD_INPUT = 0x43;   // home -> owner, latest input of a handed off player
+constexpr uint8_t SHARD_STATE = 0x44;   // owner -> home, simulated state for the client's snapshots
+constexpr uint8_t SHARD_DROP = 0x45;    // home -> owner, the client is gone
+
+// One map split over several server processes, in strips along X centered on the origin (the
+// outer two extend forever). Shard i listens on basePort + i and connects to every shard below it
+struct ShardConfig {
+	uint32_t index = 0;
+	uint32_t count = 1;
+	float width = 64.f;
+	float margin = 8.f;      // border strip mirrored to the neighbour on that side
+	float interest = 32.f;   // radius mirrored to the home of a player simulated here
+	float hysteresis = 1.f;  // how far past the border before a player is handed off
+	string host = "127.0.0.1";
+	uint16_t basePort = 7000;
+};
+
+// Stand-in for a client connected to another shard (its home) while it walks around this one.
+// Driven by the inputs home forwards, its state goes back every step
+struct ShardProxy : Player {
+	uint32_t home;
+
+	ShardProxy(uint32_t gpid, uint32_t home) : home(home) { pid = gpid; };
+
+	// Home sends the snapshots
+	void updateState(World*) {};
+};
+
+// Runs a PhysXServer as shard index of count. Every step it mirrors its border strip to the
+// neighbours as kinematic objects (and everything around a player it simulates for someone
+// else to that player's home). A client stays connected to the shard it joined: once it walks
+// past the border its player is parked there and handed off to the shard it walked into, which
+// simulates it from the forwarded inputs and sends the state back for the client's snapshots.
+// Cubes stay with the shard that spawned them
+class ShardNode : public NetServer {
+	class PeerConnection : public Connection {
+	public:
+		ShardNode* node;
+		int32_t peer = -1; // unknown until SHARD_HELLO
+
+		PeerConnection(ShardNode* node) : node(node) {};
+
+		void onData(string_view buffer);
+		void onDisconnect();
+	};
+
+	class PeerClient : public NetClient {
+	public:
+		ShardNode* node;
+		uint32_t peer;
+
+		PeerClient(ShardNode* node, uint32_t peer) : node(node), peer(peer) {};
+
+		void onConnect();
+		void onData(string_view buffer);
+		void onDisconnect();
+	};
+
+	// One link per pair, accepted from the shard above or connected to the one below. Never
+	// freed, transports may still hold on to them at exit. Guarded by peer_mutex
+	struct Peer {
+		PeerConnection* in = nullptr;
+		PeerClient* out = nullptr;
+		bool up = false;
+	};
+
+	struct Message {
+		uint32_t peer;
+		string data; // empty: the link went down
+	};
+
+	// Mirrors by sender and the sender's key (object id, or player pid with bit 32)
+	struct Mirror {
+		uint32_t handle; // World::resolve
+		uint64_t stamp;
+	};
+
+	// Clients of this shard simulated elsewhere, by global pid
+	struct Remote {
+		PhysXServer::Handle* handle;
+		uint32_t owner;
+	};
+
+	PhysXServer* server;
+	World* world;
+	uv_loop_t* loop;
+	TcpServer listener;
+	uv_timer_t connect_timer;
+
+	mutex peer_mutex;
+	vector<Peer> peers;
+
+	// Filled on the loop thread, only the latest mirror set of each peer is kept
+	mutex inbox_mutex;
+	vector<Message> inbox;
+	vector<string> pendingGhosts;
+
+	// Everything this shard could mirror, gathered once per net step
+	struct Export {
+		uint64_t key;
+		uint32_t gpid; // players only
+		uint8_t type;  // BOX_T, SPH_T or CPS_T
+		PxVec3 dims;   // half extents, radius in x, or half height and radius
+		PxTransform pose;
+	};
+
+	// Tick thread only
+	vector<Export> exports;
+	std::unordered_map<uint64_t, Mirror> mirrors;
+	std::unordered_map<uint32_t, Remote> remotes;
+	std::unordered_map<uint32_t, ShardProxy*> proxies;
+	uint64_t stamp = 0;
+
+	static void connect_timer_cb(uv_timer_t* handle);
+	static uint64_t mirrorKey(uint32_t peer, uint64_t key) { return uint64_t(peer) << 40 | key; };
+
+	// Global pid, unique across shards (bots never leave their shard)
+	uint32_t gpid(uint32_t pid) { return (config.index + 1) << 24 | pid; };
+	bool homeOf(uint32_t gpid) { return (gpid >> 24) == config.index + 1; };
+
+	float lo(uint32_t shard) { return (float(shard) - config.count * 0.5f) * config.width; };
+	float hi(uint32_t shard) { return lo(shard) + config.width; };
+	uint32_t shardAt(float x);
+	float outside(uint32_t shard, float x);
+
+	// Any thread
+	void post(uint32_t peer, string_view buffer);
+	bool send(uint32_t peer, string_view buffer);
+	bool isUp(uint32_t peer);
+	void link(uint32_t peer, PeerConnection* in);
+	void unlink(uint32_t peer, PeerConnection* in);
+	void handoff(uint32_t to, uint32_t gpid, uint32_t home, Player* player);
+
+	// Tick thread
+	void handle(uint32_t peer, string_view buffer);
+	void mirror(uint32_t peer, string_view buffer);
+	void lost(uint32_t peer);
+	void handoffs();
+	void exportTo(uint32_t peer, const vector<PxVec3>& interest);
+	PlayerState readState(Reader& r);
+	void writeState(Writer& w, const PlayerState& state);
+public:
+	ShardConfig config;
+
+	struct {
+		atomic<uint64_t> handoffs = 0;
+		atomic<uint64_t> mirrored = 0; // objects sent in ghost sets
+		atomic<uint64_t> bytes = 0;    // everything sent to other shards
+	} stats;
+
+	ShardNode(PhysXServer* server, const ShardConfig& config, uv_loop_t* loop = uv_default_loop());
+	~ShardNode();
+
+	// Before the loop runs: listens, moves the spawner into this strip and starts connecting
+	bool start();
+
+	// Tick thread (PhysXServer::tick). receive applies what came in before players move,
+	// publish hands off players past the border and, on net steps, sends states and mirrors
+	void receive();
+	void publish(bool net);
+
+	// Tick thread (post)
+	void print();
+
+	// Tick thread, clients of this shard played elsewhere still need snapshots (no hibernating)
+	size_t remoteCount() { return remotes.size(); };
+
+	Connection* client();
+};
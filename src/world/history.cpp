@@ -0,0 +1,235 @@
+#include "history.hpp"
+
+#include <numeric>
+#include <algorithm>
+
+void PoseFrame::clear() {
+	entries.clear();
+	bounds.clear();
+	order.clear();
+	nodes.clear();
+	unbounded.clear();
+}
+
+void PoseFrame::add(uint16_t id, uint32_t pid, const PxTransform& pose, const PxGeometryHolder& geometry) {
+	Entry e = { id, pid, pose, geometry };
+
+	if (geometry.getType() == PxGeometryType::ePLANE) {
+		unbounded.push_back(e);
+	} else {
+		entries.push_back(e);
+		bounds.push_back(PxGeometryQuery::getWorldBounds(geometry.any(), pose));
+	}
+}
+
+// Top down, median split on the longest axis of the centroids
+void PoseFrame::build() {
+	uint32_t n = uint32_t(entries.size());
+	order.resize(n);
+	std::iota(order.begin(), order.end(), 0);
+
+	nodes.clear();
+	if (!n) return;
+
+	nodes.push_back({ PxBounds3::empty(), 0, n });
+
+	vector<uint32_t> pending = { 0 };
+	while (!pending.empty()) {
+		auto index = pending.back();
+		pending.pop_back();
+
+		auto first = nodes[index].first;
+		auto count = nodes[index].count;
+
+		auto box = PxBounds3::empty();
+		auto centroids = PxBounds3::empty();
+		for (uint32_t i = first; i < first + count; i++) {
+			box.include(bounds[order[i]]);
+			centroids.include(bounds[order[i]].getCenter());
+		}
+		nodes[index].bounds = box;
+
+		if (count <= LEAF_SIZE) continue;
+
+		auto size = centroids.getDimensions();
+		uint32_t axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+
+		auto begin = order.begin() + first;
+		auto mid = first + count / 2;
+		std::nth_element(begin, order.begin() + mid, begin + count, [&](uint32_t a, uint32_t b) {
+			return bounds[a].getCenter(axis) < bounds[b].getCenter(axis);
+		});
+
+		auto child = uint32_t(nodes.size());
+		nodes.push_back({ PxBounds3::empty(), first, mid - first });
+		nodes.push_back({ PxBounds3::empty(), mid, first + count - mid });
+		nodes[index].first = child;
+		nodes[index].count = 0;
+
+		pending.push_back(child);
+		pending.push_back(child + 1);
+	}
+}
+
+// Slab test, near distance in t
+static inline bool rayBox(const PxVec3& origin, const PxVec3& inv, const PxBounds3& box, float maxDist, float& t) {
+	float t0 = 0.f, t1 = maxDist;
+	for (uint32_t i = 0; i < 3; i++) {
+		float tNear = (box.minimum[i] - origin[i]) * inv[i];
+		float tFar = (box.maximum[i] - origin[i]) * inv[i];
+		if (tNear > tFar) std::swap(tNear, tFar);
+		t0 = std::max(t0, tNear);
+		t1 = std::min(t1, tFar);
+		if (t0 > t1) return false;
+	}
+	t = t0;
+	return true;
+}
+
+bool PoseFrame::raycast(const PxVec3& origin, const PxVec3& dir, float maxDist, RaycastHit& hit, uint32_t ignorePid) const {
+	hit = RaycastHit();
+	hit.distance = maxDist;
+	bool found = false;
+
+	auto test = [&](const Entry& e) {
+		if (ignorePid && e.pid == ignorePid) return;
+
+		PxRaycastHit h;
+		if (!PxGeometryQuery::raycast(origin, dir, e.geometry.any(), e.pose, hit.distance, PxHitFlag::eDEFAULT, 1, &h)) return;
+		if (found && h.distance >= hit.distance) return;
+
+		hit.id = e.id;
+		hit.pid = e.pid;
+		hit.distance = h.distance;
+		hit.position = h.position;
+		hit.normal = h.normal;
+		found = true;
+	};
+
+	for (auto& e : unbounded) test(e);
+	if (nodes.empty()) return found;
+
+	// Huge instead of inf so 0 * inv stays finite
+	PxVec3 inv;
+	for (uint32_t i = 0; i < 3; i++) inv[i] = dir[i] != 0.f ? 1.f / dir[i] : PX_MAX_F32;
+
+	// Median splits keep the depth at log2(entries / LEAF_SIZE)
+	uint32_t stack[64];
+	uint32_t top = 0;
+	stack[top++] = 0;
+
+	while (top) {
+		auto& node = nodes[stack[--top]];
+
+		float t;
+		if (!rayBox(origin, inv, node.bounds, hit.distance, t)) continue;
+
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				if (!rayBox(origin, inv, bounds[order[i]], hit.distance, t)) continue;
+				test(entries[order[i]]);
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	return found;
+}
+
+size_t PoseFrame::overlap(const PxGeometry& geometry, const PxTransform& pose, vector<const Entry*>& out, uint32_t ignorePid) const {
+	auto before = out.size();
+
+	auto test = [&](const Entry& e) {
+		if (ignorePid && e.pid == ignorePid) return;
+		if (PxGeometryQuery::overlap(geometry, pose, e.geometry.any(), e.pose)) out.push_back(&e);
+	};
+
+	for (auto& e : unbounded) test(e);
+	if (nodes.empty()) return out.size() - before;
+
+	auto box = PxGeometryQuery::getWorldBounds(geometry, pose);
+
+	uint32_t stack[64];
+	uint32_t top = 0;
+	stack[top++] = 0;
+
+	while (top) {
+		auto& node = nodes[stack[--top]];
+		if (!node.bounds.intersects(box)) continue;
+
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				if (bounds[order[i]].intersects(box)) test(entries[order[i]]);
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	return out.size() - before;
+}
+
+void PoseHistory::resize(size_t ticks) {
+	scoped_lock lock(m);
+	ring.assign(ticks, nullptr);
+	head = 0;
+}
+
+size_t PoseHistory::capacity() const {
+	scoped_lock lock(m);
+	return ring.size();
+}
+
+shared_ptr<PoseFrame> PoseHistory::acquire() {
+	scoped_lock lock(m);
+	if (ring.empty()) return nullptr;
+
+	// Copies are only ever made under the lock, so a count of 1 means nobody can be reading it
+	auto& oldest = ring[head];
+	if (oldest && oldest.use_count() == 1) {
+		auto frame = std::move(oldest);
+		oldest = nullptr;
+		return frame;
+	}
+
+	oldest = nullptr;
+	return std::make_shared<PoseFrame>();
+}
+
+void PoseHistory::publish(shared_ptr<PoseFrame> frame) {
+	scoped_lock lock(m);
+	if (ring.empty()) return;
+
+	ring[head] = std::move(frame);
+	head = (head + 1) % ring.size();
+}
+
+shared_ptr<const PoseFrame> PoseHistory::at(uint64_t tick) const {
+	scoped_lock lock(m);
+	for (auto& frame : ring) {
+		if (frame && frame->tick == tick) return frame;
+	}
+	return nullptr;
+}
+
+shared_ptr<const PoseFrame> PoseHistory::atTime(uint64_t time) const {
+	scoped_lock lock(m);
+	shared_ptr<const PoseFrame> best, oldest;
+
+	for (auto& frame : ring) {
+		if (!frame) continue;
+		if (!oldest || frame->time < oldest->time) oldest = frame;
+		if (frame->time <= time && (!best || frame->time > best->time)) best = frame;
+	}
+
+	return best ? best : oldest;
+}
+
+shared_ptr<const PoseFrame> PoseHistory::latest() const {
+	scoped_lock lock(m);
+	if (ring.empty()) return nullptr;
+	return ring[(head + ring.size() - 1) % ring.size()];
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <PxPhysicsAPI.h>
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cinttypes>
+
+using namespace physx;
+
+using std::mutex;
+using std::vector;
+using std::shared_ptr;
+using std::scoped_lock;
+
+// Every object's pose at the end of one tick, with a BVH over their world bounds. A frame is
+// immutable once published, queries on it never touch the live scene
+struct PoseFrame {
+    struct Entry {
+        uint16_t id;
+        uint32_t pid; // players only, 0 otherwise
+        PxTransform pose;
+        PxGeometryHolder geometry;
+    };
+
+    struct Node {
+        PxBounds3 bounds;
+        uint32_t first; // leaf: offset into order, inner: index of the left child (right is first + 1)
+        uint32_t count; // 0 for inner nodes
+    };
+
+    struct RaycastHit {
+        uint16_t id = 0;
+        uint32_t pid = 0;
+        float distance = PX_MAX_F32;
+        PxVec3 position;
+        PxVec3 normal;
+    };
+
+    static constexpr uint32_t LEAF_SIZE = 4;
+
+    uint64_t tick = 0; // tick of the snapshot that carried these poses
+    uint64_t time = 0; // steady clock us when recorded, same clock as ClockSync::now
+
+    vector<Entry> entries;
+    vector<PxBounds3> bounds; // per entry
+    vector<uint32_t> order;   // entries sorted by the build, leaves are ranges of this
+    vector<Node> nodes;
+    vector<Entry> unbounded;  // planes, tested by every query
+
+    void clear();
+    void add(uint16_t id, uint32_t pid, const PxTransform& pose, const PxGeometryHolder& geometry);
+    void build();
+
+    // Closest hit along the ray, dir must be normalized. ignorePid skips a player (e.g. the shooter)
+    bool raycast(const PxVec3& origin, const PxVec3& dir, float maxDist, RaycastHit& hit, uint32_t ignorePid = 0) const;
+
+    // Appends every entry overlapping the geometry, returns how many were added
+    size_t overlap(const PxGeometry& geometry, const PxTransform& pose, vector<const Entry*>& out, uint32_t ignorePid = 0) const;
+};
+
+// The last N frames, recorded by the world thread right after fetchResults. Readers take a
+// reference to a frame and query it without any lock held, a frame is only recycled for
+// recording once nobody references it anymore
+class PoseHistory {
+    mutable mutex m; // guards the ring only, never held during a query
+    vector<shared_ptr<PoseFrame>> ring;
+    size_t head = 0;
+
+public:
+    PoseHistory(size_t ticks = 32) : ring(ticks) {};
+
+    // 0 turns recording off
+    void resize(size_t ticks);
+    size_t capacity() const;
+
+    // World thread: a frame to fill in, then publish it
+    shared_ptr<PoseFrame> acquire();
+    void publish(shared_ptr<PoseFrame> frame);
+
+    // Exact tick, null if it isn't (or no longer) recorded
+    shared_ptr<const PoseFrame> at(uint64_t tick) const;
+    // Latest frame recorded at or before time, the oldest one if time is older than all of them
+    shared_ptr<const PoseFrame> atTime(uint64_t time) const;
+    shared_ptr<const PoseFrame> latest() const;
+};
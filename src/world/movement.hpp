@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../network/protocol/common.hpp"
+
+// Player movement rules, shared by World::updatePlayers and the client side predictor.
+// Anything changed here changes both, which is the point
+
+namespace movement {
+    constexpr float MOVE_SPEED = 5.f;
+    constexpr float JUMP_SPEED = 15.f;
+
+    // Velocity to feed the controller this tick (scale by dt), updates the state's velocity
+    inline PxVec3 intent(PlayerInput input, PlayerState& state, uint64_t tick) {
+        if (!input.dir.isFinite()) input.dir = PxZero;
+        PxVec3 dir(input.dir.x, 0, input.dir.y);
+
+        auto len = dir.normalize();
+        if (!len) dir = PxVec3(1, 0, 0);
+
+        PxVec3 side = dir.cross(PxVec3(0, 1, 0));
+
+        float ws = 0.f, ad = 0.f;
+        if (input.movL) ad += -1.f;
+        if (input.movR) ad += 1.f;
+        if (input.movB) ws += -1.f;
+        if (input.movF) ws += 1.f;
+
+        if (input.jump && state.ground && !state.velocity.y) {
+            state.velocity.y = JUMP_SPEED;
+        }
+
+        PxVec3 movement;
+
+        auto airTick = tick - state.lastGroundTick;
+        auto fallV = airTick * (1.f / 15) * -9.81f;
+
+        if (state.ground) {
+            movement = (ws * dir + ad * side).getNormalized() * MOVE_SPEED;
+            movement.y = state.velocity.y + fallV;
+
+            state.velocity.x = movement.x;
+            state.velocity.z = movement.z;
+        } else {
+            movement.y = state.velocity.y + fallV;
+            movement.x = state.velocity.x;
+            movement.z = state.velocity.z;
+        }
+
+        return movement;
+    }
+
+    // After the move: grounded if the controller hit something below
+    inline void land(PlayerState& state, const PxVec3& position, bool down, uint64_t tick) {
+        state.position = position;
+
+        if (down) {
+            state.ground = true;
+            state.velocity.y = 0;
+            state.lastGroundTick = tick;
+        } else {
+            state.ground = false;
+        }
+    }
+}
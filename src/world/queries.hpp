@@ -0,0 +1,86 @@
+#pragma once
+
+#include <PxPhysicsAPI.h>
+
+#include <atomic>
+#include <vector>
+#include <functional>
+
+using namespace physx;
+
+using std::atomic;
+using std::vector;
+
+// A batch of scene queries for World::submit. Fill it in, submit it, and the results show up in
+// the arrays below (same index as the query) after the query phase of the tick, which runs them
+// in parallel right after fetchResults. Hit actors carry their WorldObject in userData.
+// The batch must stay alive until done is set, don't touch it while it's queued
+struct QueryBatch {
+    struct Raycast {
+        PxVec3 origin;
+        PxVec3 dir; // normalized
+        float distance;
+    };
+
+    struct Sweep {
+        PxGeometryHolder geometry;
+        PxTransform pose;
+        PxVec3 dir; // normalized
+        float distance;
+    };
+
+    struct Overlap {
+        PxGeometryHolder geometry;
+        PxTransform pose;
+    };
+
+    PxQueryFilterData filter = PxQueryFilterData(PxQueryFlag::eSTATIC | PxQueryFlag::eDYNAMIC);
+    uint32_t maxOverlapHits = 8;
+
+    vector<Raycast> raycasts;
+    vector<Sweep> sweeps;
+    vector<Overlap> overlaps;
+
+    // Closest hit per query, actor is null on a miss
+    vector<PxRaycastHit> raycastHits;
+    vector<PxSweepHit> sweepHits;
+    // maxOverlapHits slots per query, overlapCounts says how many are used
+    vector<PxOverlapHit> overlapHits;
+    vector<uint32_t> overlapCounts;
+
+    // Set after the query phase, unless onDone is given
+    atomic<bool> done = false;
+
+    // Tick thread, right after the query phase. Can clear and submit the batch again
+    std::function<void(QueryBatch&)> onDone;
+
+    uint32_t raycast(const PxVec3& origin, const PxVec3& dir, float distance) {
+        raycasts.push_back({ origin, dir, distance });
+        return uint32_t(raycasts.size() - 1);
+    }
+
+    uint32_t sweep(const PxGeometry& geometry, const PxTransform& pose, const PxVec3& dir, float distance) {
+        sweeps.push_back({ PxGeometryHolder(geometry), pose, dir, distance });
+        return uint32_t(sweeps.size() - 1);
+    }
+
+    uint32_t overlap(const PxGeometry& geometry, const PxTransform& pose) {
+        overlaps.push_back({ PxGeometryHolder(geometry), pose });
+        return uint32_t(overlaps.size() - 1);
+    }
+
+    const PxOverlapHit* overlapResult(uint32_t i, uint32_t& count) const {
+        count = overlapCounts[i];
+        return overlapHits.data() + size_t(i) * maxOverlapHits;
+    }
+
+    size_t size() const { return raycasts.size() + sweeps.size() + overlaps.size(); };
+
+    // Ready for the next tick's queries
+    void clear() {
+        raycasts.clear();
+        sweeps.clear();
+        overlaps.clear();
+        done = false;
+    }
+};
@@ -1,7 +1,10 @@
 #include "world.hpp"
+#include "movement.hpp"
 #include <thread>
+#include <chrono>
 #include <random>
 #include <algorithm>
+#include <unordered_map>
 
 using std::scoped_lock;
 
@@ -38,6 +41,11 @@ void World::cleanup() {
     foundation->release();
 }
 
+// Kinematic and static pairs only get through the filter (kineKineFilteringMode eKEEP) for reports
+static inline bool isFixed(PxFilterObjectAttributes attr) {
+	return PxFilterObjectIsKinematic(attr) || PxGetFilterObjectType(attr) == PxFilterObjectType::eRIGID_STATIC;
+}
+
 PxFilterFlags ContactReportFilterShader(
 	PxFilterObjectAttributes attr0, PxFilterData fd0,
 	PxFilterObjectAttributes attr1, PxFilterData fd1,
@@ -49,30 +57,118 @@ PxFilterFlags ContactReportFilterShader(
 		return PxFilterFlag::eDEFAULT;
 	}
 
-	flags = PxPairFlag::eCONTACT_DEFAULT | PxPairFlag::eNOTIFY_TOUCH_FOUND;
+	bool report = (fd0.word1 & fd1.word0) || (fd1.word1 & fd0.word0);
+	if (!report && isFixed(attr0) && isFixed(attr1)) return PxFilterFlag::eSUPPRESS;
+
+	flags = PxPairFlag::eCONTACT_DEFAULT;
+	if (report) flags |= PxPairFlag::eNOTIFY_TOUCH_FOUND | PxPairFlag::eNOTIFY_TOUCH_LOST | PxPairFlag::eNOTIFY_CONTACT_POINTS;
 	return PxFilterFlag::eDEFAULT;
 }
 
 void World::onContact(const PxContactPairHeader& pairHeader, const PxContactPair* pairs, PxU32 nbPairs) {
-	// printf("Contacting pairs: %u\n", nbPairs);
+	// Released actors are gone from the snapshot anyway
+	if (pairHeader.flags & (PxContactPairHeaderFlag::eREMOVED_ACTOR_0 | PxContactPairHeaderFlag::eREMOVED_ACTOR_1)) return;
+
+	WorldObject* objs[2] = {
+		static_cast<WorldObject*>(pairHeader.actors[0]->userData),
+		static_cast<WorldObject*>(pairHeader.actors[1]->userData)
+	};
+	if (!objs[0] || !objs[1]) return;
+
+	ContactEvent e;
+	e.tick = tick;
+	for (int i = 0; i < 2; i++) {
+		e.id[i] = objs[i]->id;
+		e.pid[i] = objs[i]->isPlayer() ? static_cast<Player*>(objs[i])->pid : 0;
+	}
+
 	for (PxU32 i = 0; i < nbPairs; i++) {
 		contacting++;
 
 		auto& pair = pairs[i];
-		auto obj0 = static_cast<WorldObject*>(pair.shapes[0]->getActor()->userData);
-		auto obj1 = static_cast<WorldObject*>(pair.shapes[1]->getActor()->userData);
+		e.lost = pair.events & PxPairFlag::eNOTIFY_TOUCH_LOST;
+		e.point = e.normal = PxVec3(PxZero);
+		e.impulse = 0.f;
+
+		PxContactPairPoint point;
+		if (!e.lost && pair.contactCount && pair.extractContacts(&point, 1)) {
+			e.point = point.position;
+			e.normal = point.normal;
+			e.impulse = point.impulse.magnitude();
+		}
+
+		if (!contacts.push(e)) contactsDropped++;
 	}
 }
 
-World::World() {
-    PxSceneDesc sceneDesc(physics->getTolerancesScale());
-	sceneDesc.gravity = PxVec3(0.0f, -9.81f, 0.0f);
+uint32_t World::reportMask(uint32_t group) {
+	uint32_t mask = 0;
+	for (uint32_t bit = 0; bit < 3; bit++) {
+		if (group & (1 << bit)) mask |= reportMasks[bit];
+	}
+	return mask;
+}
+
+void World::setGroup(PxRigidActor* actor, uint32_t group) {
+	PxFilterData data(group, reportMask(group), 0, 0);
+
+	PxShape* shapes[4];
+	auto count = actor->getShapes(shapes, 4);
+	for (PxU32 i = 0; i < count; i++) shapes[i]->setSimulationFilterData(data);
+}
+
+void World::reportContacts(uint32_t group, uint32_t against) {
+	RegionLock sl(*this, true);
+	scoped_lock ol(object_mutex);
+
+	for (uint32_t bit = 0; bit < 3; bit++) {
+		if (group & (1 << bit)) reportMasks[bit] |= against;
+	}
+
+	// Existing pairs keep their flags until they're filtered again
+	for (auto obj : objects) {
+		if (!obj->actor) continue;
+
+		PxShape* shape;
+		if (!obj->actor->getShapes(&shape, 1)) continue;
+
+		auto current = shape->getSimulationFilterData().word0;
+		if (!(current & group)) continue;
+
+		setGroup(obj->actor, current);
+		regions[obj->region].scene->resetFiltering(*obj->actor);
+	}
 
-	auto t = 4; // std::thread::hardware_concurrency();
+	// Statics copied into the other regions (see insert) carry the original's filter data too
+	for (auto copy : staticCopies) {
+		PxShape* shape;
+		if (!copy->getShapes(&shape, 1)) continue;
 
-	printf("[world] using %u threads\n", t);
+		auto current = shape->getSimulationFilterData().word0;
+		if (!(current & group)) continue;
+
+		setGroup(copy, current);
+		copy->getScene()->resetFiltering(*copy);
+	}
+}
+
+World::World(PxDefaultCpuDispatcher* shared) : dispatcher(shared), ownsDispatcher(!shared), gen(std::random_device{}()) {
+	if (ownsDispatcher) {
+		auto t = 4; // std::thread::hardware_concurrency();
+
+		printf("[world] using %u threads\n", t);
+
+		dispatcher = PxDefaultCpuDispatcherCreate(t);
+	}
+
+	shared_mat = physics->createMaterial(0.5f, 0.5f, 0.1f);
+	createRegions(1);
+}
+
+void World::createRegions(uint32_t count) {
+    PxSceneDesc sceneDesc(physics->getTolerancesScale());
+	sceneDesc.gravity = PxVec3(0.0f, -9.81f, 0.0f);
 
-	dispatcher = PxDefaultCpuDispatcherCreate(t);
 	sceneDesc.flags = PxSceneFlag::eREQUIRE_RW_LOCK;
 	sceneDesc.cpuDispatcher = dispatcher;
 	// Report kin-kin & static-kin contacts with be reported
@@ -94,40 +190,229 @@ World::World() {
 	}
 #endif
 
-	shared_mat = physics->createMaterial(0.5f, 0.5f, 0.1f);
-	scene = physics->createScene(sceneDesc);
-	ctm = PxCreateControllerManager(*scene);
+	for (auto& r : regions) {
+		r.ctm->release();
+		r.scene->release();
+	}
+	regions.clear();
+
+	for (uint32_t i = 0; i < count; i++) {
+		Region r;
+		r.scene = physics->createScene(sceneDesc);
+		r.ctm = PxCreateControllerManager(*r.scene);
+		r.ctm->setOverlapRecoveryModule(true);
+		regions.push_back(r);
+	}
+
+	scene = regions[0].scene;
+	ctm = regions[0].ctm;
+}
+
+bool World::partition(const PartitionConfig& config) {
+	if (!objects.empty() || !config.cols || !config.rows || config.cols * config.rows > 1024) return false;
+	partitioning = config;
+	if (config.cols * config.rows == regions.size()) return true;
+
+	// One scene doesn't go much wider than this by itself, several can
+	if (ownsDispatcher && config.cols * config.rows > 1) {
+		auto t = std::max(4u, std::thread::hardware_concurrency());
+		dispatcher->release();
+		dispatcher = PxDefaultCpuDispatcherCreate(t);
+		printf("[world] using %u threads\n", t);
+	}
+
+	createRegions(config.cols * config.rows);
+	printf("[world] %ux%u regions of %.0fm, %.1fm ghost margin\n", config.cols, config.rows, config.size, config.margin);
+	return true;
+}
+
+uint16_t World::regionAt(const PxVec3& p) {
+	auto& c = partitioning;
+	auto cell = [&](float v, uint32_t n) {
+		return uint32_t(std::clamp(floorf((v + n * c.size * 0.5f) / c.size), 0.f, float(n - 1)));
+	};
+	return uint16_t(cell(p.z, c.rows) * c.cols + cell(p.x, c.cols));
+}
+
+float World::outside(uint16_t region, const PxVec3& p) {
+	auto& c = partitioning;
+	auto axis = [&](float v, uint32_t i, uint32_t n) {
+		auto lo = (float(i) - n * 0.5f) * c.size, hi = lo + c.size;
+		if (i > 0 && v < lo) return lo - v;
+		if (i + 1 < n && v > hi) return v - hi;
+		return 0.f;
+	};
+	return std::max(axis(p.x, region % c.cols, c.cols), axis(p.z, region / c.cols, c.rows));
+}
+
+World::RegionLock::RegionLock(World& world, bool write) : world(world), write(write) {
+	for (auto& r : world.regions) write ? r.scene->lockWrite() : r.scene->lockRead();
+}
+
+World::RegionLock::~RegionLock() {
+	for (auto r = world.regions.rbegin(); r != world.regions.rend(); r++) write ? r->scene->unlockWrite() : r->scene->unlockRead();
+}
+
+uint16_t World::insert(PxRigidActor* actor) {
+	auto region = regions.size() > 1 ? regionAt(actor->getGlobalPose().p) : 0;
+	regions[region].scene->addActor(*actor);
+	if (!actor->is<PxRigidStatic>()) return region;
+
+	// Same shapes and filter data in every other region, reported as the original
+	PxShape* shapes[4];
+	auto count = actor->getShapes(shapes, 4);
+	for (uint16_t r = 0; r < regions.size(); r++) {
+		if (r == region) continue;
+
+		auto copy = physics->createRigidStatic(actor->getGlobalPose());
+		for (PxU32 i = 0; i < count; i++) {
+			auto shape = PxRigidActorExt::createExclusiveShape(*copy, shapes[i]->getGeometry().any(), *shared_mat);
+			shape->setLocalPose(shapes[i]->getLocalPose());
+			shape->setSimulationFilterData(shapes[i]->getSimulationFilterData());
+		}
+		copy->userData = actor->userData;
+		regions[r].scene->addActor(*copy);
+		staticCopies.push_back(copy);
+	}
+	return region;
+}
+
+// Tick thread, before simulate with every region write locked
+void World::updateGhosts() {
+	for (auto& [key, ghost] : ghosts) ghost.seen = false;
+
+	auto& c = partitioning;
+	scoped_lock ol(object_mutex);
+
+	for (auto obj : objects) {
+		if (!obj->actor || obj->released || obj->actor->is<PxRigidStatic>()) continue;
+
+		auto pose = obj->actor->getGlobalPose();
+		auto cx = int32_t(obj->region % c.cols), cz = int32_t(obj->region / c.cols);
+
+		for (int32_t dz = -1; dz <= 1; dz++) for (int32_t dx = -1; dx <= 1; dx++) {
+			auto x = cx + dx, z = cz + dz;
+			if ((!dx && !dz) || x < 0 || z < 0 || x >= int32_t(c.cols) || z >= int32_t(c.rows)) continue;
+
+			auto region = uint16_t(z * c.cols + x);
+			if (outside(region, pose.p) > c.margin) continue;
+
+			auto& ghost = ghosts[ghostKey(obj, region)];
+			if (!ghost.actor) {
+				ghost.actor = physics->createRigidDynamic(pose);
+				ghost.actor->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+
+				PxShape* shapes[4];
+				auto count = obj->actor->getShapes(shapes, 4);
+				for (PxU32 i = 0; i < count; i++) {
+					auto shape = PxRigidActorExt::createExclusiveShape(*ghost.actor, shapes[i]->getGeometry().any(), *shared_mat,
+						PxShapeFlag::eSIMULATION_SHAPE);
+					shape->setLocalPose(shapes[i]->getLocalPose());
+					shape->setSimulationFilterData(PxFilterData(shapes[i]->getSimulationFilterData().word0, 0, 0, 0));
+				}
+				regions[region].scene->addActor(*ghost.actor);
+			} else ghost.actor->setKinematicTarget(pose);
+			ghost.seen = true;
+		}
+	}
+
+	for (auto it = ghosts.begin(); it != ghosts.end();) {
+		if (it->second.seen) it++;
+		else {
+			it->second.actor->release();
+			it = ghosts.erase(it);
+		}
+	}
+}
+
+// Tick thread, after fetchResults with every region write locked
+void World::migrate() {
+	scoped_lock ol(object_mutex);
+
+	for (auto obj : objects) {
+		if (!obj->actor || obj->released || obj->actor->is<PxRigidStatic>()) continue;
+
+		auto p = obj->actor->getGlobalPose().p;
+		if (outside(obj->region, p) <= partitioning.margin * 0.25f) continue;
+		auto to = regionAt(p);
+
+		// Whatever ghost it had over there is the real thing now
+		auto ghost = ghosts.find(ghostKey(obj, to));
+		if (ghost != ghosts.end()) {
+			ghost->second.actor->release();
+			ghosts.erase(ghost);
+		}
+
+		if (obj->isPlayer()) {
+			// Controllers belong to one manager, so the player gets a new one over there
+			auto player = static_cast<Player*>(obj);
+			scoped_lock lock(player->world_mutex);
+			if (!player->ct) continue;
+
+			auto desc = controllerDesc(player, player->ct->getPosition());
+			player->ct->release();
+			player->ct = regions[to].ctm->createController(desc);
+			player->actor = player->ct->getActor();
+			player->actor->userData = player;
+			setGroup(player->actor, GROUP_PLAYER);
+		} else {
+			auto body = obj->actor->is<PxRigidDynamic>();
+			// Kinematic or frozen, no velocity to carry over (a frozen one's is kept aside)
+			if (obj->remote || obj->frozen) {
+				regions[obj->region].scene->removeActor(*body);
+				regions[to].scene->addActor(*body);
+				obj->region = to;
+				continue;
+			}
 
-	ctm->setOverlapRecoveryModule(true);
+			auto linear = body->getLinearVelocity(), angular = body->getAngularVelocity();
+			bool sleeping = body->isSleeping();
+
+			regions[obj->region].scene->removeActor(*body);
+			regions[to].scene->addActor(*body);
+			body->setLinearVelocity(linear);
+			body->setAngularVelocity(angular);
+			if (sleeping) body->putToSleep();
+		}
 
-	free_object_ids.reserve(65535);
-	for (int i = 65535; i > 0; i--) {
-		free_object_ids.push_back(uint16_t(i));
+		obj->region = to;
+		migrations++;
 	}
 }
 
 World::~World() {
-    dispatcher->release();
-    scene->release();
+	for (auto& r : regions) {
+		r.ctm->release();
+		r.scene->release();
+	}
+    if (ownsDispatcher) dispatcher->release();
 
-	for (auto& obj : trashQ) delete obj;
-	for (auto& obj : objects) delete obj;
+	// Primitives go with the slab
+	for (auto& t : trashQ) delete t.obj;
+	for (auto& obj : objects) if (!obj->handle) delete obj;
 }
 
-uint16_t World::assignID() {
-	if (free_object_ids.empty()) return 0;
+PrimitiveObject* World::place(PxRigidActor* actor) {
+	// Out of IDs, the actor never made it into a scene
+	uint32_t handle;
+	auto ptr = primitives.create(handle, actor);
+	if (!ptr) {
+		actor->release();
+		return nullptr;
+	}
 
-	auto id = free_object_ids.back();
-	free_object_ids.pop_back();
-	used_obj_masks[id] = 1;
-	return id;
+	// Constructed first, static copies take the actor's userData
+	ptr->handle = handle;
+	ptr->region = insert(actor);
+	objects.push_back(ptr);
+	return ptr;
 }
 
 void World::initScene() {
 	addObject<PrimitiveObject>(PxCreatePlane(*physics, PxPlane(0, 1, 0, 0), *shared_mat));
 }
 
-void World::spawn(Player* player) {
+PxCapsuleControllerDesc World::controllerDesc(Player* player, const PxExtendedVec3& position) {
 	PxCapsuleControllerDesc desc;
 
 	desc.material = shared_mat;
@@ -137,13 +422,20 @@ void World::spawn(Player* player) {
 	desc.contactOffset = 0.05f;
 	desc.stepOffset = 0.2f;
 	desc.userData = player;
-	desc.position = PxExtendedVec3(25.f, 25.f, 25.f);
+	desc.position = position;
+	return desc;
+}
+
+void World::spawn(Player* player, const PxVec3& position) {
+	auto desc = controllerDesc(player, PxExtendedVec3(position.x, position.y, position.z));
 
 	{
-		PxSceneWriteLock lock(*scene);
-		player->ct = ctm->createController(desc);
+		RegionLock lock(*this, true);
+		player->region = regions.size() > 1 ? regionAt(position) : 0;
+		player->ct = regions[player->region].ctm->createController(desc);
 		player->actor = player->ct->getActor();
 		player->actor->userData = player;
+		setGroup(player->actor, GROUP_PLAYER);
 	}
 
 	player->state.ground = false;
@@ -158,6 +450,9 @@ void World::spawn(Player* player) {
 	{
 		scoped_lock lock(player_mutex);
 		players.push_back(player);
+
+		player->netPhase = netStagger ? netCursor++ : 0;
+		netWheel.schedule(player, netDelay(player));
 	}
 
 	printf("[world] spawned player 0x%p\n", player);
@@ -165,190 +460,559 @@ void World::spawn(Player* player) {
 
 void World::updatePlayers(float dt) {
 	scoped_lock lock(player_mutex);
+	stepDt = dt;
 
+	// Take this step's input first, moves below only touch the scene
+	moves.clear();
 	for (auto& player : players) {
-		PlayerInput input; 
-		
-		{
-			scoped_lock lock(player->input_mutex);
-			input = player->input;
-		}
+		Player::QueuedInput next;
+		// Queued up faster than we step, catch up rather than lag further behind
+		while (player->inputs.size() > Player::INPUT_BACKLOG) player->inputs.pop(next);
 
-		if (!input.dir.isFinite()) input.dir = PxZero;
-		PxVec3 dir(input.dir.x, 0, input.dir.y);
+		if (player->inputs.pop(next)) {
+			player->lastInput = next.input;
+			player->inputSeq = next.seq;
+		} else if (!player->holdInput) continue;
 
-		auto len = dir.normalize();
-		if (!len) dir = PxVec3(1, 0, 0);
+		auto movement = movement::intent(player->lastInput, player->state, tick);
+		moves.push_back({ player, movement * dt });
+	}
 
-		PxVec3 side = dir.cross(PxVec3(0, 1, 0));
+	if (controllers.parallel && regions.size() > 1 && moves.size() >= controllers.minPlayers) {
+		moveParallel(dt);
+	} else {
+		RegionLock lock(*this, true);
+		for (auto& m : moves) move(m, dt);
+	}
 
-		float ws = 0.f, ad = 0.f;
-		if (input.movL) ad += -1.f;
-		if (input.movR) ad += 1.f;
-		if (input.movB) ws += -1.f;
-		if (input.movF) ws += 1.f;
+	// Batched write back
+	for (auto& m : moves) {
+		auto down = bool(m.flags & PxControllerCollisionFlag::eCOLLISION_DOWN);
+		movement::land(m.player->state, PxVec3(m.position.x, m.position.y, m.position.z), down, tick);
+	}
+}
 
-		auto& state = player->state;
-		if (input.jump && state.ground && !state.velocity.y) {
-			state.velocity.y = 15.f;
-		}
+void World::move(PlayerMove& m, float dt) {
+	static const PxControllerFilters ctFilters(0);
 
-		PxVec3 movement;
+	m.flags = m.player->ct->move(m.movement, 0.f, dt, ctFilters);
+	m.position = m.player->ct->getPosition();
+}
 
-		if (state.ground) {
-			constexpr float moveSpeed = 5.f;
-			movement = (ws * dir + ad * side).getNormalized() * moveSpeed;
+void World::MoveTask::run() {
+	// A controller only touches the scene of its own region, and no other task has that region
+	for (auto r : regions) {
+		PxSceneWriteLock lock(*world->regions[r].scene);
+		for (auto i : world->regionMoves[r]) world->move(world->moves[i], world->moveDt);
+	}
+}
 
-			auto airTick = tick - state.lastGroundTick;
-			auto fallV = airTick * (1.f / 15) * -9.81f;
+void World::moveParallel(float dt) {
+	regionMoves.resize(regions.size());
+	for (auto& list : regionMoves) list.clear();
+	for (uint32_t i = 0; i < moves.size(); i++) regionMoves[moves[i].player->region].push_back(i);
 
-			movement.y = state.velocity.y + fallV;
+	// Busiest region first onto the least loaded task
+	vector<std::pair<uint32_t, uint16_t>> busy; // players, region
+	for (uint16_t r = 0; r < regions.size(); r++) {
+		if (!regionMoves[r].empty()) busy.push_back({ uint32_t(regionMoves[r].size()), r });
+	}
+	std::sort(busy.begin(), busy.end(), std::greater<>());
+
+	// Tick thread takes a share too
+	auto taskCount = std::min<uint32_t>(dispatcher->getWorkerCount() + 1, uint32_t(busy.size()));
+	if (moveTasks.size() < taskCount) moveTasks.resize(taskCount);
+	for (uint32_t t = 0; t < taskCount; t++) moveTasks[t].regions.clear();
+
+	vector<uint32_t> load(taskCount, 0);
+	for (auto& [size, r] : busy) {
+		auto t = uint32_t(std::min_element(load.begin(), load.end()) - load.begin());
+		load[t] += size;
+		moveTasks[t].regions.push_back(r);
+	}
 
-			state.velocity.x = movement.x;
-			state.velocity.z = movement.z;
-		} else {
+	atomic<uint32_t> pending = taskCount ? taskCount - 1 : 0;
+	moveDt = dt;
 
-			auto airTick = tick - state.lastGroundTick;
-			auto fallV = airTick * (1.f / 15) * -9.81f;
+	for (uint32_t t = 0; t < taskCount; t++) {
+		moveTasks[t].world = this;
+		moveTasks[t].pending = &pending;
+		if (t) dispatcher->submitTask(moveTasks[t]);
+	}
 
-			movement.y = state.velocity.y + fallV;
-			movement.x = state.velocity.x;
-			movement.z = state.velocity.z;
-		}
+	if (taskCount) moveTasks[0].run();
 
-		static const PxControllerFilters ctFilters(0);
+	while (pending.load()) std::this_thread::yield();
+}
 
-		PxSceneWriteLock lock(*scene);
-		auto flags = player->ct->move(movement * dt, 0.f, dt, ctFilters);
+size_t World::updateNet(float) {
+	scoped_lock pl(player_mutex);
 
-		auto pos = player->ct->getPosition();
-		state.position = PxVec3(pos.x, pos.y, pos.z);
+	return netWheel.advance(tick, [&](Player* player) {
+		// Destroyed, still allocated until well after its last slot (TRASH_TICKS)
+		if (player->released) return;
 
-		if (flags & PxControllerCollisionFlag::eCOLLISION_DOWN) {
-			state.ground = true;
-			state.velocity.y = 0;
-			state.lastGroundTick = tick;
-		} else {
-			state.ground = false;
-		}
-	}
+		RegionLock sl(*this, false);
+		player->updateState(this);
+		netWheel.schedule(player, netDelay(player));
+	});
 }
 
-void World::updateNet(float) {
+size_t World::playerCount() {
 	scoped_lock pl(player_mutex);
+	return players.size();
+}
 
-	for (auto& player : players) {
-		PxSceneReadLock sl(*scene);
-		player->updateState(this);
+bool World::settled() {
+	if (playerCount()) return false;
+	{
+		scoped_lock ql(query_mutex);
+		if (!queuedQueries.empty()) return false;
+	}
+
+	RegionLock sl(*this, false);
+	scoped_lock ol(object_mutex);
+	for (auto obj : objects) {
+		auto dynamic = obj->actor ? obj->actor->is<PxRigidDynamic>() : nullptr;
+		if (dynamic && !obj->frozen && !dynamic->isSleeping()) return false;
 	}
+	return true;
+}
+
+Player* World::findPlayer(uint32_t pid) {
+	scoped_lock pl(player_mutex);
+	for (auto player : players) if (player->pid == pid) return player;
+	return nullptr;
 }
 
 void World::destroy(Player* player) {
 	player->release();
 
+	// Not in objects while parked, gc still has to trash it
+	if (player->parked) {
+		scoped_lock ol(object_mutex);
+		objects.push_back(player);
+	}
+
 	scoped_lock lock(player_mutex);
 	players.remove(player);
 
 	printf("[world] destroyed player 0x%p\n", player);
 }
 
-static std::random_device rd;
-static std::mt19937 gen(rd());
-static std::uniform_real_distribution<float> dist(-15, 15);
-static std::uniform_real_distribution<float> size_dist(1.f, 1.5f);
+bool World::park(Player* player) {
+	scoped_lock lock(player->world_mutex);
+	if (player->released || player->parked || !player->ct) return false;
 
-static uint16_t objCount = 0;
+	{
+		RegionLock sl(*this, true);
+		player->ct->release();
+		player->ct = nullptr;
+		player->actor = nullptr;
+	}
+
+	{
+		scoped_lock ol(object_mutex);
+		objects.erase(std::remove(objects.begin(), objects.end(), player), objects.end());
+	}
+
+	{
+		scoped_lock pl(player_mutex);
+		players.remove(player);
+	}
+
+	player->parked = true;
+	printf("[world] parked player 0x%p\n", player);
+	return true;
+}
+
+bool World::unpark(Player* player) {
+	scoped_lock lock(player->world_mutex);
+	if (player->released || !player->parked) return false;
+
+	auto& p = player->state.position;
+	auto desc = controllerDesc(player, PxExtendedVec3(p.x, p.y, p.z));
+
+	{
+		RegionLock sl(*this, true);
+		player->region = regions.size() > 1 ? regionAt(p) : 0;
+		player->ct = regions[player->region].ctm->createController(desc);
+		player->actor = player->ct->getActor();
+		player->actor->userData = player;
+		setGroup(player->actor, GROUP_PLAYER);
+	}
+
+	{
+		scoped_lock ol(object_mutex);
+		objects.push_back(player);
+	}
+
+	// Still on the wheel from before
+	{
+		scoped_lock pl(player_mutex);
+		players.push_back(player);
+	}
+
+	player->parked = false;
+	printf("[world] unparked player 0x%p\n", player);
+	return true;
+}
+
+PrimitiveObject* World::addRemote(const PxGeometry& geometry, const PxTransform& pose) {
+	auto body = physics->createRigidDynamic(pose);
+	body->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+	PxRigidActorExt::createExclusiveShape(*body, geometry, *shared_mat);
+
+	auto obj = addObject<PrimitiveObject>(body);
+	if (obj) obj->remote = true;
+	return obj;
+}
+
+static constexpr uint8_t shapes[] = { BOX_T, SPH_T, CPS_T };
 
 void World::step(float dt, bool blocking) {
 	// Add cubes
 	{
-		PxSceneWriteLock sl(*scene);
+		RegionLock sl(*this, true);
 		scoped_lock ol(object_mutex);
 
-#ifdef _DEBUG
-		constexpr uint16_t TOTAL_OBJ = 10;
-#else
-		constexpr uint16_t TOTAL_OBJ = 5000;
-#endif
-
-		if (objCount < TOTAL_OBJ) {
-			for (auto i = 0; i < std::max(1, TOTAL_OBJ / 1000); i++) {
+		if (housekeeping && spawned < spawner.total) {
+			for (auto i = 0; i < spawner.perTick && spawned < spawner.total; i++) {
 				auto size = 0.5f * powf(size_dist(gen), 3.f);
-				auto box = PxCreateDynamic(*physics, PxTransform(
-					PxVec3(dist(gen) * 2, 50.f, dist(gen) * 2)),
-					PxBoxGeometry(size, size, size), *shared_mat, 5.0f);
-				box->setAngularDamping(0.2f);
-				box->setLinearVelocity(PxVec3(size * dist(gen), size * dist(gen) * 4 + 40.f, size * dist(gen)));
-				box->setMaxLinearVelocity(size * 100.f);
+				auto pose = PxTransform(spawner.center + PxVec3(dist(gen) * 2, 50.f, dist(gen) * 2));
+
+				auto shape = spawner.shape;
+				if (shape == UNK_T) shape = shapes[shape_dist(gen)];
 
-				auto obj = addObject<PrimitiveObject, false>(box);
+				PxRigidDynamic* body;
+				if (shape == SPH_T) {
+					body = PxCreateDynamic(*physics, pose, PxSphereGeometry(size), *shared_mat, 5.0f);
+				} else if (shape == CPS_T) {
+					body = PxCreateDynamic(*physics, pose, PxCapsuleGeometry(size * 0.5f, size), *shared_mat, 5.0f);
+				} else {
+					body = PxCreateDynamic(*physics, pose, PxBoxGeometry(size, size, size), *shared_mat, 5.0f);
+				}
 
-				objCount++;
+				body->setAngularDamping(0.2f);
+				body->setLinearVelocity(PxVec3(size * dist(gen), size * dist(gen) * 4 + 40.f, size * dist(gen)));
+				body->setMaxLinearVelocity(size * 100.f);
+
+				if (addObject<PrimitiveObject, false>(body)) spawned++;
 			}
 		}
 	}
 
 	// Remove dead cubes
-	{
-		PxSceneReadLock sl(*scene);
+	if (housekeeping) {
+		RegionLock sl(*this, false);
 		scoped_lock ol(object_mutex);
 
 		for (auto& obj : objects) {
-			if (obj->isPlayer()) continue;
+			if (obj->isPlayer() || obj->remote || obj->frozen) continue;
 
 			auto dynamic = obj->actor->is<PxRigidDynamic>();
 			if (!dynamic) continue;
 			if (dynamic->isSleeping()) {
-				if (obj->release()) objCount--;
+				if (obj->release()) spawned--;
 			}
 		}
 	}
 
-	// Simulate
+	// Freeze what no player is near, thaw what one came close to
+	if ((activation.enabled || frozenCount) && tick % std::max(1u, activation.every) == 0) updateActivation();
+
+	// Simulate, regions all at once on the dispatcher
 	{
-		PxSceneWriteLock sl(*scene);
-		scene->simulate(1 / 60.f); // ???
+		RegionLock sl(*this, true);
+		if (regions.size() > 1) updateGhosts();
+		for (auto& r : regions) r.scene->simulate(dt);
 		tick++;
 	}
 
 	if (blocking) syncSim();
 }
 
+uint64_t World::cellKey(float x, float z) {
+	auto cx = int32_t(floorf(x / activation.cellSize));
+	auto cz = int32_t(floorf(z / activation.cellSize));
+	return uint64_t(uint32_t(cx)) << 32 | uint32_t(cz);
+}
+
+void World::updateActivation() {
+	observers.clear();
+	activeCells.clear();
+	{
+		scoped_lock pl(player_mutex);
+		for (auto p : players) observers.push_back(p->state.position);
+	}
+
+	// Every cell that has a point within radius of someone
+	auto cell = activation.cellSize;
+	auto r = activation.radius;
+	for (auto& p : observers) {
+		auto x0 = floorf((p.x - r) / cell), x1 = floorf((p.x + r) / cell);
+		auto z0 = floorf((p.z - r) / cell), z1 = floorf((p.z + r) / cell);
+		for (auto cx = x0; cx <= x1; cx++) {
+			for (auto cz = z0; cz <= z1; cz++) {
+				auto dx = std::max(0.f, std::max(cx * cell - p.x, p.x - (cx + 1) * cell));
+				auto dz = std::max(0.f, std::max(cz * cell - p.z, p.z - (cz + 1) * cell));
+				if (dx * dx + dz * dz > r * r) continue;
+				activeCells.insert(uint64_t(uint32_t(int32_t(cx))) << 32 | uint32_t(int32_t(cz)));
+			}
+		}
+	}
+
+	RegionLock sl(*this, true);
+	scoped_lock ol(object_mutex);
+
+	for (auto obj : objects) {
+		if (obj->isPlayer() || obj->remote || obj->released || !obj->actor) continue;
+		auto body = obj->actor->is<PxRigidDynamic>();
+		if (!body) continue;
+
+		auto p = body->getGlobalPose().p;
+		bool active = !activation.enabled || activeCells.count(cellKey(p.x, p.z));
+
+		if (active && obj->frozen) thaw(obj, body);
+		else if (!active && !obj->frozen) freeze(obj, body);
+		else if (!active && !activation.kinematic && !body->isSleeping()) body->putToSleep(); // bumped awake
+	}
+}
+
+void World::freeze(WorldObject* obj, PxRigidDynamic* body) {
+	frozenState[obj] = { body->getLinearVelocity(), body->getAngularVelocity() };
+	if (activation.kinematic) body->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+	else body->putToSleep();
+
+	obj->frozen = true;
+	frozenCount++;
+	freezes++;
+}
+
+void World::thaw(WorldObject* obj, PxRigidDynamic* body) {
+	// Whichever way it was frozen, the mode may have changed since
+	if (body->getRigidBodyFlags() & PxRigidBodyFlag::eKINEMATIC) body->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, false);
+
+	auto it = frozenState.find(obj);
+	if (it != frozenState.end()) {
+		body->setLinearVelocity(it->second.linear);
+		body->setAngularVelocity(it->second.angular);
+		frozenState.erase(it);
+	}
+	body->wakeUp();
+
+	obj->frozen = false;
+	frozenCount--;
+	thaws++;
+}
+
 void World::gc() {
 
 	scoped_lock ol(object_mutex);
-	// Actual deallocation happens 1 tick after "gc", 
-	// so player onTick function can still have access to the "freed" object
-	for (auto& ptr : trashQ) {
-		// Made sure this ID is not used immediated for the tick between remove & cleanup ((and not 0))
-		if (ptr->id) free_object_ids.push_back(ptr->id);
-		delete ptr;
+	// Players are deleted TRASH_TICKS after "gc", the net wheel can still look at a "freed" one
+	size_t expired = 0;
+	while (expired < trashQ.size() && trashQ[expired].tick + TRASH_TICKS <= tick) {
+		delete trashQ[expired++].obj;
 	}
-	trashQ.clear();
+	trashQ.erase(trashQ.begin(), trashQ.begin() + expired);
 
-	PxSceneWriteLock sl(*scene);
+	RegionLock sl(*this, true);
 
 	objects.erase(std::remove_if(objects.begin(), objects.end(), [&](WorldObject*& obj) {
 		if (obj->released.load()) {
+			if (obj->frozen) {
+				frozenState.erase(obj);
+				frozenCount--;
+			}
+
 			// requires scene lock
 			if (obj->actor && obj->actor->isReleasable()) {
 				obj->actor->release();
 				obj->actor = nullptr;
 			}
 
-			used_obj_masks[obj->id] = 0;
-
-			// Push to trash queue to clean up in next tick
-			trashQ.push_back(obj);
+			// Primitives go back to the slab now, encoders see the generation move on. The ID
+			// can be handed out again this tick, it's removed before it's added in any snapshot
+			if (obj->handle) primitives.destroy(obj->handle);
+			else trashQ.push_back({ tick, obj });
 			return true;
 		} else return false;
 	}), objects.end());
 }
 
 void World::syncSim() {
-	PxSceneWriteLock sl(*scene);
-	scene->fetchResults(true);
+	RegionLock sl(*this, true);
+	for (auto& r : regions) r.scene->fetchResults(true);
+	if (regions.size() > 1) migrate();
 
 	// printf("%lu contacting pairs\n", contacting.load());
 	contacting = 0;
 }
+
+void World::recordHistory() {
+	if (!history.capacity()) return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	auto frame = history.acquire();
+	frame->clear();
+
+	// Snapshots are encoded after the next step, so they carry these poses with tick + 1
+	frame->tick = tick + 1;
+	frame->time = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	{
+		RegionLock sl(*this, false);
+		scoped_lock ol(object_mutex);
+
+		for (auto obj : objects) {
+			if (!obj->actor || obj->released) continue;
+
+			// Everything in this world has exactly one shape
+			PxShape* shape;
+			if (!obj->actor->getShapes(&shape, 1)) continue;
+
+			auto pid = obj->isPlayer() ? static_cast<Player*>(obj)->pid : 0;
+			frame->add(obj->id, pid, obj->actor->getGlobalPose() * shape->getLocalPose(), shape->getGeometry());
+		}
+	}
+
+	frame->build();
+	history.publish(frame);
+
+	timing.history.store(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+}
+
+bool World::rewindRaycast(uint64_t t, const PxVec3& origin, const PxVec3& dir, float maxDist,
+	PoseFrame::RaycastHit& hit, uint32_t ignorePid) {
+	auto frame = history.at(t);
+	return frame && frame->raycast(origin, dir, maxDist, hit, ignorePid);
+}
+
+size_t World::rewindOverlap(uint64_t t, const PxGeometry& geometry, const PxTransform& pose,
+	vector<uint16_t>& ids, vector<uint32_t>& pids, uint32_t ignorePid) {
+	auto frame = history.at(t);
+	if (!frame) return 0;
+
+	vector<const PoseFrame::Entry*> hits;
+	frame->overlap(geometry, pose, hits, ignorePid);
+	for (auto e : hits) {
+		ids.push_back(e->id);
+		pids.push_back(e->pid);
+	}
+	return hits.size();
+}
+
+void World::submit(QueryBatch* batch) {
+	batch->done = false;
+
+	scoped_lock lock(query_mutex);
+	queuedQueries.push_back(batch);
+}
+
+void World::QueryTask::run() {
+	RegionLock lock(*world, false);
+
+	uint32_t job;
+	while ((job = world->nextQueryJob++) < world->queryJobs.size()) world->runQueryJob(world->queryJobs[job]);
+}
+
+void World::runQueryJob(const QueryJob& job) {
+	auto& b = *job.batch;
+	auto flags = PxHitFlags(PxHitFlag::eDEFAULT);
+
+	for (uint32_t i = job.first; i < job.first + job.count; i++) {
+		// Regions are queried one after the other, closest block wins (ghosts aren't query shapes)
+		if (job.kind == QueryJob::RAYCAST) {
+			auto& q = b.raycasts[i];
+			for (auto& r : regions) {
+				PxRaycastBuffer buf;
+				if (r.scene->raycast(q.origin, q.dir, q.distance, buf, flags, b.filter) && buf.hasBlock &&
+					(!b.raycastHits[i].actor || buf.block.distance < b.raycastHits[i].distance)) b.raycastHits[i] = buf.block;
+			}
+		} else if (job.kind == QueryJob::SWEEP) {
+			auto& q = b.sweeps[i];
+			for (auto& r : regions) {
+				PxSweepBuffer buf;
+				if (r.scene->sweep(q.geometry.any(), q.pose, q.dir, q.distance, buf, flags, b.filter) && buf.hasBlock &&
+					(!b.sweepHits[i].actor || buf.block.distance < b.sweepHits[i].distance)) b.sweepHits[i] = buf.block;
+			}
+		} else {
+			// Every overlap is a touch, written straight into the batch's slots for this query
+			auto& q = b.overlaps[i];
+			auto filter = b.filter;
+			filter.flags |= PxQueryFlag::eNO_BLOCK;
+			auto slots = b.overlapHits.data() + size_t(i) * b.maxOverlapHits;
+			uint32_t count = 0;
+
+			for (auto& r : regions) {
+				if (count == b.maxOverlapHits) break;
+				PxOverlapBuffer buf(slots + count, b.maxOverlapHits - count);
+				r.scene->overlap(q.geometry.any(), q.pose, buf, filter);
+
+				// Statics are in every region, keep the first copy only
+				for (PxU32 t = 0; t < buf.getNbTouches(); t++) {
+					auto hit = slots[count + t];
+					bool seen = false;
+					for (uint32_t k = 0; k < count && !seen; k++) seen = slots[k].actor->userData == hit.actor->userData;
+					if (!seen) slots[count++] = hit;
+				}
+			}
+			b.overlapCounts[i] = count;
+		}
+	}
+}
+
+void World::runQueries() {
+	{
+		scoped_lock lock(query_mutex);
+		runningQueries.swap(queuedQueries);
+	}
+	if (runningQueries.empty()) return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	queryJobs.clear();
+	for (auto batch : runningQueries) {
+		batch->raycastHits.assign(batch->raycasts.size(), PxRaycastHit());
+		batch->sweepHits.assign(batch->sweeps.size(), PxSweepHit());
+		batch->overlapHits.resize(batch->overlaps.size() * batch->maxOverlapHits);
+		batch->overlapCounts.assign(batch->overlaps.size(), 0);
+
+		auto split = [&](QueryJob::Kind kind, size_t n) {
+			for (uint32_t i = 0; i < n; i += QUERY_CHUNK) {
+				queryJobs.push_back({ batch, kind, i, std::min<uint32_t>(QUERY_CHUNK, uint32_t(n - i)) });
+			}
+		};
+		split(QueryJob::RAYCAST, batch->raycasts.size());
+		split(QueryJob::SWEEP, batch->sweeps.size());
+		split(QueryJob::OVERLAP, batch->overlaps.size());
+	}
+
+	// Same as moveParallel, the tick thread takes a share too
+	auto taskCount = std::min<uint32_t>(dispatcher->getWorkerCount() + 1, uint32_t(queryJobs.size()));
+	if (queryTasks.size() < taskCount) queryTasks.resize(taskCount);
+
+	atomic<uint32_t> pending = taskCount ? taskCount - 1 : 0;
+	nextQueryJob = 0;
+
+	for (uint32_t t = 0; t < taskCount; t++) {
+		queryTasks[t].world = this;
+		queryTasks[t].pending = &pending;
+		if (t) dispatcher->submitTask(queryTasks[t]);
+	}
+
+	if (taskCount) queryTasks[0].run();
+
+	while (pending.load()) std::this_thread::yield();
+
+	// Moved out first, onDone is free to submit the batch again
+	vector<QueryBatch*> finished;
+	finished.swap(runningQueries);
+	for (auto batch : finished) {
+		if (batch->onDone) batch->onDone(*batch);
+		else batch->done = true;
+	}
+
+	timing.queries.store(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+}
@@ -11,7 +11,16 @@
 #include <vector>
 #include <mutex>
 #include <bitset>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 #include "../network/protocol/common.hpp"
+#include "../misc/ring.hpp"
+#include "../misc/wheel.hpp"
+#include "../misc/slab.hpp"
+#include "history.hpp"
+#include "queries.hpp"
 
 using namespace physx;
 
@@ -28,6 +37,11 @@ class World;
 struct WorldObject {
     atomic<bool> released;
     uint16_t id;
+    uint32_t handle = 0; // generation << 16 | id for primitives (see World::resolve), players have none
+    uint16_t region = 0; // which region's scene the actor is in
+    bool remote = false; // kinematic mirror of something another shard simulates, see ShardNode
+    uint32_t remoteOf = 0; // pid of the local player a remote capsule stands in for, hidden from them
+    bool frozen = false; // no player near, kinematic or asleep until one comes close (see ActivationConfig)
     PxRigidActor* actor;
 
     virtual bool isPrimitive() = 0;
@@ -38,8 +52,8 @@ struct WorldObject {
         return released.compare_exchange_weak(expected, true);
     }
 
-    WorldObject(uint16_t id) : id(id), actor(nullptr), released(false) {};
-    WorldObject(uint16_t id, PxRigidActor* actor) : id(id), actor(actor), released(false) {
+    WorldObject(uint16_t id) : released(false), id(id), actor(nullptr) {};
+    WorldObject(uint16_t id, PxRigidActor* actor) : released(false), id(id), actor(actor) {
         actor->userData = this;
     }
     virtual ~WorldObject() {};
@@ -55,9 +69,24 @@ struct Player : WorldObject {
     uint32_t pid = 0;
 
     mutex world_mutex;
-    mutex input_mutex;
 
-    PlayerInput input;
+    // Inputs in seq order, written by the network side (or the player itself), the world thread
+    // applies one per step. The client predicted exactly one step per input, so an empty queue
+    // means the player doesn't move that step (unless holdInput) and nothing gets applied twice
+    static constexpr size_t INPUT_QUEUE = 64;
+    static constexpr size_t INPUT_BACKLOG = 8; // more queued than this, the oldest are dropped
+    struct QueuedInput {
+        uint32_t seq;
+        PlayerInput input;
+    };
+    Ring<QueuedInput> inputs = Ring<QueuedInput>(INPUT_QUEUE);
+    uint32_t postedSeq = 0;  // producer only
+    PlayerInput lastInput;   // the one inputSeq is, tick thread only
+    uint32_t inputSeq = 0;   // seq of the input the last step applied
+    bool holdInput = false;  // steps with nothing queued repeat lastInput (server side bots)
+    uint32_t netEvery = 0; // steps between snapshots, 0 follows World::netEvery. Tick thread only
+    uint32_t netPhase = 0; // offset within any interval, spreads players over the steps
+    bool parked = false;   // out of the simulation but still sent snapshots, see World::park
     PlayerState state;
     PxController* ct;
 
@@ -70,36 +99,251 @@ struct Player : WorldObject {
         ct = nullptr;
     }
 
+    // Single producer. False for a seq that isn't newer than the last one (duplicate or
+    // reordered) or when the queue is full
+    bool postInput(const PlayerInput& input, uint32_t seq) {
+        if (seq <= postedSeq || !inputs.push({ seq, input })) return false;
+        postedSeq = seq;
+        return true;
+    }
+
     // Need to be called from the world thread
     virtual void updateState(World* world) = 0;
 
     Player() : WorldObject(0), ct(nullptr) {};
 };
 
+// Cube spawner settings, shape is one of BOX_T, SPH_T, CPS_T or UNK_T for a random mix
+struct SpawnConfig {
+#ifdef _DEBUG
+    uint16_t total = 10;
+#else
+    uint16_t total = 5000;
+#endif
+    uint16_t perTick = std::max(1, total / 1000);
+    uint8_t shape = BOX_T;
+    PxVec3 center = PxVec3(PxZero); // cubes drop around here and players join next to it
+};
+
+// Character controller updates. A move writes to its scene, so it needs that scene's write lock:
+// with regions (PartitionConfig), each region's players are moved on the physx dispatcher under
+// their own region's lock, side by side with the other regions. One region moves serially
+struct ControllerConfig {
+    bool parallel = true;
+    uint32_t minPlayers = 64; // below this the serial loop is cheaper
+};
+
+// Optional split of the world into a grid of regions over XZ, each with its own scene and
+// controller manager, simulated side by side on the world's dispatcher. Objects live in the region
+// their center is in and migrate when they cross (margin / 4 past the border, so they don't flap).
+// Anything within margin of a neighbour also gets a kinematic ghost there: it pushes, but never
+// gets pushed back, and isn't reported or queried. Statics are copied into every region
+struct PartitionConfig {
+    uint32_t cols = 1;
+    uint32_t rows = 1;
+    float size = 64.f;  // region edge, the grid is centered on the origin and the outer ring extends forever
+    float margin = 4.f; // ghost strip, should exceed the biggest half extent plus a step of travel
+};
+
+// Player-proximity activation. Every few steps the XZ plane is bucketed into cells and any cell
+// within radius of a player is active. Dynamic objects outside of them are frozen: switched to
+// kinematic (they stay put and still block), or with kinematic = false just put to sleep (a
+// neighbour can still wake them up until the next check). Their velocities are kept and given
+// back once a player comes close again. Off by default, the spawner drops cubes out of reach too
+struct ActivationConfig {
+    bool enabled = false;
+    bool kinematic = true;
+    float radius = 48.f;
+    float cellSize = 16.f;
+    uint32_t every = 10; // steps between checks
+};
+
+// Collision groups, PxFilterData::word0 of every shape. word1 holds the groups it wants contact
+// reports against, a pair is reported when either side asks for the other
+enum CollisionGroup : uint32_t {
+    GROUP_STATIC = 1 << 0,
+    GROUP_PRIMITIVE = 1 << 1,
+    GROUP_PLAYER = 1 << 2,
+    GROUP_ALL = (1 << 3) - 1
+};
+
+struct ContactEvent {
+    uint64_t tick;
+    uint16_t id[2];
+    uint32_t pid[2]; // players only, 0 otherwise
+    bool lost;       // touch lost, otherwise found
+    PxVec3 point;    // first contact point, zero when lost
+    PxVec3 normal;
+    float impulse;
+};
+
 class World : public PxSimulationEventCallback {
     friend PhysXServer;
+    friend class ShardNode;
+    friend class SimBus;
+    friend class SnapshotEncoder;
+    friend struct BotPlayer;
 
     PxDefaultCpuDispatcher* dispatcher;
-    PxScene* scene;
+    bool ownsDispatcher;
+    PxScene* scene; // region 0
     PxControllerManager* ctm;
+
+    struct Region {
+        PxScene* scene;
+        PxControllerManager* ctm;
+    };
+    vector<Region> regions;
+    PartitionConfig partitioning;
+
+    // Kinematic copies of objects near a border, by object and region (players all have id 0).
+    // Tick thread only
+    struct Ghost {
+        PxRigidDynamic* actor;
+        bool seen;
+    };
+    std::unordered_map<uint64_t, Ghost> ghosts;
+    // Primitives by handle (their memory is reused right away), players by address
+    static uint64_t ghostKey(const WorldObject* obj, uint16_t region) {
+        if (obj->handle) return 1ull << 63 | uint64_t(obj->handle) << 16 | region;
+        return uint64_t(uintptr_t(obj)) << 10 | region;
+    };
+    vector<PxRigidStatic*> staticCopies;
+
+    void createRegions(uint32_t count);
+    uint16_t regionAt(const PxVec3& p);
+    float outside(uint16_t region, const PxVec3& p); // distance outside the region's bounds on XZ
+    uint16_t insert(PxRigidActor* actor);             // adds to its region's scene (copies statics)
+    PxCapsuleControllerDesc controllerDesc(Player* player, const PxExtendedVec3& position);
+    void updateGhosts();
+    void migrate();
+
+    // Locks every region's scene in order, for anything that walks objects across regions
+    class RegionLock {
+        World& world;
+        bool write;
+    public:
+        RegionLock(World& world, bool write);
+        ~RegionLock();
+    };
     
     uint32_t id = 0;
     uint64_t tick = 0;
+    float stepDt = 0.f; // per input, clients predict with it (see getStep)
 
     mutex player_mutex;
     mutex object_mutex;
 
     list<Player*> players;
     vector<WorldObject*> objects;
-    vector<WorldObject*> trashQ;
 
-    vector<uint16_t> free_object_ids;
-    bitset<65536> used_obj_masks;
+    // Primitives live in the slab and go back to it at gc, whatever still holds their handle
+    // finds out from the generation. Released players are only deleted TRASH_TICKS after gc,
+    // the net wheel gets to see them gone first (the slowest rate is NET_EVERY_MAX)
+    static constexpr uint64_t TRASH_TICKS = 256;
+    struct Trash {
+        uint64_t tick;
+        WorldObject* obj;
+    };
+    vector<Trash> trashQ;
+
+    Slab<PrimitiveObject> primitives;
 
     PxMaterial* shared_mat;
 
+    // Spawner draws, per world since rooms step on several threads at once
+    std::mt19937 gen;
+    std::uniform_real_distribution<float> dist{ -15.f, 15.f };
+    std::uniform_real_distribution<float> size_dist{ 1.f, 1.5f };
+    std::uniform_int_distribution<int> shape_dist{ 0, 2 };
+    uint16_t spawned = 0;
+
     atomic<uint64_t> contacting = 0;
 
+    // Velocities of frozen objects, tick thread (step) and gc under object_mutex
+    struct Thaw {
+        PxVec3 linear;
+        PxVec3 angular;
+    };
+    std::unordered_map<WorldObject*, Thaw> frozenState;
+    std::unordered_set<uint64_t> activeCells;
+    vector<PxVec3> observers;
+
+    uint64_t cellKey(float x, float z);
+    void updateActivation();
+    void freeze(WorldObject* obj, PxRigidDynamic* body);
+    void thaw(WorldObject* obj, PxRigidDynamic* body);
+    PrimitiveObject* place(PxRigidActor* actor); // addObject, locks held
+
+    // Players by the tick their next snapshot is due, guarded by player_mutex
+    TimingWheel<Player*, 256> netWheel;
+    uint32_t netCursor = 0;
+
+    // Filled by onContact during fetchResults
+    Ring<ContactEvent> contacts = Ring<ContactEvent>(16384);
+    uint32_t reportMasks[3] = {}; // per group bit, what that group reports against
+
+    uint32_t reportMask(uint32_t group);
+    void setGroup(PxRigidActor* actor, uint32_t group);
+
+    // Scratch space for updatePlayers, reused between ticks
+    struct PlayerMove {
+        Player* player;
+        PxVec3 movement;
+        PxExtendedVec3 position;
+        PxControllerCollisionFlags flags;
+    };
+
+    class MoveTask : public PxBaseTask {
+    public:
+        World* world = nullptr;
+        vector<uint16_t> regions; // moved one after another, each under its write lock
+        atomic<uint32_t>* pending = nullptr;
+
+        void run() override;
+        void release() override { (*pending)--; };
+        const char* getName() const override { return "World.moveControllers"; };
+    };
+
+    vector<PlayerMove> moves;
+    vector<MoveTask> moveTasks;
+    vector<vector<uint32_t>> regionMoves; // indices into moves, by the player's region
+    float moveDt = 0.f;
+
+    void move(PlayerMove& m, float dt);
+    void moveParallel(float dt);
+
+    // Query service, batches are split into jobs that the dispatcher threads pull from
+    static constexpr uint32_t QUERY_CHUNK = 16;
+
+    struct QueryJob {
+        enum Kind : uint8_t { RAYCAST, SWEEP, OVERLAP };
+
+        QueryBatch* batch;
+        Kind kind;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    class QueryTask : public PxBaseTask {
+    public:
+        World* world = nullptr;
+        atomic<uint32_t>* pending = nullptr;
+
+        void run() override;
+        void release() override { (*pending)--; };
+        const char* getName() const override { return "World.queries"; };
+    };
+
+    mutex query_mutex;
+    vector<QueryBatch*> queuedQueries; // guarded by query_mutex
+    vector<QueryBatch*> runningQueries;
+    vector<QueryJob> queryJobs;
+    atomic<uint32_t> nextQueryJob = 0;
+    vector<QueryTask> queryTasks;
+
+    void runQueryJob(const QueryJob& job);
+
     void onConstraintBreak(PxConstraintInfo* , PxU32) override {}
     void onWake(PxActor**, PxU32) override {}
     void onSleep(PxActor**, PxU32) override {}
@@ -107,54 +351,132 @@ class World : public PxSimulationEventCallback {
     void onAdvance(const PxRigidBody* const*, const PxTransform*, const PxU32) override {}
     void onContact(const PxContactPairHeader& pairHeader, const PxContactPair* pairs, PxU32 nbPairs) override;
 public:
+    SpawnConfig spawner;
+    ControllerConfig controllers;
+    ActivationConfig activation; // turning it off thaws everything on the next step
+    bool housekeeping = true; // cube spawner and sleeping cube sweep, turned off under overload
+
+    // Snapshot rate in steps, per player unless Player::netEvery is set. netScale stretches every
+    // rate (overload). Each player sends on its own phase of the interval so encodes don't all
+    // land on the same step, netStagger = false (before spawning) lines them up instead
+    static constexpr uint32_t NET_EVERY_MAX = 255;
+    atomic<uint32_t> netEvery = 1;
+    atomic<uint32_t> netScale = 1;
+    bool netStagger = true;
+
+    uint32_t netInterval(const Player* player) {
+        auto every = (player->netEvery ? player->netEvery : netEvery.load()) * netScale.load();
+        return std::clamp<uint32_t>(every, 1, NET_EVERY_MAX);
+    }
+
+    // Steps from the wheel's tick to the player's next slot, 1 to netInterval
+    uint32_t netDelay(const Player* player) {
+        auto every = netInterval(player);
+        return every - (netWheel.now() + player->netPhase) % every;
+    }
+
+    // Pose of everything over the last 32 ticks for lag compensation, resize(0) turns it off
+    PoseHistory history;
+
     struct {
         atomic<float> update = 0.f;
         atomic<float> sim = 0.f;
+        atomic<float> history = 0.f;
+        atomic<float> queries = 0.f;
     } timing;
 
     static int init();
     static void cleanup();
 
-    World();
+    // Creates its own 4 thread dispatcher unless given one to share (released by whoever made it)
+    World(PxDefaultCpuDispatcher* shared = nullptr);
     ~World();
 
+    // Before initScene, false once anything was added. An own dispatcher grows to every core
+    bool partition(const PartitionConfig& config);
+    size_t regionCount() { return regions.size(); };
+    atomic<uint64_t> migrations = 0;
+
+    atomic<uint64_t> freezes = 0;
+    atomic<uint64_t> thaws = 0;
+    atomic<uint32_t> frozenCount = 0;
+
     void initScene();
 
-    // Assign object ID
-    uint16_t assignID();
+    // Reseed the spawner, worlds are seeded from std::random_device by default
+    void seed(uint32_t value) { gen.seed(value); };
+
+    // The object a handle was given out for, nullptr once gc took it back (object_mutex held,
+    // or the tick thread, which is the only one that frees)
+    PrimitiveObject* resolve(uint32_t handle) { return primitives.get(handle); };
 
-    // Assign an ID and add it to the list
+    // Allocate it from the slab (its index is the ID) and add it to the list. Out of IDs the
+    // actor is released and it returns nullptr
     template<typename T, bool lock = true>
     T* addObject(PxRigidActor* actor) {
+        static_assert(std::is_same_v<T, PrimitiveObject>, "only primitives are allocated by the world");
+        setGroup(actor, actor->is<PxRigidDynamic>() ? GROUP_PRIMITIVE : GROUP_STATIC);
+
         if constexpr (lock) {
-            PxSceneWriteLock sl(*scene);
+            RegionLock sl(*this, true);
             scoped_lock ol(object_mutex);
-
-            scene->addActor(*actor);
-            auto id = assignID();
-            if (!id) return nullptr;
-            auto ptr = new T(id, actor);
-            objects.push_back(ptr);
-            return ptr;
-        } else {
-            scene->addActor(*actor);
-            auto id = assignID();
-            if (!id) return nullptr;
-            auto ptr = new T(id, actor);
-            objects.push_back(ptr);
-            return ptr;
-        }
+            return place(actor);
+        } else return place(actor);
     }
 
-    void spawn(Player* player);
+    void spawn(Player* player, const PxVec3& position = PxVec3(25.f, 25.f, 25.f));
     void destroy(Player* player);
 
-    void updateNet(float dt);
+    // Tick thread. park takes a player out of the scene (and players) but keeps it on the net
+    // wheel, so its snapshots still go out while someone else writes its state. unpark puts it
+    // back at state.position. False if it was already parked or gone
+    bool park(Player* player);
+    bool unpark(Player* player);
+
+    // Kinematic object driven from outside (setKinematicTarget), flagged remote
+    PrimitiveObject* addRemote(const PxGeometry& geometry, const PxTransform& pose);
+
+    // Encodes every player that's due by now (wheel catches up over skipped steps), returns how many
+    size_t updateNet(float dt);
+    Player* findPlayer(uint32_t pid);
+    size_t playerCount();
+
+    // No players, no queued queries and every dynamic body asleep. After syncSim
+    bool settled();
     void updatePlayers(float dt);
 
     void gc();
     void step(float dt, bool blocking = true);
     void syncSim();
 
-    PxScene* getScene() { return scene; };
+    // Contacts between group (one or more GROUP_*) and any of against get reported from the next
+    // tick on. Nothing is reported by default, reporting every resting cube isn't free
+    void reportContacts(uint32_t group, uint32_t against);
+
+    // One consumer, after syncSim. Ids are valid until the next gc
+    template<typename F>
+    size_t drainContacts(F&& fn) { return contacts.drain(fn); };
+    atomic<uint64_t> contactsDropped = 0; // ring was full
+
+    // Any thread. The batch runs in the next query phase, see QueryBatch
+    void submit(QueryBatch* batch);
+
+    // After syncSim: runs every batch submitted so far on the dispatcher threads (and this one)
+    // under a shared read lock, then hands them back through onDone
+    void runQueries();
+
+    // After syncSim, copies every pose into the history and builds its BVH
+    void recordHistory();
+
+    // Queries against the world as the client saw the snapshot of that tick (see PoseFrame::tick),
+    // false/0 if the tick isn't in the history anymore. Safe from any thread
+    bool rewindRaycast(uint64_t tick, const PxVec3& origin, const PxVec3& dir, float maxDist,
+        PoseFrame::RaycastHit& hit, uint32_t ignorePid = 0);
+    size_t rewindOverlap(uint64_t tick, const PxGeometry& geometry, const PxTransform& pose,
+        vector<uint16_t>& ids, vector<uint32_t>& pids, uint32_t ignorePid = 0);
+
+    PxScene* getScene(size_t region = 0) { return regions[region].scene; };
+    uint64_t getTick() { return tick; };
+    // Seconds each input moves a player (the dt of the last updatePlayers), sent in every snapshot
+    float getStep() { return stepDt; };
 };
\ No newline at end of file